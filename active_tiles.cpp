@@ -0,0 +1,267 @@
+#include "active_tiles.hpp"
+#include "advect.hpp"
+#include "obstacles.hpp"
+#include "packed_fields.hpp"
+#include "utils.hpp"
+#include <cmath>
+
+ActiveTiles::ActiveTiles(int n, int tile)
+    : n_(n), tile_(clampTile(n, tile)), tiles_((n + tile_ - 1) / tile_),
+      active_(tiles_ * tiles_, 0), live_(active_.size(), 0), grown_(active_.size(), 0),
+      spans_(tiles_) {}
+
+void ActiveTiles::activateAll() {
+    std::fill(active_.begin(), active_.end(), 1);
+    activeCount_ = tiles_ * tiles_;
+    dropped_.clear();
+    rebuildSpans();
+}
+
+void ActiveTiles::touch(int i0, int j0, int i1, int j1) {
+    i0 = std::max(1, i0);
+    j0 = std::max(1, j0);
+    i1 = std::min(n_, i1);
+    j1 = std::min(n_, j1);
+    for (int tj = (j0 - 1) / tile_; tj <= (j1 - 1) / tile_; tj++) {
+        for (int ti = (i0 - 1) / tile_; ti <= (i1 - 1) / tile_; ti++) {
+            live_[ti + tiles_ * tj] = 1;
+        }
+    }
+}
+
+template <class Rows>
+void ActiveTiles::update(Rows u, Rows v, Rows dens, float epsilon, float dt0) {
+    Grid<0> IX{n_};
+    float maxVel = 0.0f;
+    for (int tj = 0; tj < tiles_; tj++) {
+        for (int ti = 0; ti < tiles_; ti++) {
+            int t = ti + tiles_ * tj;
+            if (!active_[t]) {
+                continue;
+            }
+            int i1 = std::min(n_, (ti + 1) * tile_);
+            int j1 = std::min(n_, (tj + 1) * tile_);
+            float vel = 0.0f, den = 0.0f;
+            for (int j = tj * tile_ + 1; j <= j1; j++) {
+                for (int i = ti * tile_ + 1; i <= i1; i++) {
+                    vel = std::max(vel, std::max(std::fabs(u[IX(i,j)]), std::fabs(v[IX(i,j)])));
+                    den = std::max(den, std::fabs(dens[IX(i,j)]));
+                }
+            }
+            if (vel > epsilon || den > epsilon) {
+                live_[t] = 1;
+            }
+            maxVel = std::max(maxVel, vel);
+        }
+    }
+
+    // Grow the live set by `halo` tiles in each direction, rows then columns.
+    int halo = std::min(tiles_, 1 + (int)std::ceil(dt0 * maxVel / tile_));
+    for (int tj = 0; tj < tiles_; tj++) {
+        for (int ti = 0; ti < tiles_; ti++) {
+            uint8_t any = 0;
+            for (int k = std::max(0, ti - halo); k <= std::min(tiles_ - 1, ti + halo) && !any; k++) {
+                any = live_[k + tiles_ * tj];
+            }
+            grown_[ti + tiles_ * tj] = any;
+        }
+    }
+    dropped_.clear();
+    activeCount_ = 0;
+    for (int tj = 0; tj < tiles_; tj++) {
+        for (int ti = 0; ti < tiles_; ti++) {
+            uint8_t any = 0;
+            for (int k = std::max(0, tj - halo); k <= std::min(tiles_ - 1, tj + halo) && !any; k++) {
+                any = grown_[ti + tiles_ * k];
+            }
+            int t = ti + tiles_ * tj;
+            if (active_[t] && !any) {
+                dropped_.push_back(t);
+            }
+            active_[t] = any;
+            activeCount_ += any;
+        }
+    }
+    std::fill(live_.begin(), live_.end(), 0);
+    rebuildSpans();
+}
+
+template <class Rows>
+void ActiveTiles::clearTile(int t, Rows x) const {
+    Grid<0> IX{n_};
+    int ti = t % tiles_;
+    int tj = t / tiles_;
+    // Extend onto the ghost ring where the tile touches the boundary.
+    int i0 = ti == 0 ? 0 : ti * tile_ + 1;
+    int j0 = tj == 0 ? 0 : tj * tile_ + 1;
+    int i1 = ti == tiles_ - 1 ? n_ + 1 : (ti + 1) * tile_;
+    int j1 = tj == tiles_ - 1 ? n_ + 1 : (tj + 1) * tile_;
+    for (int j = j0; j <= j1; j++) {
+        x.clear(IX(i0,j), IX(i1,j));
+    }
+}
+
+template <class Rows>
+void ActiveTiles::clearDropped(Rows x) const {
+    for (int t : dropped_) {
+        clearTile(t, x);
+    }
+}
+
+template <class Rows>
+void ActiveTiles::clearActive(Rows x) const {
+    for (int t = 0; t < tiles_ * tiles_; t++) {
+        if (active_[t]) {
+            clearTile(t, x);
+        }
+    }
+}
+
+void ActiveTiles::rebuildSpans() {
+    for (int tj = 0; tj < tiles_; tj++) {
+        std::vector<Span>& spans = spans_[tj];
+        spans.clear();
+        for (int ti = 0; ti < tiles_; ti++) {
+            if (!active_[ti + tiles_ * tj]) {
+                continue;
+            }
+            int first = ti * tile_ + 1;
+            int last = std::min(n_, (ti + 1) * tile_);
+            if (!spans.empty() && spans.back().last + 1 == first) {
+                spans.back().last = last;
+            } else {
+                spans.push_back({first, last});
+            }
+        }
+    }
+}
+
+template <class Rows>
+void sparse_add_source(const ActiveTiles& tiles, int n, Rows x, Rows s, float dt,
+                       float* lines) {
+    const int S = n + 2;
+    tiles.forEachSpan([&](int j, int first, int last) {
+        float* row = x.edit(j, lines, first, last);
+        const float* src = s.row(j, lines + S, first, last);
+        for (int i = first; i <= last; i++) {
+            row[i] += dt * src[i];
+        }
+        x.store(j, row, first, last);
+    });
+}
+
+template <class Rows>
+void sparse_lin_solve(const ActiveTiles& tiles, int n, int b, Rows x, Rows x0, float a,
+                      float c, int iters, float* lines, const ObstacleMap* solids) {
+    Grid<0> IX{n};
+    const int S = IX.stride();
+    for (int k = 0; k < iters; k++) {
+        tiles.forEachSpan([&](int j, int first, int last) {
+            const float ka = a;
+            const float kInvC = 1.0f / c;
+            const float* down = x.row(j - 1, lines, first, last);
+            float* row = x.edit(j, lines + S, first - 1, last + 1);
+            const float* up = x.row(j + 1, lines + 2 * S, first, last);
+            const float* rhs = x0.row(j, lines + 3 * S, first, last);
+            for (int i = first; i <= last; i++) {
+                if (solids && solids->solid(i, j)) {
+                    continue;
+                }
+                row[i] = (rhs[i] + ka * (row[i-1] + row[i+1] + down[i] + up[i])) * kInvC;
+            }
+            x.store(j, row, first, last);
+        });
+        if (solids) {
+            solids->apply(b, x);
+        }
+        set_bnd(IX, b, x);
+    }
+}
+
+template <class Rows>
+float sparse_advect(const ActiveTiles& tiles, int n, int b, Rows d, Rows d0, Rows u, Rows v,
+                    float dt, float* lines) {
+    Grid<0> IX{n};
+    float dt0 = dt * n;
+    float maxSq = 0.0f;
+    tiles.forEachSpan([&](int j, int first, int last) {
+        float* out = d.out(j, lines);
+        for (int i = first; i <= last; i++) {
+            maxSq = std::max(maxSq, u[IX(i,j)] * u[IX(i,j)] + v[IX(i,j)] * v[IX(i,j)]);
+            out[i] = advect_cell(IX, i, j, d0, u, v, dt0);
+        }
+        d.store(j, out, first, last);
+    });
+    set_bnd(IX, b, d);
+    return maxSq;
+}
+
+template <class Rows>
+void sparse_divergence(const ActiveTiles& tiles, int n, Rows u, Rows v, const Rows* p,
+                       Rows div, float* lines) {
+    Grid<0> IX{n};
+    const int S = IX.stride();
+    float h = 1.0f / n;
+    tiles.forEachSpan([&](int j, int first, int last) {
+        const float* ur = u.row(j, lines, first - 1, last + 1);
+        const float* down = v.row(j - 1, lines + S, first, last);
+        const float* up = v.row(j + 1, lines + 2 * S, first, last);
+        float* out = div.out(j, lines + 3 * S);
+        for (int i = first; i <= last; i++) {
+            out[i] = -0.5f * h * (ur[i+1] - ur[i-1] + up[i] - down[i]);
+        }
+        div.store(j, out, first, last);
+        if (p) p->clear(IX(first,j), IX(last,j));
+    });
+    set_bnd(IX, 0, div);
+    if (p) set_bnd(IX, 0, *p);
+}
+
+template <class Rows>
+void sparse_subtract_gradient(const ActiveTiles& tiles, int n, Rows u, Rows v, Rows p,
+                              float* lines) {
+    Grid<0> IX{n};
+    const int S = IX.stride();
+    float h = 1.0f / n;
+    tiles.forEachSpan([&](int j, int first, int last) {
+        const float* down = p.row(j - 1, lines, first, last);
+        const float* row = p.row(j, lines + S, first - 1, last + 1);
+        const float* up = p.row(j + 1, lines + 2 * S, first, last);
+        float* ur = u.edit(j, lines + 3 * S, first, last);
+        float* vr = v.edit(j, lines + 4 * S, first, last);
+        for (int i = first; i <= last; i++) {
+            ur[i] -= 0.5f * (row[i+1] - row[i-1]) / h;
+            vr[i] -= 0.5f * (up[i] - down[i]) / h;
+        }
+        u.store(j, ur, first, last);
+        v.store(j, vr, first, last);
+    });
+    set_bnd(IX, 1, u);
+    set_bnd(IX, 2, v);
+}
+
+// The two storages FluidSolver runs.
+template void ActiveTiles::update(FloatRows, FloatRows, FloatRows, float, float);
+template void ActiveTiles::clearDropped(FloatRows) const;
+template void ActiveTiles::clearActive(FloatRows) const;
+template void sparse_add_source(const ActiveTiles&, int, FloatRows, FloatRows, float, float*);
+template void sparse_lin_solve(const ActiveTiles&, int, int, FloatRows, FloatRows, float, float,
+                               int, float*, const ObstacleMap*);
+template float sparse_advect(const ActiveTiles&, int, int, FloatRows, FloatRows, FloatRows, FloatRows,
+                             float, float*);
+template void sparse_divergence(const ActiveTiles&, int, FloatRows, FloatRows, const FloatRows*,
+                                FloatRows, float*);
+template void sparse_subtract_gradient(const ActiveTiles&, int, FloatRows, FloatRows, FloatRows,
+                                       float*);
+template void ActiveTiles::update(PackedRows, PackedRows, PackedRows, float, float);
+template void ActiveTiles::clearDropped(PackedRows) const;
+template void ActiveTiles::clearActive(PackedRows) const;
+template void sparse_add_source(const ActiveTiles&, int, PackedRows, PackedRows, float, float*);
+template void sparse_lin_solve(const ActiveTiles&, int, int, PackedRows, PackedRows, float, float,
+                               int, float*, const ObstacleMap*);
+template float sparse_advect(const ActiveTiles&, int, int, PackedRows, PackedRows, PackedRows, PackedRows,
+                             float, float*);
+template void sparse_divergence(const ActiveTiles&, int, PackedRows, PackedRows, const PackedRows*,
+                                PackedRows, float*);
+template void sparse_subtract_gradient(const ActiveTiles&, int, PackedRows, PackedRows, PackedRows,
+                                       float*);
@@ -0,0 +1,104 @@
+#ifndef ACTIVE_TILES_HPP
+#define ACTIVE_TILES_HPP
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+class ObstacleMap;
+
+// Bitmap of the tile x tile blocks of an N x N grid that hold anything above
+// an epsilon. Cells of inactive tiles are kept at exactly zero in every
+// solver field, so the sparse kernels below only visit active tiles and the
+// cost of a step follows the active area instead of N^2.
+class ActiveTiles {
+public:
+    ActiveTiles(int n, int tile);
+
+    // The tile side actually used for a requested one: 1..N.
+    static int clampTile(int n, int tile) { return std::max(1, std::min(tile, n)); }
+
+    int tile() const { return tile_; }
+    int tiles() const { return tiles_; }   // per side
+    int activeCount() const { return activeCount_; }
+    bool active(int ti, int tj) const { return active_[ti + tiles_ * tj] != 0; }
+
+    // Marks every tile active; use when fields were written from outside.
+    void activateAll();
+    // Keeps the tiles overlapping interior cells [i0,i1] x [j0,j1] live
+    // through the next update(), e.g. where splats were stamped.
+    void touch(int i0, int j0, int i1, int j1);
+    // Rebuilds the bitmap: a tile is live if it was touched or any of u, v,
+    // dens exceeds epsilon in it, and live tiles wake every tile within the
+    // distance the fastest velocity can carry values in one step (dt0 =
+    // dt * N) plus one tile of halo for diffusion and pressure. Fields are
+    // row accessors, FloatRows or PackedRows, here and below.
+    template <class Rows>
+    void update(Rows u, Rows v, Rows dens, float epsilon, float dt0);
+    // Zeroes the cells, and adjacent ghost cells, of tiles the last update()
+    // deactivated. Must be applied to every field before the next sweep.
+    template <class Rows>
+    void clearDropped(Rows x) const;
+    // Same for the tiles that are active now.
+    template <class Rows>
+    void clearActive(Rows x) const;
+
+    // Calls f(j, first, last) for each run [first, last] of active cells in
+    // interior row j, rows in increasing order.
+    template <class F>
+    void forEachSpan(F&& f) const {
+        for (int tj = 0; tj < tiles_; tj++) {
+            const std::vector<Span>& spans = spans_[tj];
+            if (spans.empty()) {
+                continue;
+            }
+            int last = std::min(n_, (tj + 1) * tile_);
+            for (int j = tj * tile_ + 1; j <= last; j++) {
+                for (const Span& s : spans) {
+                    f(j, s.first, s.last);
+                }
+            }
+        }
+    }
+
+private:
+    struct Span {
+        int first, last;
+    };
+
+    void rebuildSpans();
+    template <class Rows>
+    void clearTile(int t, Rows x) const;
+
+    int n_, tile_, tiles_;
+    int activeCount_ = 0;
+    std::vector<uint8_t> active_, live_, grown_;
+    std::vector<int> dropped_;              // tile indices
+    std::vector<std::vector<Span>> spans_;  // per tile row
+};
+
+// Scalar kernels restricted to active tiles; inactive cells are left
+// untouched. add_source, advect, divergence and subtract_gradient compute
+// the dense stage's values cell for cell. sparse_lin_solve does not: it
+// multiplies by 1/c instead of dividing and relaxes only active cells, so
+// the diffusion and pressure solves are confined to active tiles and a
+// sparse step only approximates the dense one. Solids are handled as in
+// relax.hpp. lines holds five line buffers of n + 2 floats.
+template <class Rows>
+void sparse_add_source(const ActiveTiles& tiles, int n, Rows x, Rows s, float dt,
+                       float* lines);
+template <class Rows>
+void sparse_lin_solve(const ActiveTiles& tiles, int n, int b, Rows x, Rows x0, float a,
+                      float c, int iters, float* lines, const ObstacleMap* solids = nullptr);
+// Returns the largest u^2 + v^2 over the active cells.
+template <class Rows>
+float sparse_advect(const ActiveTiles& tiles, int n, int b, Rows d, Rows d0, Rows u, Rows v,
+                    float dt, float* lines);
+// Zeroes p too unless it is null.
+template <class Rows>
+void sparse_divergence(const ActiveTiles& tiles, int n, Rows u, Rows v, const Rows* p,
+                       Rows div, float* lines);
+template <class Rows>
+void sparse_subtract_gradient(const ActiveTiles& tiles, int n, Rows u, Rows v, Rows p,
+                              float* lines);
+
+#endif
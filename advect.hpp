@@ -0,0 +1,87 @@
+#ifndef ADVECT_HPP
+#define ADVECT_HPP
+#include <algorithm>
+
+enum class SimdLevel { Auto, Scalar, AVX2, AVX512 };
+
+// SemiLagrangian is the first-order backtrace. MacCormack and BFECC add a
+// backward pass to estimate and cancel its error; both clamp the result to
+// the values the first-order step interpolated between, so they create no
+// new extrema.
+enum class AdvectScheme { SemiLagrangian, MacCormack, BFECC };
+const char* advect_scheme_name(AdvectScheme scheme);
+
+// Best level the running CPU supports, and the level actually used for a
+// request (Auto or an unsupported level fall back to what the CPU has).
+SimdLevel detect_simd();
+SimdLevel resolve_simd(SimdLevel requested);
+const char* simd_name(SimdLevel level);
+
+// Backtraces (i,j) by dt0 cells per unit velocity and clamps the departure
+// point into the grid: it lies in the cell with lower corner (i0,j0), at
+// fractions (s1,t1) towards the next cell. Fields are anything indexed by
+// IX(i,j): a float pointer or a row accessor (utils.hpp).
+template <class G, class V>
+inline void advect_backtrace(G IX, int i, int j, V u, V v, float dt0,
+                             int& i0, int& j0, float& s1, float& t1) {
+    const int N = IX.n();
+    float x = i - dt0 * u[IX(i,j)];
+    float y = j - dt0 * v[IX(i,j)];
+    if (x < 0.5f) x = 0.5f;
+    if (x > N + 0.5f) x = N + 0.5f;
+    i0 = (int)x;
+    if (y < 0.5f) y = 0.5f;
+    if (y > N + 0.5f) y = N + 0.5f;
+    j0 = (int)y;
+    s1 = x - i0;
+    t1 = y - j0;
+}
+
+// One semi-Lagrangian sample: backtrace from (i,j), clamp, bilinear blend.
+// The SIMD kernels use this for row tails and mirror it operation for
+// operation, so every level produces bit-identical output.
+template <class G, class D, class V>
+inline float advect_cell(G IX, int i, int j, D d0, V u, V v, float dt0) {
+    int i0, j0;
+    float s1, t1;
+    advect_backtrace(IX, i, j, u, v, dt0, i0, j0, s1, t1);
+    int i1 = i0 + 1;
+    int j1 = j0 + 1;
+    float s0 = 1 - s1;
+    float t0 = 1 - t1;
+    return s0 * (t0 * d0[IX(i0,j0)] + t1 * d0[IX(i0,j1)]) +
+           s1 * (t0 * d0[IX(i1,j0)] + t1 * d0[IX(i1,j1)]);
+}
+
+// Smallest and largest of the four d0 values advect_cell() blends at (i,j).
+template <class G, class D, class V>
+inline void advect_limits(G IX, int i, int j, D d0, V u, V v, float dt0, float& lo,
+                          float& hi) {
+    int i0, j0;
+    float s1, t1;
+    advect_backtrace(IX, i, j, u, v, dt0, i0, j0, s1, t1);
+    float a = d0[IX(i0,j0)], b = d0[IX(i0 + 1,j0)];
+    float c = d0[IX(i0,j0 + 1)], d = d0[IX(i0 + 1,j0 + 1)];
+    lo = std::min(std::min(a, b), std::min(c, d));
+    hi = std::max(std::max(a, b), std::max(c, d));
+}
+
+// Advects the interior with the given level, walking contiguous rows.
+// Does not apply set_bnd. Returns the largest u^2 + v^2 among the cells it
+// advected, gathered from the velocity loads the backtrace makes anyway.
+// Fields are row accessors, FloatRows or PackedRows (utils.hpp,
+// packed_fields.hpp): d0 is gathered in its own storage and widened in
+// registers, and rows of u, v and d pass through lines, three rows of
+// n + 2 floats.
+template <class Rows>
+float advect_simd(SimdLevel level, int n, Rows d, Rows d0, Rows u, Rows v, float dt,
+                  float* lines);
+
+// Advects the interior with a scheme, then applies set_bnd(b, d). scratch
+// holds 2 * (n+2)^2 + 3 * (n+2) floats. As with advect(), d may alias u or
+// v but not d0. Returns the largest u^2 + v^2, like advect_simd().
+float advect_high_order(AdvectScheme scheme, SimdLevel level, int n, int b, float* d,
+                       const float* d0, const float* u, const float* v, float dt,
+                       float* scratch);
+
+#endif
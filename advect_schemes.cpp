@@ -0,0 +1,61 @@
+#include "advect.hpp"
+#include "utils.hpp"
+
+const char* advect_scheme_name(AdvectScheme scheme) {
+    switch (scheme) {
+    case AdvectScheme::SemiLagrangian: return "sl";
+    case AdvectScheme::MacCormack: return "maccormack";
+    case AdvectScheme::BFECC: return "bfecc";
+    }
+    return "unknown";
+}
+
+// Forward then backward advection of d0 measures the first-order error.
+// MacCormack (Selle et al. 2008) adds half of it to the forward result;
+// BFECC (Kim et al. 2005) removes half of it from d0 and advects again. The
+// plain passes run at the given SIMD level; the limiter pass reads u and v
+// only at the cell it writes, so d may alias them.
+float advect_high_order(AdvectScheme scheme, SimdLevel level, int n, int b, float* d,
+                         const float* d0, const float* u, const float* v, float dt,
+                        float* scratch) {
+    Grid<0> IX{n};
+    float* lines = scratch + 2 * IX.size();
+    // advect_simd() only reads its sources.
+    auto rows = [&](const float* x) { return FloatRows{const_cast<float*>(x), IX.stride()}; };
+    if (scheme == AdvectScheme::SemiLagrangian) {
+        float maxSq = advect_simd(level, n, rows(d), rows(d0), rows(u), rows(v), dt, lines);
+        set_bnd(IX, b, d);
+        return maxSq;
+    }
+    const float dt0 = dt * n;
+    float* forward = scratch;
+    float* back = scratch + IX.size();
+    float maxSq = advect_simd(level, n, rows(forward), rows(d0), rows(u), rows(v), dt, lines);
+    set_bnd(IX, b, forward);
+    advect_simd(level, n, rows(back), rows(forward), rows(u), rows(v), -dt, lines);
+
+    const float* result = forward;
+    if (scheme == AdvectScheme::BFECC) {
+        float* corrected = forward;
+        for (int j = 1; j <= n; j++) {
+            for (int i = 1; i <= n; i++) {
+                corrected[IX(i,j)] = d0[IX(i,j)] + 0.5f * (d0[IX(i,j)] - back[IX(i,j)]);
+            }
+        }
+        set_bnd(IX, b, corrected);
+        advect_simd(level, n, rows(back), rows(corrected), rows(u), rows(v), dt, lines);
+        result = back;
+    }
+    for (int j = 1; j <= n; j++) {
+        for (int i = 1; i <= n; i++) {
+            float value = scheme == AdvectScheme::BFECC
+                ? result[IX(i,j)]
+                : result[IX(i,j)] + 0.5f * (d0[IX(i,j)] - back[IX(i,j)]);
+            float lo, hi;
+            advect_limits(IX, i, j, d0, u, v, dt0, lo, hi);
+            d[IX(i,j)] = std::min(std::max(value, lo), hi);
+        }
+    }
+    set_bnd(IX, b, d);
+    return maxSq;
+}
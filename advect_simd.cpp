@@ -0,0 +1,275 @@
+#include "advect.hpp"
+#include "packed_fields.hpp"
+#include "utils.hpp"
+#include <algorithm>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define FLUID_X86 1
+#endif
+
+namespace {
+
+// Row tails of the SIMD kernels go through here as well. out is row j.
+template <class D, class V>
+inline float advect_span(Grid<0> IX, int j, int first, int last, float* out, D d0, V u, V v,
+                         float dt0, float maxSq) {
+    for (int i = first; i <= last; i++) {
+        float speedSq = u[IX(i,j)] * u[IX(i,j)] + v[IX(i,j)] * v[IX(i,j)];
+        maxSq = std::max(maxSq, speedSq);
+        out[i] = advect_cell(IX, i, j, d0, u, v, dt0);
+    }
+    return maxSq;
+}
+
+// lines holds three rows, as for the vector kernels; only the output row
+// is used here, since u and v are read a cell at a time.
+template <class Rows>
+float advect_rows_scalar(int n, int first, int last, Rows d, Rows d0, Rows u, Rows v,
+                         float dt0, float* lines) {
+    Grid<0> IX{n};
+    const int S = IX.stride();
+    float maxSq = 0.0f;
+    for (int j = first; j <= last; j++) {
+        float* out = d.out(j, lines + 2 * S);
+        maxSq = advect_span(IX, j, 1, n, out, d0, u, v, dt0, maxSq);
+        d.store(j, out, 1, n);
+    }
+    return maxSq;
+}
+
+#ifdef FLUID_X86
+
+// The four corners the bilinear blend reads, gathered from d0 in its
+// storage: k00 and k01 index the lower-left and upper-left corners. A 16-bit
+// field is gathered 32 bits at a time, so each load also brings in the cell
+// to its right, at most the last cell of the grid.
+__attribute__((target("avx2,f16c")))
+inline void corners_avx2(FloatRows d0, __m256i k00, __m256i k01, __m256& d00, __m256& d01,
+                         __m256& d10, __m256& d11) {
+    const __m256i ione = _mm256_set1_epi32(1);
+    d00 = _mm256_i32gather_ps(d0.data, k00, 4);
+    d01 = _mm256_i32gather_ps(d0.data, k01, 4);
+    d10 = _mm256_i32gather_ps(d0.data, _mm256_add_epi32(k00, ione), 4);
+    d11 = _mm256_i32gather_ps(d0.data, _mm256_add_epi32(k01, ione), 4);
+}
+
+// Left and right halves of eight gathered pairs of 16-bit cells.
+__attribute__((target("avx2,f16c")))
+inline void widen_pairs_avx2(const PackedRows& d0, __m256i pairs, __m256& left,
+                             __m256& right) {
+    if (d0.table) {
+        __m256i lo = _mm256_and_si256(pairs, _mm256_set1_epi32(0xFFFF));
+        __m256i hi = _mm256_srli_epi32(pairs, 16);
+        // packus interleaves 128-bit lanes; put each side back together.
+        __m256i halves = _mm256_permute4x64_epi64(_mm256_packus_epi32(lo, hi), 0xD8);
+        left = _mm256_cvtph_ps(_mm256_castsi256_si128(halves));
+        right = _mm256_cvtph_ps(_mm256_extracti128_si256(halves, 1));
+    } else {
+        left = _mm256_castsi256_ps(_mm256_slli_epi32(pairs, 16));
+        right = _mm256_castsi256_ps(_mm256_and_si256(pairs, _mm256_set1_epi32(0xFFFF0000)));
+    }
+}
+
+__attribute__((target("avx2,f16c")))
+inline void corners_avx2(const PackedRows& d0, __m256i k00, __m256i k01, __m256& d00,
+                         __m256& d01, __m256& d10, __m256& d11) {
+    const int* base = reinterpret_cast<const int*>(d0.data);
+    widen_pairs_avx2(d0, _mm256_i32gather_epi32(base, k00, 2), d00, d10);
+    widen_pairs_avx2(d0, _mm256_i32gather_epi32(base, k01, 2), d01, d11);
+}
+
+template <class Rows>
+__attribute__((target("avx2,f16c")))
+float advect_rows_avx2(int n, int first, int last, Rows d, Rows d0, Rows u, Rows v,
+                       float dt0, float* lines) {
+    Grid<0> IX{n};
+    const int S = IX.stride();
+    const __m256 vdt0 = _mm256_set1_ps(dt0);
+    const __m256 lo = _mm256_set1_ps(0.5f);
+    const __m256 hi = _mm256_set1_ps(n + 0.5f);
+    const __m256 one = _mm256_set1_ps(1.0f);
+    __m256 maxSq = _mm256_setzero_ps();
+    float tailSq = 0.0f;
+    const __m256i vstride = _mm256_set1_epi32(S);
+    const __m256i lane = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+    for (int j = first; j <= last; j++) {
+        const float* ur = u.row(j, lines);
+        const float* vr = v.row(j, lines + S);
+        float* out = d.out(j, lines + 2 * S);
+        const __m256 fj = _mm256_set1_ps((float)j);
+        int i = 1;
+        for (; i + 7 <= n; i += 8) {
+            __m256 fi = _mm256_cvtepi32_ps(_mm256_add_epi32(_mm256_set1_epi32(i), lane));
+            __m256 vu = _mm256_loadu_ps(ur + i);
+            __m256 vv = _mm256_loadu_ps(vr + i);
+            maxSq = _mm256_max_ps(maxSq, _mm256_add_ps(_mm256_mul_ps(vu, vu), _mm256_mul_ps(vv, vv)));
+            __m256 x = _mm256_sub_ps(fi, _mm256_mul_ps(vdt0, vu));
+            __m256 y = _mm256_sub_ps(fj, _mm256_mul_ps(vdt0, vv));
+            x = _mm256_min_ps(_mm256_max_ps(x, lo), hi);
+            y = _mm256_min_ps(_mm256_max_ps(y, lo), hi);
+            __m256i i0 = _mm256_cvttps_epi32(x);
+            __m256i j0 = _mm256_cvttps_epi32(y);
+            __m256 s1 = _mm256_sub_ps(x, _mm256_cvtepi32_ps(i0));
+            __m256 s0 = _mm256_sub_ps(one, s1);
+            __m256 t1 = _mm256_sub_ps(y, _mm256_cvtepi32_ps(j0));
+            __m256 t0 = _mm256_sub_ps(one, t1);
+            __m256i k00 = _mm256_add_epi32(i0, _mm256_mullo_epi32(j0, vstride));
+            __m256i k01 = _mm256_add_epi32(k00, vstride);
+            __m256 d00, d01, d10, d11;
+            corners_avx2(d0, k00, k01, d00, d01, d10, d11);
+            __m256 a = _mm256_mul_ps(s0, _mm256_add_ps(_mm256_mul_ps(t0, d00), _mm256_mul_ps(t1, d01)));
+            __m256 b = _mm256_mul_ps(s1, _mm256_add_ps(_mm256_mul_ps(t0, d10), _mm256_mul_ps(t1, d11)));
+            _mm256_storeu_ps(out + i, _mm256_add_ps(a, b));
+        }
+        tailSq = advect_span(IX, j, i, n, out, d0, u, v, dt0, tailSq);
+        d.store(j, out, 1, n);
+    }
+    alignas(32) float lanes[8];
+    _mm256_store_ps(lanes, maxSq);
+    for (float sq : lanes) {
+        tailSq = std::max(tailSq, sq);
+    }
+    return tailSq;
+}
+
+__attribute__((target("avx512f")))
+inline void corners_avx512(FloatRows d0, __m512i k00, __m512i k01, __m512& d00, __m512& d01,
+                           __m512& d10, __m512& d11) {
+    const __m512i ione = _mm512_set1_epi32(1);
+    d00 = _mm512_i32gather_ps(k00, d0.data, 4);
+    d01 = _mm512_i32gather_ps(k01, d0.data, 4);
+    d10 = _mm512_i32gather_ps(_mm512_add_epi32(k00, ione), d0.data, 4);
+    d11 = _mm512_i32gather_ps(_mm512_add_epi32(k01, ione), d0.data, 4);
+}
+
+__attribute__((target("avx512f")))
+inline void widen_pairs_avx512(const PackedRows& d0, __m512i pairs, __m512& left,
+                               __m512& right) {
+    if (d0.table) {
+        left = _mm512_cvtph_ps(_mm512_cvtepi32_epi16(pairs));
+        right = _mm512_cvtph_ps(_mm512_cvtepi32_epi16(_mm512_srli_epi32(pairs, 16)));
+    } else {
+        left = _mm512_castsi512_ps(_mm512_slli_epi32(pairs, 16));
+        right = _mm512_castsi512_ps(_mm512_and_si512(pairs, _mm512_set1_epi32(0xFFFF0000)));
+    }
+}
+
+__attribute__((target("avx512f")))
+inline void corners_avx512(const PackedRows& d0, __m512i k00, __m512i k01, __m512& d00,
+                           __m512& d01, __m512& d10, __m512& d11) {
+    widen_pairs_avx512(d0, _mm512_i32gather_epi32(k00, d0.data, 2), d00, d10);
+    widen_pairs_avx512(d0, _mm512_i32gather_epi32(k01, d0.data, 2), d01, d11);
+}
+
+template <class Rows>
+__attribute__((target("avx512f")))
+float advect_rows_avx512(int n, int first, int last, Rows d, Rows d0, Rows u, Rows v,
+                         float dt0, float* lines) {
+    Grid<0> IX{n};
+    const int S = IX.stride();
+    const __m512 vdt0 = _mm512_set1_ps(dt0);
+    const __m512 lo = _mm512_set1_ps(0.5f);
+    const __m512 hi = _mm512_set1_ps(n + 0.5f);
+    const __m512 one = _mm512_set1_ps(1.0f);
+    __m512 maxSq = _mm512_setzero_ps();
+    float tailSq = 0.0f;
+    const __m512i vstride = _mm512_set1_epi32(S);
+    const __m512i lane = _mm512_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7,
+                                           8, 9, 10, 11, 12, 13, 14, 15);
+    for (int j = first; j <= last; j++) {
+        const float* ur = u.row(j, lines);
+        const float* vr = v.row(j, lines + S);
+        float* out = d.out(j, lines + 2 * S);
+        const __m512 fj = _mm512_set1_ps((float)j);
+        int i = 1;
+        for (; i + 15 <= n; i += 16) {
+            __m512 fi = _mm512_cvtepi32_ps(_mm512_add_epi32(_mm512_set1_epi32(i), lane));
+            __m512 vu = _mm512_loadu_ps(ur + i);
+            __m512 vv = _mm512_loadu_ps(vr + i);
+            maxSq = _mm512_max_ps(maxSq, _mm512_add_ps(_mm512_mul_ps(vu, vu), _mm512_mul_ps(vv, vv)));
+            __m512 x = _mm512_sub_ps(fi, _mm512_mul_ps(vdt0, vu));
+            __m512 y = _mm512_sub_ps(fj, _mm512_mul_ps(vdt0, vv));
+            x = _mm512_min_ps(_mm512_max_ps(x, lo), hi);
+            y = _mm512_min_ps(_mm512_max_ps(y, lo), hi);
+            __m512i i0 = _mm512_cvttps_epi32(x);
+            __m512i j0 = _mm512_cvttps_epi32(y);
+            __m512 s1 = _mm512_sub_ps(x, _mm512_cvtepi32_ps(i0));
+            __m512 s0 = _mm512_sub_ps(one, s1);
+            __m512 t1 = _mm512_sub_ps(y, _mm512_cvtepi32_ps(j0));
+            __m512 t0 = _mm512_sub_ps(one, t1);
+            __m512i k00 = _mm512_add_epi32(i0, _mm512_mullo_epi32(j0, vstride));
+            __m512i k01 = _mm512_add_epi32(k00, vstride);
+            __m512 d00, d01, d10, d11;
+            corners_avx512(d0, k00, k01, d00, d01, d10, d11);
+            __m512 a = _mm512_mul_ps(s0, _mm512_add_ps(_mm512_mul_ps(t0, d00), _mm512_mul_ps(t1, d01)));
+            __m512 b = _mm512_mul_ps(s1, _mm512_add_ps(_mm512_mul_ps(t0, d10), _mm512_mul_ps(t1, d11)));
+            _mm512_storeu_ps(out + i, _mm512_add_ps(a, b));
+        }
+        tailSq = advect_span(IX, j, i, n, out, d0, u, v, dt0, tailSq);
+        d.store(j, out, 1, n);
+    }
+    return std::max(tailSq, _mm512_reduce_max_ps(maxSq));
+}
+
+#endif // FLUID_X86
+
+template <class Rows>
+float advect_rows(SimdLevel level, int n, int first, int last, Rows d, Rows d0, Rows u, Rows v,
+                  float dt, float* lines) {
+    float dt0 = dt * n;
+    switch (resolve_simd(level)) {
+#ifdef FLUID_X86
+    case SimdLevel::AVX512:
+        return advect_rows_avx512(n, first, last, d, d0, u, v, dt0, lines);
+    case SimdLevel::AVX2:
+        return advect_rows_avx2(n, first, last, d, d0, u, v, dt0, lines);
+#endif
+    default:
+        return advect_rows_scalar(n, first, last, d, d0, u, v, dt0, lines);
+    }
+}
+
+} // namespace
+
+SimdLevel detect_simd() {
+#ifdef FLUID_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f")) {
+        return SimdLevel::AVX512;
+    }
+    if (__builtin_cpu_supports("avx2")) {
+        return SimdLevel::AVX2;
+    }
+#endif
+    return SimdLevel::Scalar;
+}
+
+SimdLevel resolve_simd(SimdLevel requested) {
+    static const SimdLevel best = detect_simd();
+    if (requested == SimdLevel::Auto || requested > best) {
+        return best;
+    }
+    return requested;
+}
+
+const char* simd_name(SimdLevel level) {
+    switch (level) {
+    case SimdLevel::Auto: return "auto";
+    case SimdLevel::Scalar: return "scalar";
+    case SimdLevel::AVX2: return "avx2";
+    case SimdLevel::AVX512: return "avx512";
+    }
+    return "unknown";
+}
+
+template <class Rows>
+float advect_simd(SimdLevel level, int n, Rows d, Rows d0, Rows u, Rows v, float dt,
+                  float* lines) {
+    return advect_rows(level, n, 1, n, d, d0, u, v, dt, lines);
+}
+
+template float advect_simd(SimdLevel, int, FloatRows, FloatRows, FloatRows, FloatRows, float,
+                           float*);
+template float advect_simd(SimdLevel, int, PackedRows, PackedRows, PackedRows, PackedRows,
+                           float, float*);
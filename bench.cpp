@@ -0,0 +1,566 @@
+#include "domain_solver.hpp"
+#include "ensemble.hpp"
+#include "fluid.hpp"
+#include "profiler.hpp"
+#include "scalar_transport.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+// Stage-level benchmark for the headless solver. Writes one CSV row per
+// (stage, grid size, thread count) so runs can be diffed for regressions.
+
+struct BenchOptions {
+    double minTime = 0.2;   // seconds spent timing each stage
+    std::string out;        // report path, stdout when empty
+    std::vector<int> sizes = {64, 128, 200, 256, 512};
+    std::vector<int> threads = {1, 2, 4, 8, 16, 32};
+    std::vector<int> ensembles = {8, 32};  // instances per ensemble row
+    std::vector<int> ranks = {1, 2, 4};    // processes per domain row
+    std::vector<int> scalars = {1, 2, 4, 8};  // fields per transport row
+    std::string profile;    // record stage timers, write <profile>.csv/.json
+};
+
+struct BenchRow {
+    std::string stage;
+    int n;
+    int threads;
+    int reps;
+    double nsPerCell;
+    double gbPerSec;
+    double residual = 0.0;  // RMS pressure residual of the last solve
+    int iterations = 0;     // sweeps/cycles of the last pressure solve
+    double instanceStepsPerSec = 0.0;  // whole-step stages only
+    int gridPasses = 0;                // whole-step stages only
+    std::string metric;     // names value, a stage-specific quantity
+    double value = 0.0;
+};
+
+static void fillFields(FluidSolver& s, unsigned seed) {
+    std::mt19937 rng(seed);
+    std::uniform_real_distribution<float> vel(-1.0f, 1.0f);
+    std::uniform_real_distribution<float> den(0.0f, 1.0f);
+    for (int i = 0; i < s.size(); i++) {
+        s.u[i] = vel(rng);
+        s.v[i] = vel(rng);
+        s.u_prev[i] = vel(rng);
+        s.v_prev[i] = vel(rng);
+        s.dens[i] = den(rng);
+        s.dens_prev[i] = den(rng);
+    }
+}
+
+// Runs f until minTime has elapsed and returns the median ns per call.
+template <class F>
+static double timeStage(F&& f, double minTime, int& reps) {
+    using clock = std::chrono::steady_clock;
+    f(); // warm-up
+    std::vector<double> samples;
+    auto start = clock::now();
+    do {
+        auto t0 = clock::now();
+        f();
+        auto t1 = clock::now();
+        samples.push_back(std::chrono::duration<double, std::nano>(t1 - t0).count());
+    } while (std::chrono::duration<double>(clock::now() - start).count() < minTime);
+    reps = (int)samples.size();
+    std::nth_element(samples.begin(), samples.begin() + reps / 2, samples.end());
+    return samples[reps / 2];
+}
+
+template <class F>
+static BenchRow measureStage(FluidSolver& s, const std::string& stage, double bytesPerCell,
+                             const BenchOptions& opt, F&& f) {
+    BenchRow row;
+    row.stage = stage;
+    row.n = s.n();
+    row.threads = s.params.threads;
+    double ns = timeStage(f, opt.minTime, row.reps);
+    double cells = double(s.n()) * s.n();
+    row.nsPerCell = ns / cells;
+    row.gbPerSec = bytesPerCell * cells / ns;
+    return row;
+}
+
+template <class F>
+static BenchRow runStage(FluidSolver& s, const std::string& stage, double bytesPerCell,
+                         const BenchOptions& opt, F&& f) {
+    fillFields(s, 1234);
+    return measureStage(s, stage, bytesPerCell, opt, f);
+}
+
+// Steps an n x n DomainSolver split over `ranks` processes. Every rank has
+// to take the same steps, so the count comes from the slowest rank's first
+// timed step; rank 0, which runs in this process, fills in the row.
+static bool measureDomain(BenchRow& row, int n, int ranks, double bytesPerCell,
+                          const BenchOptions& opt) {
+    using clock = std::chrono::steady_clock;
+    row.n = n;
+    row.threads = ranks;
+    double ns = 0.0;
+    bool ok = run_ranks(ranks, 1 << 20, [&](HaloTransport& t) {
+        DomainSolver d(n, t);
+        d.initFluid();
+        for (int k = 0; k < 3; k++) {
+            d.updateFluid(d.params.dt);  // spin-up; also settles the halo depth
+        }
+        std::vector<double> samples;
+        int reps = 1;
+        for (int k = 0; k < reps; k++) {
+            t.barrier();
+            auto t0 = clock::now();
+            d.updateFluid(d.params.dt);
+            t.barrier();
+            samples.push_back(std::chrono::duration<double, std::nano>(clock::now() - t0).count());
+            if (k == 0) {
+                float first = t.allreduceMax((float)samples[0]);
+                reps = (int)std::min(10000.0, std::max(3.0, opt.minTime * 1e9 / first));
+            }
+        }
+        if (t.rank() == 0) {
+            std::nth_element(samples.begin(), samples.begin() + reps / 2, samples.end());
+            ns = samples[reps / 2];
+            row.reps = reps;
+            row.iterations = d.lastPressure.iterations;
+        }
+    });
+    double cells = double(n) * n;
+    row.nsPerCell = ns / cells;
+    row.gbPerSec = bytesPerCell * cells / ns;
+    row.instanceStepsPerSec = 1e9 / ns;
+    return ok;
+}
+
+static double densityVariance(const FluidSolver& s) {
+    double sum = 0.0, sumSq = 0.0;
+    for (int j = 1; j <= s.n(); j++) {
+        for (int i = 1; i <= s.n(); i++) {
+            sum += s.dens[s.IX(i,j)];
+            sumSq += double(s.dens[s.IX(i,j)]) * s.dens[s.IX(i,j)];
+        }
+    }
+    double cells = double(s.n()) * s.n();
+    return sumSq / cells - (sum / cells) * (sum / cells);
+}
+
+// Carries a Gaussian density blob once around the grid center by
+// solid-body rotation with s.params.advection, in the same number of steps
+// at every resolution. Returns the share of the density variance left, 1
+// for an exact scheme; ns gets the median time per advect() call.
+static double rotateBlob(FluidSolver& s, int steps, double& ns) {
+    const int n = s.n();
+    const float dt = s.params.dt;
+    const float center = 0.5f * (n + 1);
+    const float omega = float(2.0 * M_PI / (steps * dt));
+    for (int j = 0; j <= n + 1; j++) {
+        for (int i = 0; i <= n + 1; i++) {
+            float x = (i - center) / n, y = (j - center) / n;
+            s.u[s.IX(i,j)] = -omega * y;
+            s.v[s.IX(i,j)] = omega * x;
+            float dx = x - 0.25f;
+            float blob = std::exp(-(dx * dx + y * y) / (2 * 0.05f * 0.05f));
+            s.dens[s.IX(i,j)] = blob > 1e-6f ? blob : 0.0f;  // no denormals in the tail
+        }
+    }
+    double before = densityVariance(s);
+    std::vector<double> samples;
+    for (int k = 0; k < steps; k++) {
+        auto t0 = std::chrono::steady_clock::now();
+        s.advect(0, s.dens_prev, s.dens, s.u, s.v, dt);
+        samples.push_back(std::chrono::duration<double, std::nano>(
+            std::chrono::steady_clock::now() - t0).count());
+        s.dens.swap(s.dens_prev);
+    }
+    std::nth_element(samples.begin(), samples.begin() + steps / 2, samples.end());
+    ns = samples[steps / 2];
+    return densityVariance(s) / before;
+}
+
+static void benchSize(int n, const BenchOptions& opt, std::vector<BenchRow>& rows) {
+    FluidSolver s(n);
+    const FluidParams& p = s.params;
+
+    // Modeled DRAM traffic per interior cell, 4 bytes per float touched.
+    const int iters = p.iterations;
+    const double setBndBytes = 4.0 * 8.0 / n;            // 4N edge cells, read + write
+    const double diffuseBytes = iters * (12.0 + setBndBytes);
+    const double advectBytes = 16.0 + setBndBytes;        // u, v, d0, d
+    const double projectBytes = 16.0 + iters * (12.0 + setBndBytes) + 20.0 + 4 * setBndBytes;
+    const double stepBytes = 3 * 12.0 + 3 * diffuseBytes + 3 * advectBytes +
+                             2 * projectBytes + 3 * 4.0;
+
+    rows.push_back(runStage(s, "set_bnd", setBndBytes, opt, [&] { s.set_bnd(0, s.dens); }));
+    rows.push_back(runStage(s, "diffuse", diffuseBytes, opt,
+                            [&] { s.diffuse(0, s.dens, s.dens_prev, p.diff, p.dt); }));
+    rows.push_back(runStage(s, "advect", advectBytes, opt,
+                            [&] { s.advect(0, s.dens, s.dens_prev, s.u, s.v, p.dt); }));
+    for (SimdLevel level : {SimdLevel::Scalar, SimdLevel::AVX2, SimdLevel::AVX512}) {
+        if (resolve_simd(level) != level) {
+            continue;
+        }
+        s.params.simd = level;
+        rows.push_back(runStage(s, std::string("advect_") + simd_name(level), advectBytes, opt,
+                                [&] { s.advect(0, s.dens, s.dens_prev, s.u, s.v, p.dt); }));
+    }
+    s.params.simd = SimdLevel::Auto;
+    rows.push_back(runStage(s, "project", projectBytes, opt,
+                            [&] { s.project(s.u, s.v, s.u_prev, s.v_prev); }));
+    rows.back().residual = pressure_residual(n, s.u_prev.data(), s.v_prev.data());
+    rows.back().iterations = s.lastPressure.iterations;
+
+    // Steady scene: the same velocity field is projected every call, cold
+    // and then warm-started with early exit at the cold solve's residual.
+    std::vector<float> u0, v0;
+    auto steady = [&] {
+        s.u = u0;
+        s.v = v0;
+        s.project(s.u, s.v, s.u_prev, s.v_prev);
+    };
+    fillFields(s, 1234);
+    u0 = s.u;
+    v0 = s.v;
+    rows.push_back(runStage(s, "project_steady", projectBytes, opt, steady));
+    rows.back().residual = pressure_residual(n, s.u_prev.data(), s.v_prev.data());
+    rows.back().iterations = s.lastPressure.iterations;
+    s.params.warmStart = true;
+    s.params.tolerance = (float)rows.back().residual;
+    rows.push_back(runStage(s, "project_warm", projectBytes, opt, steady));
+    rows.back().residual = s.lastPressure.residual;
+    rows.back().iterations = s.lastPressure.iterations;
+    s.params.warmStart = false;
+    s.params.tolerance = 0.0f;
+
+    // Same projection with the multigrid pressure backend
+    const MultigridSettings& mg = s.params.multigrid;
+    const double mgSweepBytes = 2.0 * (mg.preSmooth + mg.postSmooth) * 12.0 + 24.0;
+    const double projectMgBytes = 16.0 + mg.cycles * mgSweepBytes + 20.0;
+    s.params.pressureSolver = PressureSolver::Multigrid;
+    rows.push_back(runStage(s, "project_mg", projectMgBytes, opt,
+                            [&] { s.project(s.u, s.v, s.u_prev, s.v_prev); }));
+    rows.back().residual = pressure_residual(n, s.u_prev.data(), s.v_prev.data());
+    rows.back().iterations = s.lastPressure.iterations;
+    s.params.pressureSolver = PressureSolver::GaussSeidel;
+
+    // Odd sizes coarsen with a remainder row and column
+    {
+        FluidSolver odd(n + 1);
+        odd.params.pressureSolver = PressureSolver::Multigrid;
+        rows.push_back(runStage(odd, "project_mg_odd", projectMgBytes, opt,
+                                [&] { odd.project(odd.u, odd.v, odd.u_prev, odd.v_prev); }));
+        rows.back().residual = pressure_residual(n + 1, odd.u_prev.data(), odd.v_prev.data());
+        rows.back().iterations = odd.lastPressure.iterations;
+    }
+
+    // Plain and tiled Jacobi, single threaded to isolate the cache effect
+    for (Relaxation r : {Relaxation::Jacobi, Relaxation::TiledJacobi}) {
+        std::string name = r == Relaxation::Jacobi ? "_jacobi" : "_tiled";
+        s.params.relaxation = r;
+        rows.push_back(runStage(s, "diffuse" + name, diffuseBytes, opt,
+                                [&] { s.diffuse(0, s.dens, s.dens_prev, p.diff, p.dt); }));
+        rows.push_back(runStage(s, "project" + name, projectBytes, opt,
+                                [&] { s.project(s.u, s.v, s.u_prev, s.v_prev); }));
+        rows.back().residual = pressure_residual(n, s.u_prev.data(), s.v_prev.data());
+        rows.back().iterations = s.lastPressure.iterations;
+    }
+
+    // Red-black relaxation across the thread-count sweep
+    s.params.relaxation = Relaxation::RedBlack;
+    for (int t : opt.threads) {
+        s.params.threads = t;
+        rows.push_back(runStage(s, "diffuse_rb", diffuseBytes, opt,
+                                [&] { s.diffuse(0, s.dens, s.dens_prev, p.diff, p.dt); }));
+        rows.push_back(runStage(s, "project_rb", projectBytes, opt,
+                                [&] { s.project(s.u, s.v, s.u_prev, s.v_prev); }));
+        rows.back().residual = pressure_residual(n, s.u_prev.data(), s.v_prev.data());
+        rows.back().iterations = s.lastPressure.iterations;
+        rows.push_back(runStage(s, "step_rb", stepBytes, opt, [&] { s.updateFluid(p.dt); }));
+        rows.back().instanceStepsPerSec = 1e9 / (rows.back().nsPerCell * n * n);
+        rows.back().gridPasses = s.lastPasses.grid;
+    }
+    s.params.relaxation = Relaxation::GaussSeidel;
+    s.params.threads = 1;
+    rows.push_back(runStage(s, "step", stepBytes, opt, [&] { s.updateFluid(p.dt); }));
+    rows.back().instanceStepsPerSec = 1e9 / (rows.back().nsPerCell * n * n);
+    rows.back().gridPasses = s.lastPasses.grid;
+
+    // Advection schemes: accuracy on the rotating blob (variance_kept)
+    // against cost per advect, then the cost of a whole step.
+    for (AdvectScheme scheme : {AdvectScheme::SemiLagrangian, AdvectScheme::MacCormack,
+                                AdvectScheme::BFECC}) {
+        s.params.advection = scheme;
+        const std::string name = advect_scheme_name(scheme);
+        const double bytes = scheme == AdvectScheme::SemiLagrangian ? advectBytes
+                           : scheme == AdvectScheme::MacCormack     ? 3 * advectBytes
+                                                                    : 4 * advectBytes;
+        BenchRow row;
+        row.stage = "rotate_" + name;
+        row.n = n;
+        row.threads = 1;
+        row.reps = 100;
+        double ns = 0.0;
+        row.metric = "variance_kept";
+        row.value = rotateBlob(s, row.reps, ns);
+        row.nsPerCell = ns / (double(n) * n);
+        row.gbPerSec = bytes / row.nsPerCell;
+        rows.push_back(row);
+        if (scheme != AdvectScheme::SemiLagrangian) {
+            rows.push_back(runStage(s, "step_" + name, stepBytes, opt,
+                                    [&] { s.updateFluid(p.dt); }));
+            rows.back().instanceStepsPerSec = 1e9 / (rows.back().nsPerCell * n * n);
+            rows.back().gridPasses = s.lastPasses.grid;
+        }
+    }
+    s.params.advection = AdvectScheme::SemiLagrangian;
+
+    // Obstacle boundaries: one apply() on static disks of growing radius,
+    // rated per boundary cell with the count as boundary_cells,
+    // then whole steps around a static disk and with a moving one.
+    for (int div : {16, 8, 4}) {
+        ObstacleMap& o = s.obstacles();
+        o.clear();
+        o.addDisk(0.5f * n + 1, 0.5f * n + 1, float(n) / div);
+        o.update(p.dt);
+        const double cells = (double)o.boundary().size();
+        BenchRow row;
+        row.stage = "obstacle_bnd";
+        row.n = n;
+        row.threads = 1;
+        double ns = timeStage([&] { o.apply(1, s.u.data()); }, opt.minTime, row.reps);
+        row.nsPerCell = ns / cells;
+        row.gbPerSec = 24.0 * cells / ns;  // four neighbors, cell and entry
+        row.metric = "boundary_cells";
+        row.value = cells;
+        rows.push_back(row);
+    }
+    for (bool moving : {false, true}) {
+        ObstacleMap& o = s.obstacles();
+        o.clear();
+        if (moving) {
+            o.moving.push_back(MovingObstacle{0.25f * n, 0.5f * n + 1, n / 8.0f, 0.2f, 0.0f});
+        } else {
+            o.addDisk(0.75f * n, 0.5f * n + 1, n / 8.0f);
+        }
+        rows.push_back(runStage(s, moving ? "step_moving" : "step_obstacle", stepBytes, opt,
+                                [&] {
+                                    if (moving && o.moving[0].x > 0.75f * n) {
+                                        o.moving[0].x = 0.25f * n;
+                                    }
+                                    s.updateFluid(p.dt);
+                                }));
+        rows.back().instanceStepsPerSec = 1e9 / (rows.back().nsPerCell * n * n);
+        rows.back().gridPasses = s.lastPasses.grid;
+    }
+    s.obstacles().clear();
+    s.updateFluid(p.dt);   // rebuild with no obstacles
+
+    // The plain step again with the stage timers recording, for their overhead.
+    bool profiling = profiler_enabled();
+    profiler_enable(true);
+    rows.push_back(runStage(s, "step_profiled", stepBytes, opt, [&] { s.updateFluid(p.dt); }));
+    rows.back().instanceStepsPerSec = 1e9 / (rows.back().nsPerCell * n * n);
+    rows.back().gridPasses = s.lastPasses.grid;
+    profiler_enable(profiling);
+
+    // The built-in source after a short spin-up instead of random fields,
+    // stepped densely, with active tiles and with 16-bit storage. Rates are
+    // still per N^2 cells. The 16-bit rows report the RMS density drift from
+    // the fp32 scene at the end of the spin-up, relative to its RMS density,
+    // as fp32_drift.
+    struct SceneConfig {
+        const char* stage;
+        bool sparse;
+        FieldStorage storage;
+    };
+    const SceneConfig scenes[] = {
+        {"step_scene", false, FieldStorage::Float32},
+        {"step_sparse", true, FieldStorage::Float32},
+        {"step_fp16", false, FieldStorage::Float16},
+        {"step_bf16", false, FieldStorage::BFloat16},
+    };
+    std::vector<float> reference, density;
+    for (const SceneConfig& config : scenes) {
+        FluidSolver scene(n);
+        scene.params.activeTiles = config.sparse;
+        scene.params.storage = config.storage;
+        for (int k = 0; k < 50; k++) {
+            scene.updateFluid(p.dt);
+        }
+        double drift = 0.0;
+        if (config.storage == FieldStorage::Float32 && !config.sparse) {
+            scene.copyDensity(reference);
+        } else if (config.storage != FieldStorage::Float32) {
+            scene.copyDensity(density);
+            double err = 0.0, norm = 0.0;
+            for (size_t k = 0; k < density.size(); k++) {
+                err += double(density[k] - reference[k]) * (density[k] - reference[k]);
+                norm += double(reference[k]) * reference[k];
+            }
+            drift = norm > 0 ? std::sqrt(err / norm) : 0.0;
+        }
+        // Half the field bytes in the 16-bit modes
+        double bytes = config.storage == FieldStorage::Float32 ? stepBytes : stepBytes / 2;
+        rows.push_back(measureStage(scene, config.stage, bytes, opt,
+                                    [&] { scene.updateFluid(p.dt); }));
+        rows.back().instanceStepsPerSec = 1e9 / (rows.back().nsPerCell * n * n);
+        if (config.storage != FieldStorage::Float32) {
+            rows.back().metric = "fp32_drift";
+            rows.back().value = drift;
+        }
+        rows.back().gridPasses = scene.lastPasses.grid;
+    }
+
+    // Domain decomposition over processes. Strong scaling keeps the N x N
+    // grid; weak scaling grows it to about N^2 cells per rank.
+    for (int r : opt.ranks) {
+        const int weakN = (int)std::lround(n * std::sqrt(double(r)));
+        for (bool weak : {false, true}) {
+            BenchRow row;
+            row.stage = weak ? "domain_weak" : "domain_strong";
+            const int domainN = weak ? weakN : n;
+            if (r > domainN || (weak && r == 1)) {
+                continue;  // one rank is the same run for both
+            }
+            if (!measureDomain(row, domainN, r, stepBytes, opt)) {
+                std::cerr << "domain run with " << r << " ranks failed" << std::endl;
+                continue;
+            }
+            rows.push_back(row);
+        }
+    }
+
+    // M instances stepped together; rates are per instance-cell.
+    for (int m : opt.ensembles) {
+        for (int t : opt.threads) {
+            if (t > 1 && (t - 1) * 16 >= m) {
+                break;  // more workers than 16-instance blocks
+            }
+            std::vector<InstanceParams> instances(m);
+            for (int k = 0; k < m; k++) {
+                instances[k].visc = p.visc * (1 + k % 4);
+                instances[k].diff = p.diff * (1 + k % 3);
+            }
+            FluidParams shared = p;
+            shared.threads = t;
+            Ensemble e(n, instances, shared);
+            BenchRow row;
+            row.stage = "ensemble_" + std::to_string(m);
+            row.n = n;
+            row.threads = t;
+            double ns = timeStage([&] { e.step(); }, opt.minTime, row.reps);
+            double cells = double(n) * n * m;
+            row.nsPerCell = ns / cells;
+            row.gbPerSec = stepBytes * cells / ns;
+            row.instanceStepsPerSec = 1e9 * m / ns;
+            rows.push_back(row);
+        }
+    }
+
+    // K passive scalars sharing one backtrace per cell. Rates are per
+    // field-cell; cost_ratio is the cost relative to K separate single-field
+    // steps, taken from the transport_1 row (0 without one).
+    fillFields(s, 1234);
+    double singleNs = 0.0;
+    for (int k : opt.scalars) {
+        ScalarTransport t(n, std::vector<float>(k, p.diff));
+        for (float& x : t.values) {
+            x = 1.0f;
+        }
+        BenchRow row;
+        row.stage = "transport_" + std::to_string(k);
+        row.n = n;
+        row.threads = 1;
+        double ns = timeStage([&] { t.step(s.u.data(), s.v.data(), p.dt, iters); },
+                              opt.minTime, row.reps);
+        if (k == 1) {
+            singleNs = ns;
+        }
+        // Per field: source, diffusion, advected field; the velocity is shared.
+        const double bytes = 12.0 + diffuseBytes + 8.0 + 8.0 / k + setBndBytes;
+        double cells = double(n) * n * k;
+        row.nsPerCell = ns / cells;
+        row.gbPerSec = bytes * cells / ns;
+        row.instanceStepsPerSec = 1e9 * k / ns;
+        row.metric = "cost_ratio";
+        row.value = singleNs > 0 ? ns / (k * singleNs) : 0.0;
+        rows.push_back(row);
+    }
+}
+
+static void parseList(char* arg, std::vector<int>& out) {
+    out.clear();
+    for (char* tok = std::strtok(arg, ","); tok; tok = std::strtok(nullptr, ",")) {
+        out.push_back(std::atoi(tok));
+    }
+}
+
+static bool parseArgs(int argc, char** argv, BenchOptions& opt) {
+    for (int i = 1; i < argc; i++) {
+        if (!std::strcmp(argv[i], "--min-time") && i + 1 < argc) {
+            opt.minTime = std::atof(argv[++i]);
+        } else if (!std::strcmp(argv[i], "--out") && i + 1 < argc) {
+            opt.out = argv[++i];
+        } else if (!std::strcmp(argv[i], "--sizes") && i + 1 < argc) {
+            parseList(argv[++i], opt.sizes);
+        } else if (!std::strcmp(argv[i], "--threads") && i + 1 < argc) {
+            parseList(argv[++i], opt.threads);
+        } else if (!std::strcmp(argv[i], "--ensembles") && i + 1 < argc) {
+            parseList(argv[++i], opt.ensembles);
+        } else if (!std::strcmp(argv[i], "--ranks") && i + 1 < argc) {
+            parseList(argv[++i], opt.ranks);
+        } else if (!std::strcmp(argv[i], "--scalars") && i + 1 < argc) {
+            parseList(argv[++i], opt.scalars);
+        } else if (!std::strcmp(argv[i], "--profile") && i + 1 < argc) {
+            opt.profile = argv[++i];
+        } else {
+            std::cerr << "usage: fluid_bench [--min-time sec] [--sizes n1,n2,...] "
+                         "[--threads t1,t2,...] [--ensembles m1,m2,...] [--ranks r1,r2,...] "
+                         "[--scalars k1,k2,...] [--profile prefix] [--out report.csv]" << std::endl;
+            return false;
+        }
+    }
+    return true;
+}
+
+int main(int argc, char** argv) {
+    BenchOptions opt;
+    if (!parseArgs(argc, argv, opt)) {
+        return 1;
+    }
+    profiler_enable(!opt.profile.empty());
+
+    std::vector<BenchRow> rows;
+    for (int n : opt.sizes) {
+        benchSize(n, opt, rows);
+    }
+    if (!opt.profile.empty() && (!write_profile_csv(opt.profile + ".csv") ||
+                                 !write_chrome_trace(opt.profile + ".json"))) {
+        std::cerr << "Failed to write " << opt.profile << ".csv/.json" << std::endl;
+        return 1;
+    }
+
+    std::ofstream file;
+    if (!opt.out.empty()) {
+        file.open(opt.out);
+        if (!file) {
+            std::cerr << "Failed to open " << opt.out << std::endl;
+            return 1;
+        }
+    }
+    std::ostream& os = opt.out.empty() ? std::cout : file;
+    os << "stage,n,threads,reps,ns_per_cell,gb_per_s,residual,iters,instance_steps_per_s,"
+          "grid_passes,metric,value\n";
+    for (const BenchRow& r : rows) {
+        os << r.stage << ',' << r.n << ',' << r.threads << ',' << r.reps << ','
+           << r.nsPerCell << ',' << r.gbPerSec << ',' << r.residual << ','
+           << r.iterations << ',' << r.instanceStepsPerSec << ',' << r.gridPasses << ','
+           << r.metric << ',' << r.value << '\n';
+    }
+    return 0;
+}
@@ -0,0 +1,422 @@
+#include "checkpoint.hpp"
+#include "profiler.hpp"
+#include "utils.hpp"
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace {
+
+const size_t kPage = 4096;
+const uint32_t kNoSlot = 0xffffffffu;
+
+struct Superblock {
+    char magic[8];
+    uint32_t version;
+    uint32_t page;
+    uint32_t n;
+    uint32_t fields;
+    uint64_t slotBytes;
+    uint64_t fieldBytes;
+    uint32_t active;      // committed slot, kNoSlot before the first commit
+    uint32_t reserved;
+    uint64_t sequence;    // commits so far
+};
+
+// FluidParams with fixed-width members, so the file does not depend on
+// the in-memory layout of the struct.
+struct DiskParams {
+    float dt, diff, visc;
+    int32_t iterations, relaxation, threads, tileSize, fusedSweeps, simd, pressureSolver;
+    int32_t mgCycle, mgCycles, mgPreSmooth, mgPostSmooth;
+    float tolerance;
+    int32_t checkEvery, warmStart;
+    int32_t activeTiles, activeTileSize;
+    float activeEpsilon;
+    int32_t storage;
+    int32_t unused;       // was the fused pipeline flag; written as 0
+    int32_t advection;
+};
+
+struct SlotMeta {
+    uint64_t sequence;
+    float simulationTime;
+    uint32_t reserved;
+    DiskParams params;
+};
+
+size_t field_bytes(int n) {
+    size_t bytes = (size_t)Grid<0>{n}.size() * sizeof(float);
+    return (bytes + kPage - 1) / kPage * kPage;
+}
+
+size_t slot_bytes(int n) {
+    return kPage + kCheckpointFields * field_bytes(n);
+}
+
+std::string temp_path(const std::string& path) {
+    return path + ".tmp";
+}
+
+size_t file_bytes(int n) {
+    return kPage + 2 * slot_bytes(n);
+}
+
+DiskParams to_disk(const FluidParams& p) {
+    DiskParams d;
+    std::memset(&d, 0, sizeof(d));
+    d.dt = p.dt;
+    d.diff = p.diff;
+    d.visc = p.visc;
+    d.iterations = p.iterations;
+    d.relaxation = (int32_t)p.relaxation;
+    d.threads = p.threads;
+    d.tileSize = p.tileSize;
+    d.fusedSweeps = p.fusedSweeps;
+    d.simd = (int32_t)p.simd;
+    d.pressureSolver = (int32_t)p.pressureSolver;
+    d.mgCycle = (int32_t)p.multigrid.cycle;
+    d.mgCycles = p.multigrid.cycles;
+    d.mgPreSmooth = p.multigrid.preSmooth;
+    d.mgPostSmooth = p.multigrid.postSmooth;
+    d.tolerance = p.tolerance;
+    d.checkEvery = p.checkEvery;
+    d.warmStart = p.warmStart;
+    d.activeTiles = p.activeTiles;
+    d.activeTileSize = p.activeTileSize;
+    d.activeEpsilon = p.activeEpsilon;
+    d.storage = (int32_t)p.storage;
+    d.advection = (int32_t)p.advection;
+    return d;
+}
+
+FluidParams from_disk(const DiskParams& d) {
+    FluidParams p;
+    p.dt = d.dt;
+    p.diff = d.diff;
+    p.visc = d.visc;
+    p.iterations = d.iterations;
+    p.relaxation = (Relaxation)d.relaxation;
+    p.threads = d.threads;
+    p.tileSize = d.tileSize;
+    p.fusedSweeps = d.fusedSweeps;
+    p.simd = (SimdLevel)d.simd;
+    p.pressureSolver = (PressureSolver)d.pressureSolver;
+    p.multigrid.cycle = (CycleType)d.mgCycle;
+    p.multigrid.cycles = d.mgCycles;
+    p.multigrid.preSmooth = d.mgPreSmooth;
+    p.multigrid.postSmooth = d.mgPostSmooth;
+    p.tolerance = d.tolerance;
+    p.checkEvery = d.checkEvery;
+    p.warmStart = d.warmStart != 0;
+    p.activeTiles = d.activeTiles != 0;
+    p.activeTileSize = d.activeTileSize;
+    p.activeEpsilon = d.activeEpsilon;
+    p.storage = (FieldStorage)d.storage;
+    p.advection = (AdvectScheme)d.advection;
+    return p;
+}
+
+bool valid_superblock(const Superblock& sb, size_t fileBytes) {
+    return !std::memcmp(sb.magic, "FLUIDCKP", 8) && sb.version == kCheckpointVersion &&
+           sb.page == kPage && sb.fields == (uint32_t)kCheckpointFields && sb.n >= 1 &&
+           sb.slotBytes == slot_bytes(sb.n) && sb.fieldBytes == field_bytes(sb.n) &&
+           fileBytes >= file_bytes(sb.n);
+}
+
+} // namespace
+
+CheckpointView::~CheckpointView() {
+    close();
+}
+
+bool CheckpointView::open(const std::string& path) {
+    close();
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+    struct stat st;
+    void* map = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && (size_t)st.st_size >= kPage) {
+        map = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    }
+    ::close(fd);
+    if (map == MAP_FAILED) {
+        return false;
+    }
+    map_ = map;
+    bytes_ = st.st_size;
+
+    const Superblock& sb = *(const Superblock*)map_;
+    if (!valid_superblock(sb, bytes_) || sb.active > 1) {
+        close();
+        return false;
+    }
+    const char* slot = (const char*)map_ + kPage + sb.active * sb.slotBytes;
+    // Start paging the slot in while the caller gets going.
+    madvise((void*)slot, sb.slotBytes, MADV_WILLNEED);
+    const SlotMeta& meta = *(const SlotMeta*)slot;
+    n_ = (int)sb.n;
+    sequence_ = meta.sequence;
+    simulationTime_ = meta.simulationTime;
+    params_ = from_disk(meta.params);
+    for (int k = 0; k < kCheckpointFields; k++) {
+        fields_[k] = (const float*)(slot + kPage + k * sb.fieldBytes);
+    }
+    return true;
+}
+
+void CheckpointView::close() {
+    if (map_) {
+        munmap(map_, bytes_);
+        map_ = nullptr;
+    }
+    n_ = 0;
+}
+
+bool save_checkpoint(const std::string& path, const FluidSolver& solver) {
+    CheckpointWriter writer(path, 0);
+    return writer.save(solver);
+}
+
+bool load_checkpoint(const std::string& path, FluidSolver& solver) {
+    CheckpointView view;
+    if (!view.open(path) || view.n() != solver.n()) {
+        return false;
+    }
+    const float* fields[kCheckpointFields];
+    for (int k = 0; k < kCheckpointFields; k++) {
+        fields[k] = view.field(k);
+    }
+    solver.params = view.params();
+    solver.simulationTime = view.simulationTime();
+    solver.restoreFields(fields);
+    return true;
+}
+
+CheckpointWriter::CheckpointWriter(const std::string& path, double intervalSeconds)
+    : path_(path),
+      interval_(std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+          std::chrono::duration<double>(intervalSeconds))),
+      next_(std::chrono::steady_clock::now() + interval_) {
+    writer_ = std::thread(&CheckpointWriter::writerLoop, this);
+}
+
+CheckpointWriter::~CheckpointWriter() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stop_ = true;
+    }
+    cv_.notify_all();
+    writer_.join();
+    if (map_) {
+        munmap(map_, bytes_);
+    }
+    if (fd_ >= 0) {
+        close(fd_);
+    }
+}
+
+bool CheckpointWriter::maybeSave(const FluidSolver& solver) {
+    auto now = std::chrono::steady_clock::now();
+    if (now < next_) {
+        return false;
+    }
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (pending_) {
+            std::lock_guard<std::mutex> statsLock(statsMutex_);
+            stats_.busy++;
+            return false;
+        }
+    }
+    snapshot(solver);
+    next_ = now + interval_;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        pending_ = true;
+    }
+    cv_.notify_all();
+    return true;
+}
+
+bool CheckpointWriter::save(const FluidSolver& solver) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    cv_.wait(lock, [&] { return !pending_; });
+    snapshot(solver);
+    pending_ = true;
+    saveTarget_ = committed_ + 1;
+    cv_.notify_all();
+    cv_.wait(lock, [&] { return committed_ >= saveTarget_; });
+    return saveOk_;
+}
+
+CheckpointStats CheckpointWriter::stats() {
+    std::lock_guard<std::mutex> lock(statsMutex_);
+    return stats_;
+}
+
+void CheckpointWriter::snapshot(const FluidSolver& solver) {
+    ProfileScope scope("checkpoint_snapshot");
+    auto t0 = std::chrono::steady_clock::now();
+    std::vector<float>* fields[kCheckpointFields];
+    for (int k = 0; k < kCheckpointFields; k++) {
+        fields[k] = &fields_[k];
+    }
+    solver.copyFields(fields);
+    n_ = solver.n();
+    simulationTime_ = solver.simulationTime;
+    params_ = solver.params;
+    double ms = std::chrono::duration<double, std::milli>(
+        std::chrono::steady_clock::now() - t0).count();
+    std::lock_guard<std::mutex> lock(statsMutex_);
+    stats_.snapshotMs = ms;
+}
+
+void CheckpointWriter::writerLoop() {
+    profile_thread_name("checkpoint writer");
+    std::unique_lock<std::mutex> lock(mutex_);
+    for (;;) {
+        cv_.wait(lock, [&] { return stop_ || pending_; });
+        if (!pending_) {
+            return;
+        }
+        lock.unlock();
+        bool ok = commit();
+        lock.lock();
+        if (!ok) {
+            std::lock_guard<std::mutex> statsLock(statsMutex_);
+            stats_.failures++;
+        }
+        pending_ = false;
+        committed_++;
+        if (committed_ == saveTarget_) {
+            saveOk_ = ok;
+        }
+        cv_.notify_all();
+    }
+}
+
+// Maps path_ if it is a valid checkpoint of total bytes for this N, so
+// unchanged pages need no rewrite. Anything else at path_ is left alone and
+// a fresh file is built next to it, renamed over it by the first commit.
+bool CheckpointWriter::openFile(size_t total) {
+    if (fd_ < 0) {
+        fd_ = open(path_.c_str(), O_RDWR);
+    }
+    struct stat st;
+    Superblock existing;
+    bool reuse = fd_ >= 0 && fstat(fd_, &st) == 0 && (size_t)st.st_size == total &&
+                 pread(fd_, &existing, sizeof(existing), 0) == (ssize_t)sizeof(existing) &&
+                 valid_superblock(existing, total) && existing.n == (uint32_t)n_;
+    if (!reuse) {
+        if (fd_ >= 0) {
+            close(fd_);
+        }
+        fd_ = open(temp_path(path_).c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+        if (fd_ < 0) {
+            return false;
+        }
+        if (ftruncate(fd_, (off_t)total) != 0) {
+            close(fd_);
+            fd_ = -1;
+            return false;
+        }
+        staged_ = true;
+    }
+    void* map = mmap(nullptr, total, PROT_READ | PROT_WRITE, MAP_SHARED, fd_, 0);
+    if (map == MAP_FAILED) {
+        return false;
+    }
+    map_ = map;
+    bytes_ = total;
+    if (!reuse) {
+        Superblock sb;
+        std::memset(&sb, 0, sizeof(sb));
+        std::memcpy(sb.magic, "FLUIDCKP", 8);
+        sb.version = kCheckpointVersion;
+        sb.page = kPage;
+        sb.n = (uint32_t)n_;
+        sb.fields = kCheckpointFields;
+        sb.slotBytes = slot_bytes(n_);
+        sb.fieldBytes = field_bytes(n_);
+        sb.active = kNoSlot;
+        std::memcpy(map_, &sb, sizeof(sb));
+    }
+    return true;
+}
+
+// Writes the staging copy into the slot not named by the superblock, then
+// flips the superblock to it.
+bool CheckpointWriter::commit() {
+    ProfileScope scope("checkpoint_write");
+    auto t0 = std::chrono::steady_clock::now();
+    const size_t total = file_bytes(n_);
+    if (map_ && ((Superblock*)map_)->n != (uint32_t)n_) {
+        munmap(map_, bytes_);
+        map_ = nullptr;
+        close(fd_);
+        fd_ = -1;
+        staged_ = false;
+    }
+    if (!map_ && !openFile(total)) {
+        return false;
+    }
+
+    Superblock& sb = *(Superblock*)map_;
+    uint32_t target = sb.active == 0 ? 1 : 0;
+    char* slot = (char*)map_ + kPage + target * sb.slotBytes;
+
+    SlotMeta meta;
+    std::memset(&meta, 0, sizeof(meta));
+    meta.sequence = sb.sequence + 1;
+    meta.simulationTime = simulationTime_;
+    meta.params = to_disk(params_);
+    std::memcpy(slot, &meta, sizeof(meta));
+
+    // Only pages that differ are dirtied, so msync writes just those.
+    uint64_t written = 1, unchanged = 0;
+    const size_t bytes = (size_t)Grid<0>{n_}.size() * sizeof(float);
+    for (int k = 0; k < kCheckpointFields; k++) {
+        char* dst = slot + kPage + k * sb.fieldBytes;
+        const char* src = (const char*)fields_[k].data();
+        for (size_t offset = 0; offset < bytes; offset += kPage) {
+            size_t len = std::min(kPage, bytes - offset);
+            if (std::memcmp(dst + offset, src + offset, len)) {
+                std::memcpy(dst + offset, src + offset, len);
+                written++;
+            } else {
+                unchanged++;
+            }
+        }
+    }
+    if (msync(slot, sb.slotBytes, MS_SYNC) != 0) {
+        return false;
+    }
+    sb.active = target;
+    sb.sequence++;
+    if (msync(map_, kPage, MS_SYNC) != 0) {
+        return false;
+    }
+    // A fresh file only replaces the old checkpoint once it holds one.
+    if (staged_) {
+        if (rename(temp_path(path_).c_str(), path_.c_str()) != 0) {
+            return false;
+        }
+        staged_ = false;
+    }
+
+    double ms = std::chrono::duration<double, std::milli>(
+        std::chrono::steady_clock::now() - t0).count();
+    std::lock_guard<std::mutex> lock(statsMutex_);
+    stats_.checkpoints++;
+    stats_.pagesWritten += written;
+    stats_.pagesUnchanged += unchanged;
+    stats_.writeMs = ms;
+    return true;
+}
@@ -0,0 +1,124 @@
+#ifndef CHECKPOINT_HPP
+#define CHECKPOINT_HPP
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "fluid.hpp"
+
+// Checkpoint file, version 2. Page 0 is a superblock naming the last
+// committed slot; two slots follow, each a metadata page and then
+// kCheckpointFields fp32 grids of (N+2)^2 cells, every one starting on a
+// page boundary, in FluidSolver::copyFields() order. Writers alternate
+// slots and flip the superblock last, so a crash mid-write leaves the
+// previous checkpoint intact. A file of another size or format is never
+// overwritten in place: the new one is built at <path>.tmp and renamed
+// over it once its first slot is committed.
+const uint32_t kCheckpointVersion = 2;
+const int kCheckpointFields = 7;
+
+// Maps a checkpoint read-only. field() points straight into the mapping:
+// nothing is parsed or copied, pages load on first touch.
+class CheckpointView {
+public:
+    CheckpointView() = default;
+    ~CheckpointView();
+
+    CheckpointView(const CheckpointView&) = delete;
+    CheckpointView& operator=(const CheckpointView&) = delete;
+
+    // False if the file is missing, of another version or never committed.
+    bool open(const std::string& path);
+    void close();
+
+    int n() const { return n_; }
+    uint64_t sequence() const { return sequence_; }
+    float simulationTime() const { return simulationTime_; }
+    const FluidParams& params() const { return params_; }
+    const float* field(int k) const { return fields_[k]; }
+
+private:
+    void* map_ = nullptr;
+    size_t bytes_ = 0;
+    int n_ = 0;
+    uint64_t sequence_ = 0;
+    float simulationTime_ = 0;
+    FluidParams params_;
+    const float* fields_[kCheckpointFields] = {};
+};
+
+// Synchronous save and restore. load_checkpoint() needs solver.n() to
+// match the file; it replaces all fields, simulationTime and params.
+bool save_checkpoint(const std::string& path, const FluidSolver& solver);
+bool load_checkpoint(const std::string& path, FluidSolver& solver);
+
+struct CheckpointStats {
+    uint64_t checkpoints = 0;    // committed by the writer
+    uint64_t busy = 0;           // due while the previous one was still writing
+    uint64_t pagesWritten = 0;   // pages that differed from the slot's old contents
+    uint64_t pagesUnchanged = 0;
+    double snapshotMs = 0;       // last copy on the stepping thread
+    double writeMs = 0;          // last write and sync on the writer thread
+    uint64_t failures = 0;       // commits whose file could not be created or synced
+};
+
+// Saves every intervalSeconds from a background thread. The stepping
+// thread calls maybeSave() between steps; when a save is due it copies the
+// fields into a staging buffer and returns, and the writer then updates
+// only the pages of the target slot that changed.
+class CheckpointWriter {
+public:
+    CheckpointWriter(const std::string& path, double intervalSeconds);
+    ~CheckpointWriter();
+
+    CheckpointWriter(const CheckpointWriter&) = delete;
+    CheckpointWriter& operator=(const CheckpointWriter&) = delete;
+
+    // True if a snapshot was taken.
+    bool maybeSave(const FluidSolver& solver);
+    // Snapshots now and waits until it is committed; false if that commit
+    // failed.
+    bool save(const FluidSolver& solver);
+    CheckpointStats stats();
+
+private:
+    void snapshot(const FluidSolver& solver);
+    void writerLoop();
+    bool openFile(size_t total);
+    bool commit();
+
+    std::string path_;
+    std::chrono::steady_clock::duration interval_;
+    std::chrono::steady_clock::time_point next_;
+
+    // Staging copy handed to the writer
+    int n_ = 0;
+    float simulationTime_ = 0;
+    FluidParams params_;
+    std::vector<float> fields_[kCheckpointFields];
+
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    bool pending_ = false;
+    bool stop_ = false;
+    uint64_t committed_ = 0;
+    uint64_t saveTarget_ = 0;   // commit save() waits for, and its outcome
+    bool saveOk_ = false;
+    std::thread writer_;
+
+    // Writer thread only
+    int fd_ = -1;
+    void* map_ = nullptr;
+    size_t bytes_ = 0;
+    bool staged_ = false;       // mapped file is path_.tmp, not yet renamed
+
+    std::mutex statsMutex_;
+    CheckpointStats stats_;
+};
+
+#endif
@@ -0,0 +1,342 @@
+#include "domain_solver.hpp"
+#include "profiler.hpp"
+#include "thread_pool.hpp"
+#include "utils.hpp"
+#include <algorithm>
+#include <cmath>
+
+namespace {
+
+// Global (i,j) into a slab whose storage starts at row `base`.
+struct SlabGrid {
+    int dynamicN;
+    int base;
+    int n() const { return dynamicN; }
+    int operator()(int i, int j) const { return i + (dynamicN + 2) * (j - base); }
+};
+
+} // namespace
+
+DomainSolver::DomainSolver(int n, HaloTransport& transport, const FluidParams& params)
+    : params(params), transport_(transport), n_(n) {
+    row_band(n, transport.size(), transport.rank(), j0_, j1_);
+    lo_ = j0_;
+    hi_ = j1_;
+    reserveHalo(1);
+}
+
+void DomainSolver::initFluid() {
+    for (std::vector<float>* x : {&u, &v, &u_prev, &v_prev, &dens, &dens_prev}) {
+        std::fill(x->begin(), x->end(), 0.0f);
+    }
+    simulationTime = 0.0f;
+    pendingSplats_.clear();
+}
+
+void DomainSolver::reserveHalo(int rows) {
+    rows = std::min(rows, n_ + 1);
+    if (rows <= depth_) {
+        return;
+    }
+    const int lo = std::max(0, j0_ - rows);
+    const int hi = std::min(n_ + 1, j1_ + rows);
+    const size_t stride = n_ + 2;
+    for (std::vector<float>* x : {&u, &v, &u_prev, &v_prev, &dens, &dens_prev}) {
+        std::vector<float> grown((hi - lo + 1) * stride, 0.0f);
+        if (!x->empty()) {
+            std::copy(x->begin(), x->end(), grown.begin() + (lo_ - lo) * stride);
+        }
+        x->swap(grown);
+    }
+    depth_ = rows;
+    lo_ = lo;
+    hi_ = hi;
+}
+
+// Sends each neighbor the `rows` rows next to it. A rank thinner than
+// `rows` forwards rows it gets from the far side, so it receives those
+// before sending; the chain that forms cannot deadlock because every pass
+// starts at a rank that has nothing to receive.
+void DomainSolver::exchange(std::vector<float>& x, int rows) {
+    ProfileScope scope("halo_exchange");
+    const int rank = transport_.rank();
+    const bool below = rank > 0;
+    const bool above = rank + 1 < transport_.size();
+    const size_t rowBytes = (n_ + 2) * sizeof(float);
+
+    const int upFirst = std::max(0, j1_ + 1 - rows);
+    const int belowFirst = std::max(0, j0_ - rows);
+    auto sendUp = [&] {
+        transport_.send(rank + 1, &x[index(0, upFirst)], (j1_ - upFirst + 1) * rowBytes);
+    };
+    auto receiveBelow = [&] {
+        transport_.receive(rank - 1, &x[index(0, belowFirst)], (j0_ - belowFirst) * rowBytes);
+    };
+    if (above && (!below || upFirst >= j0_)) {
+        sendUp();
+        if (below) receiveBelow();
+    } else {
+        if (below) receiveBelow();
+        if (above) sendUp();
+    }
+
+    const int downLast = std::min(n_ + 1, j0_ + rows - 1);
+    const int aboveLast = std::min(n_ + 1, j1_ + rows);
+    auto sendDown = [&] {
+        transport_.send(rank - 1, &x[index(0, j0_)], (downLast - j0_ + 1) * rowBytes);
+    };
+    auto receiveAbove = [&] {
+        transport_.receive(rank + 1, &x[index(0, j1_ + 1)], (aboveLast - j1_) * rowBytes);
+    };
+    if (below && (!above || downLast <= j1_)) {
+        sendDown();
+        if (above) receiveAbove();
+    } else {
+        if (above) receiveAbove();
+        if (below) sendDown();
+    }
+}
+
+// set_bnd for the rows this rank owns: its column ghosts, and the wall rows
+// and corners on the first and last rank.
+void DomainSolver::set_bnd(int b, std::vector<float>& x) {
+    const int N = n_;
+    for (int j = j0_; j <= j1_; j++) {
+        x[index(0,j)] = b == 1 ? -x[index(1,j)] : x[index(1,j)];
+        x[index(N+1,j)] = b == 1 ? -x[index(N,j)] : x[index(N,j)];
+    }
+    if (bottom()) {
+        for (int i = 1; i <= N; i++) {
+            x[index(i,0)] = b == 2 ? -x[index(i,1)] : x[index(i,1)];
+        }
+        x[index(0,0)] = 0.5f * (x[index(1,0)] + x[index(0,1)]);
+        x[index(N+1,0)] = 0.5f * (x[index(N,0)] + x[index(N+1,1)]);
+    }
+    if (top()) {
+        for (int i = 1; i <= N; i++) {
+            x[index(i,N+1)] = b == 2 ? -x[index(i,N)] : x[index(i,N)];
+        }
+        x[index(0,N+1)] = 0.5f * (x[index(1,N+1)] + x[index(0,N)]);
+        x[index(N+1,N+1)] = 0.5f * (x[index(N,N+1)] + x[index(N+1,N)]);
+    }
+}
+
+void DomainSolver::add_source(std::vector<float>& x, const std::vector<float>& s, float dt) {
+    ProfileScope scope("add_source");
+    for (int k = index(0, ownFirst()); k < index(0, ownLast() + 1); k++) {
+        x[k] += dt * s[k];
+    }
+}
+
+// Red-black sweeps over the owned rows. Each color only reads the other
+// one, so a single halo row exchanged after every color gives the values a
+// single process would see.
+SolveStats DomainSolver::lin_solve(int b, std::vector<float>& x, const std::vector<float>& x0,
+                                   float a, float c, const char* stage) {
+    const float invC = 1.0f / c;
+    auto sweeps = [&](int iters) {
+        ProfileScope scope(stage);
+        const SlabGrid IX{n_, lo_};
+        const int n = n_, first = j0_, last = j1_;
+        float* xp = x.data();
+        const float* x0p = x0.data();
+        for (int k = 0; k < iters; k++) {
+            for (int color = 0; color < 2; color++) {
+                for (int j = first; j <= last; j++) {
+                    for (int i = 1 + ((j + color) & 1); i <= n; i += 2) {
+                        xp[IX(i,j)] = (x0p[IX(i,j)] + a * (xp[IX(i-1,j)] + xp[IX(i+1,j)] +
+                                       xp[IX(i,j-1)] + xp[IX(i,j+1)])) * invC;
+                    }
+                }
+                if (color == 1) {
+                    set_bnd(b, x);
+                }
+                exchange(x, 1);
+            }
+        }
+    };
+
+    exchange(x, 1);
+    SolveStats stats;
+    if (params.tolerance <= 0) {
+        sweeps(params.iterations);
+        stats.iterations = params.iterations;
+        return stats;
+    }
+    const int every = std::max(1, params.checkEvery);
+    while (stats.iterations < params.iterations) {
+        int k = std::min(every, params.iterations - stats.iterations);
+        sweeps(k);
+        stats.iterations += k;
+        stats.residual = residual(x, x0, a, c);
+        if (stats.residual <= params.tolerance) {
+            break;
+        }
+    }
+    return stats;
+}
+
+// RMS residual over the whole grid: each rank sums its rows, the sums are
+// reduced, so every rank takes the same early-exit decision.
+float DomainSolver::residual(const std::vector<float>& x, const std::vector<float>& x0,
+                             float a, float c) {
+    ProfileScope scope("residual");
+    double sum = 0.0;
+    for (int j = j0_; j <= j1_; j++) {
+        for (int i = 1; i <= n_; i++) {
+            float r = x0[index(i,j)] + a * (x[index(i-1,j)] + x[index(i+1,j)] +
+                      x[index(i,j-1)] + x[index(i,j+1)]) - c * x[index(i,j)];
+            sum += double(r) * r;
+        }
+    }
+    sum = transport_.allreduceSum(sum);
+    return float(std::sqrt(sum / (double(n_) * n_)));
+}
+
+void DomainSolver::diffuse(int b, std::vector<float>& x, std::vector<float>& x0,
+                           float diff, float dt) {
+    float a = dt * diff * n_ * n_;
+    lastDiffuse = lin_solve(b, x, x0, a, 1 + 4 * a, "diffuse_sweeps");
+}
+
+// The halo is deepened to cover the longest backtrace on any rank before
+// d0 is exchanged.
+void DomainSolver::advect(int b, std::vector<float>& d, std::vector<float>& d0,
+                          std::vector<float>& u, std::vector<float>& v, float dt) {
+    ProfileScope scope("advect");
+    const float dt0 = dt * n_;
+    float maxV = 0.0f;
+    for (int j = j0_; j <= j1_; j++) {
+        for (int i = 1; i <= n_; i++) {
+            maxV = std::max(maxV, std::fabs(v[index(i,j)]));
+        }
+    }
+    float reach = dt0 * transport_.allreduceMax(maxV);
+    // Sampled rows lie within floor(j - reach) .. floor(j + reach) + 1.
+    int rows = reach < n_ ? (int)std::ceil(reach) + 2 : n_ + 1;
+    reserveHalo(rows);
+    exchange(d0, std::min(rows, depth_));
+
+    SlabGrid IX{n_, lo_};
+    for (int j = j0_; j <= j1_; j++) {
+        for (int i = 1; i <= n_; i++) {
+            d[index(i,j)] = advect_cell(IX, i, j, d0.data(), u.data(), v.data(), dt0);
+        }
+    }
+    set_bnd(b, d);
+}
+
+void DomainSolver::project(std::vector<float>& u, std::vector<float>& v,
+                           std::vector<float>& p, std::vector<float>& div) {
+    ProfileScope scope("project");
+    const float h = 1.0f / n_;
+    {
+        ProfileScope divergence("divergence");
+        exchange(v, 1);
+        for (int j = j0_; j <= j1_; j++) {
+            for (int i = 1; i <= n_; i++) {
+                div[index(i,j)] = -0.5f * h * (u[index(i+1,j)] - u[index(i-1,j)] +
+                                               v[index(i,j+1)] - v[index(i,j-1)]);
+                p[index(i,j)] = 0;
+            }
+        }
+        set_bnd(0, div);
+        set_bnd(0, p);
+    }
+    lastPressure = lin_solve(0, p, div, 1, 4, "pressure_sweeps");
+    ProfileScope gradient("subtract_gradient");
+    for (int j = j0_; j <= j1_; j++) {
+        for (int i = 1; i <= n_; i++) {
+            u[index(i,j)] -= 0.5f * (p[index(i+1,j)] - p[index(i-1,j)]) / h;
+            v[index(i,j)] -= 0.5f * (p[index(i,j+1)] - p[index(i,j-1)]) / h;
+        }
+    }
+    set_bnd(1, u);
+    set_bnd(2, v);
+}
+
+void DomainSolver::vel_step(float visc, float dt) {
+    ProfileScope scope("vel_step");
+    std::vector<float>& u0 = u_prev;
+    std::vector<float>& v0 = v_prev;
+    add_source(u, u0, dt);
+    add_source(v, v0, dt);
+    SWAP(u0, u);
+    diffuse(1, u, u0, visc, dt);
+    SWAP(v0, v);
+    diffuse(2, v, v0, visc, dt);
+    project(u, v, u0, v0);
+    SWAP(u0, u);
+    SWAP(v0, v);
+    advect(1, u, u0, u, v, dt);
+    advect(2, v, v0, u, v, dt);
+    project(u, v, u0, v0);
+}
+
+void DomainSolver::dens_step(float diff, float dt) {
+    ProfileScope scope("dens_step");
+    std::vector<float>& x = dens;
+    std::vector<float>& x0 = dens_prev;
+    add_source(x, x0, dt);
+    SWAP(x0, x);
+    diffuse(0, x, x0, diff, dt);
+    SWAP(x0, x);
+    advect(0, x, x0, u, v, dt);
+}
+
+// Every rank sees every splat and keeps the cells in its own rows.
+void DomainSolver::rasterize(std::vector<Splat>& splats) {
+    ProfileScope scope("splats");
+    merge_splats(splats);
+    const int stride = n_ + 2;
+    for_each_splat_sum(n_, splats, [&](int k, float du, float dv, float density) {
+        int j = k / stride;
+        if (j < j0_ || j > j1_) {
+            return;
+        }
+        int l = index(k % stride, j);
+        u_prev[l] += du;
+        v_prev[l] += dv;
+        dens_prev[l] += density;
+    });
+}
+
+void DomainSolver::updateFluid(float dt) {
+    ProfileScope scope("step");
+    simulationTime += dt;
+    // Queued splats first, then the built-in source, as FluidSolver drains them.
+    pendingSplats_.push_back(circular_source(n_, simulationTime, dt));
+    rasterize(pendingSplats_);
+    pendingSplats_.clear();
+    vel_step(params.visc, dt);
+    dens_step(params.diff, dt);
+    ProfileScope clear("clear_sources");
+    std::fill(u_prev.begin(), u_prev.end(), 0.0f);
+    std::fill(v_prev.begin(), v_prev.end(), 0.0f);
+    std::fill(dens_prev.begin(), dens_prev.end(), 0.0f);
+}
+
+// Slabs travel down the rank chain; each rank forwards everything above it
+// after its own rows.
+void DomainSolver::gatherDensity(std::vector<float>& out) {
+    ProfileScope scope("gather");
+    const int rank = transport_.rank();
+    const size_t rowBytes = (n_ + 2) * sizeof(float);
+    const int aboveRows = n_ + 1 - ownLast();
+    if (rank == 0) {
+        out.resize(Grid<0>{n_}.size());
+        std::copy(dens.begin() + index(0, 0), dens.begin() + index(0, ownLast() + 1),
+                  out.begin());
+        if (aboveRows > 0) {
+            transport_.receive(1, &out[(ownLast() + 1) * (n_ + 2)], aboveRows * rowBytes);
+        }
+        return;
+    }
+    std::vector<float> above(aboveRows * (n_ + 2));
+    if (aboveRows > 0) {
+        transport_.receive(rank + 1, above.data(), aboveRows * rowBytes);
+    }
+    transport_.send(rank - 1, &dens[index(0, ownFirst())],
+                    (ownLast() - ownFirst() + 1) * rowBytes);
+    transport_.send(rank - 1, above.data(), aboveRows * rowBytes);
+}
@@ -0,0 +1,79 @@
+#ifndef DOMAIN_SOLVER_HPP
+#define DOMAIN_SOLVER_HPP
+#include <vector>
+#include "fluid.hpp"
+#include "halo_exchange.hpp"
+
+// One horizontal slab of an N x N simulation split across the ranks of a
+// HaloTransport. Rank r owns the interior rows row_band(n, ranks, r) and,
+// on the first and last rank, the wall rows 0 and N+1. Each field stores
+// the owned rows plus up to haloDepth() neighbor rows on either side;
+// stencils exchange one halo row after every half sweep, advection
+// exchanges as many rows as the fastest backtrace reaches.
+//
+// Every rank constructs one with the same n and params and calls the same
+// methods in the same order. The step is FluidSolver's with red-black
+// relaxation; with tolerance == 0 the gathered fields match a FluidSolver
+// using Relaxation::RedBlack bit for bit, for any rank count. With a
+// tolerance, the residual is reduced across ranks once per check.
+// relaxation, threads, simd, advection, pressureSolver, warmStart,
+// activeTiles and storage are ignored.
+class DomainSolver {
+public:
+    DomainSolver(int n, HaloTransport& transport, const FluidParams& params = FluidParams());
+
+    int n() const { return n_; }
+    int firstRow() const { return j0_; }
+    int lastRow() const { return j1_; }
+    int haloDepth() const { return depth_; }
+
+    void initFluid();
+    // Queued for the next updateFluid(); call with the same splats on every rank.
+    void addSplat(const Splat& splat) { pendingSplats_.push_back(splat); }
+    void updateFluid(float dt);
+    // Collective. Rank 0 receives the whole (N+2)^2 density, other ranks
+    // leave out untouched.
+    void gatherDensity(std::vector<float>& out);
+
+    FluidParams params;
+    float simulationTime = 0.0f;
+    SolveStats lastDiffuse, lastPressure;
+
+private:
+    int index(int i, int j) const { return i + (n_ + 2) * (j - lo_); }
+    bool bottom() const { return j0_ == 1; }
+    bool top() const { return j1_ == n_; }
+    int ownFirst() const { return bottom() ? 0 : j0_; }
+    int ownLast() const { return top() ? n_ + 1 : j1_; }
+
+    void vel_step(float visc, float dt);
+    void dens_step(float diff, float dt);
+    void rasterize(std::vector<Splat>& splats);
+    void set_bnd(int b, std::vector<float>& x);
+    void add_source(std::vector<float>& x, const std::vector<float>& s, float dt);
+    void diffuse(int b, std::vector<float>& x, std::vector<float>& x0, float diff, float dt);
+    void advect(int b, std::vector<float>& d, std::vector<float>& d0,
+                std::vector<float>& u, std::vector<float>& v, float dt);
+    void project(std::vector<float>& u, std::vector<float>& v,
+                 std::vector<float>& p, std::vector<float>& div);
+    SolveStats lin_solve(int b, std::vector<float>& x, const std::vector<float>& x0,
+                         float a, float c, const char* stage);
+    float residual(const std::vector<float>& x, const std::vector<float>& x0,
+                   float a, float c);
+    // Refreshes `rows` halo rows on both sides from the neighbors.
+    void exchange(std::vector<float>& x, int rows);
+    // Grows the stored halo to at least `rows`.
+    void reserveHalo(int rows);
+
+    HaloTransport& transport_;
+    int n_;
+    int j0_, j1_;      // owned interior rows
+    int depth_ = 0;    // halo rows stored on each side
+    int lo_, hi_;      // stored rows, clamped to 0..N+1
+
+    std::vector<float> u, v, u_prev, v_prev;
+    std::vector<float> dens, dens_prev;
+    std::vector<Splat> pendingSplats_;
+};
+
+#endif
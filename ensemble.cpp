@@ -0,0 +1,303 @@
+#include "ensemble.hpp"
+#include "profiler.hpp"
+#include "utils.hpp"
+#include <algorithm>
+
+// Each kernel mirrors its FluidSolver counterpart operation for operation,
+// with the per-instance loop innermost over lanes [m0, m1).
+namespace {
+
+struct Lanes {
+    int n, count, m0, m1;
+    int operator()(int i, int j) const { return (i + (n + 2) * j) * count; }
+};
+
+void set_bnd(const Lanes& L, int b, float* x) {
+    const int N = L.n;
+    const float sx = b == 1 ? -1.0f : 1.0f;
+    const float sy = b == 2 ? -1.0f : 1.0f;
+    for (int i = 1; i <= N; i++) {
+        for (int m = L.m0; m < L.m1; m++) {
+            x[L(0,i) + m] = sx * x[L(1,i) + m];
+            x[L(N+1,i) + m] = sx * x[L(N,i) + m];
+            x[L(i,0) + m] = sy * x[L(i,1) + m];
+            x[L(i,N+1) + m] = sy * x[L(i,N) + m];
+        }
+    }
+    for (int m = L.m0; m < L.m1; m++) {
+        x[L(0,0) + m] = 0.5f * (x[L(1,0) + m] + x[L(0,1) + m]);
+        x[L(0,N+1) + m] = 0.5f * (x[L(1,N+1) + m] + x[L(0,N) + m]);
+        x[L(N+1,0) + m] = 0.5f * (x[L(N,0) + m] + x[L(N+1,1) + m]);
+        x[L(N+1,N+1) + m] = 0.5f * (x[L(N,N+1) + m] + x[L(N+1,N) + m]);
+    }
+}
+
+void add_source(const Lanes& L, float* x, const float* s, float dt) {
+    const int cells = (L.n + 2) * (L.n + 2);
+    for (int k = 0; k < cells; k++) {
+        for (int m = L.m0; m < L.m1; m++) {
+            x[k * L.count + m] += dt * s[k * L.count + m];
+        }
+    }
+}
+
+void clear(const Lanes& L, float* x) {
+    const int cells = (L.n + 2) * (L.n + 2);
+    for (int k = 0; k < cells; k++) {
+        std::fill(x + k * L.count + L.m0, x + k * L.count + L.m1, 0.0f);
+    }
+}
+
+void lin_solve(const Lanes& L, int b, float* x, const float* x0,
+               const float* a, const float* c, int iters) {
+    const int N = L.n;
+    for (int k = 0; k < iters; k++) {
+        for (int i = 1; i <= N; i++) {
+            for (int j = 1; j <= N; j++) {
+                float* xc = x + L(i,j);
+                const float* l = x + L(i-1,j);
+                const float* r = x + L(i+1,j);
+                const float* d = x + L(i,j-1);
+                const float* u = x + L(i,j+1);
+                const float* s = x0 + L(i,j);
+                for (int m = L.m0; m < L.m1; m++) {
+                    xc[m] = (s[m] + a[m] * (l[m] + r[m] + d[m] + u[m])) / c[m];
+                }
+            }
+        }
+        set_bnd(L, b, x);
+    }
+}
+
+void pressure_gs(const Lanes& L, float* p, const float* div, int iters) {
+    const int N = L.n;
+    for (int k = 0; k < iters; k++) {
+        for (int i = 1; i <= N; i++) {
+            for (int j = 1; j <= N; j++) {
+                float* pc = p + L(i,j);
+                const float* l = p + L(i-1,j);
+                const float* r = p + L(i+1,j);
+                const float* d = p + L(i,j-1);
+                const float* u = p + L(i,j+1);
+                const float* s = div + L(i,j);
+                for (int m = L.m0; m < L.m1; m++) {
+                    pc[m] = (s[m] + l[m] + r[m] + d[m] + u[m]) / 4;
+                }
+            }
+        }
+        set_bnd(L, 0, p);
+    }
+}
+
+// advect_cell() across lanes: the backtrace of a chunk of lanes runs first,
+// over contiguous u and v, leaving each lane's lower-left corner and
+// fractions; the bilinear blend then gathers d0 at those corners.
+void advect(const Lanes& L, int b, float* d, const float* d0,
+            const float* u, const float* v, float dt) {
+    const int N = L.n;
+    float dt0 = dt * N;
+    const float lo = 0.5f;
+    const float hi = N + 0.5f;
+    const int right = L.count;           // (i+1,j) - (i,j)
+    const int up = (N + 2) * L.count;    // (i,j+1) - (i,j)
+    const int chunk = 64;
+    int corner[chunk];
+    float s1[chunk], t1[chunk];
+    for (int j = 1; j <= N; j++) {
+        for (int i = 1; i <= N; i++) {
+            const float* uc = u + L(i,j);
+            const float* vc = v + L(i,j);
+            float* dc = d + L(i,j);
+            for (int m0 = L.m0; m0 < L.m1; m0 += chunk) {
+                const int lanes = std::min(chunk, L.m1 - m0);
+                for (int k = 0; k < lanes; k++) {
+                    float x = i - dt0 * uc[m0 + k];
+                    float y = j - dt0 * vc[m0 + k];
+                    x = x < lo ? lo : x;
+                    x = x > hi ? hi : x;
+                    y = y < lo ? lo : y;
+                    y = y > hi ? hi : y;
+                    const int i0 = (int)x;
+                    const int j0 = (int)y;
+                    s1[k] = x - i0;
+                    t1[k] = y - j0;
+                    corner[k] = L(i0,j0) + m0 + k;
+                }
+                for (int k = 0; k < lanes; k++) {
+                    const float* p = d0 + corner[k];
+                    const float s0 = 1 - s1[k];
+                    const float t0 = 1 - t1[k];
+                    dc[m0 + k] = s0 * (t0 * p[0] + t1[k] * p[up]) +
+                                 s1[k] * (t0 * p[right] + t1[k] * p[right + up]);
+                }
+            }
+        }
+    }
+    set_bnd(L, b, d);
+}
+
+void project(const Lanes& L, float* u, float* v, float* p, float* div, int iters) {
+    const int N = L.n;
+    float h = 1.0f / N;
+    for (int j = 1; j <= N; j++) {
+        for (int i = 1; i <= N; i++) {
+            for (int m = L.m0; m < L.m1; m++) {
+                div[L(i,j) + m] = -0.5f * h * (u[L(i+1,j) + m] - u[L(i-1,j) + m] +
+                                               v[L(i,j+1) + m] - v[L(i,j-1) + m]);
+                p[L(i,j) + m] = 0;
+            }
+        }
+    }
+    set_bnd(L, 0, div);
+    set_bnd(L, 0, p);
+    pressure_gs(L, p, div, iters);
+    for (int j = 1; j <= N; j++) {
+        for (int i = 1; i <= N; i++) {
+            for (int m = L.m0; m < L.m1; m++) {
+                u[L(i,j) + m] -= 0.5f * (p[L(i+1,j) + m] - p[L(i-1,j) + m]) / h;
+                v[L(i,j) + m] -= 0.5f * (p[L(i,j+1) + m] - p[L(i,j-1) + m]) / h;
+            }
+        }
+    }
+    set_bnd(L, 1, u);
+    set_bnd(L, 2, v);
+}
+
+} // namespace
+
+Ensemble::Ensemble(int n, const std::vector<InstanceParams>& instances, const FluidParams& shared)
+    : shared(shared), n_(n), m_((int)instances.size()), instances_(instances),
+      u_((size_t)Grid<0>{n}.size() * m_), v_(u_.size()), uPrev_(u_.size()),
+      vPrev_(u_.size()), dens_(u_.size()), densPrev_(u_.size()) {}
+
+void Ensemble::step() {
+    ProfileScope scope("ensemble_step");
+    simulationTime += shared.dt;
+    int threads = std::max(1, shared.threads);
+    if (threads == 1) {
+        stepLanes(0, m_);
+        return;
+    }
+    if (!pool_ || pool_->size() != threads) {
+        pool_.reset(new ThreadPool(threads));
+    }
+    // Hand out whole cache lines of instances so workers never share one.
+    const int block = 16;
+    const int blocks = (m_ + block - 1) / block;
+    pool_->run([&](int worker) {
+        int first = (int)((int64_t)blocks * worker / threads) * block;
+        int last = std::min(m_, (int)((int64_t)blocks * (worker + 1) / threads) * block);
+        if (first < last) {
+            stepLanes(first, last);
+        }
+    });
+}
+
+void Ensemble::stepLanes(int first, int last) {
+    const int N = n_;
+    const float dt = shared.dt;
+    const Lanes L{N, m_, first, last};
+
+    // Per-instance coefficients, indexed by instance like the fields.
+    std::vector<float> coef(6 * (size_t)m_);
+    float* viscA = coef.data();
+    float* viscC = viscA + m_;
+    float* diffA = viscC + m_;
+    float* diffC = diffA + m_;
+    float* radius = diffC + m_;
+    float* on = radius + m_;
+    std::vector<float> amount(3 * (size_t)m_);
+    float* srcU = amount.data();
+    float* srcV = srcU + m_;
+    float* srcD = srcV + m_;
+    float maxRadius = 0.0f;
+    for (int m = first; m < last; m++) {
+        const InstanceParams& ip = instances_[m];
+        viscA[m] = dt * ip.visc * N * N;
+        viscC[m] = 1 + 4 * viscA[m];
+        diffA[m] = dt * ip.diff * N * N;
+        diffC[m] = 1 + 4 * diffA[m];
+        float direction = fmod(simulationTime * ip.rotationSpeed, 2.0f * M_PI);
+        srcU[m] = ip.sourceVelocity * std::cos(direction) * dt;
+        srcV[m] = ip.sourceVelocity * std::sin(direction) * dt;
+        srcD[m] = ip.sourceDensity * dt;
+        radius[m] = ip.sourceRadius;
+        on[m] = simulationTime >= ip.sourceStart && simulationTime < ip.sourceStop ? 1.0f : 0.0f;
+        maxRadius = std::max(maxRadius, ip.sourceRadius);
+    }
+
+    float* u = u_.data();
+    float* v = v_.data();
+    float* u0 = uPrev_.data();
+    float* v0 = vPrev_.data();
+    float* x = dens_.data();
+    float* x0 = densPrev_.data();
+
+    // Sources: the disk around the grid center, masked per instance.
+    float center = N * 0.5f + 1.0f;
+    int lo = std::max(1, static_cast<int>(center - maxRadius));
+    int hi = std::min(N, static_cast<int>(center + maxRadius));
+    for (int j = lo; j <= hi; j++) {
+        for (int i = lo; i <= hi; i++) {
+            float dx = (i - center);
+            float dy = (j - center);
+            float distance = std::sqrt(dx * dx + dy * dy);
+            for (int m = first; m < last; m++) {
+                float w = distance <= radius[m] ? on[m] : 0.0f;
+                u0[L(i,j) + m] += srcU[m] * w;
+                v0[L(i,j) + m] += srcV[m] * w;
+                x0[L(i,j) + m] += srcD[m] * w;
+            }
+        }
+    }
+
+    // Velocity, as FluidSolver::vel_step
+    add_source(L, u, u0, dt);
+    add_source(L, v, v0, dt);
+    std::swap(u0, u);
+    lin_solve(L, 1, u, u0, viscA, viscC, shared.iterations);
+    std::swap(v0, v);
+    lin_solve(L, 2, v, v0, viscA, viscC, shared.iterations);
+    project(L, u, v, u0, v0, shared.iterations);
+    std::swap(u0, u);
+    std::swap(v0, v);
+    advect(L, 1, u, u0, u, v, dt);
+    advect(L, 2, v, v0, u, v, dt);
+    project(L, u, v, u0, v0, shared.iterations);
+
+    // Density, as FluidSolver::dens_step
+    add_source(L, x, x0, dt);
+    std::swap(x0, x);
+    lin_solve(L, 0, x, x0, diffA, diffC, shared.iterations);
+    std::swap(x0, x);
+    advect(L, 0, x, x0, u, v, dt);
+
+    clear(L, u0);
+    clear(L, v0);
+    clear(L, x0);
+}
+
+InstanceStats Ensemble::stats(int m) const {
+    const Lanes L{n_, m_, m, m + 1};
+    InstanceStats s;
+    for (int j = 1; j <= n_; j++) {
+        for (int i = 1; i <= n_; i++) {
+            float d = dens_[L(i,j) + m];
+            float uu = u_[L(i,j) + m];
+            float vv = v_[L(i,j) + m];
+            s.mass += d;
+            s.kineticEnergy += 0.5 * (double(uu) * uu + double(vv) * vv);
+            s.maxDensity = std::max(s.maxDensity, d);
+            s.maxSpeed = std::max(s.maxSpeed, std::sqrt(uu * uu + vv * vv));
+        }
+    }
+    return s;
+}
+
+void Ensemble::sampleDensity(int m, std::vector<float>& out) const {
+    const int cells = Grid<0>{n_}.size();
+    out.resize(cells);
+    for (int k = 0; k < cells; k++) {
+        out[k] = dens_[(size_t)k * m_ + m];
+    }
+}
@@ -0,0 +1,64 @@
+#ifndef ENSEMBLE_HPP
+#define ENSEMBLE_HPP
+#include <cmath>
+#include <memory>
+#include <vector>
+#include "fluid.hpp"
+
+// Settings one ensemble member may vary. The source is the rotating disk of
+// FluidSolver::add_fixed_circular_source, injected while simulationTime is
+// in [sourceStart, sourceStop).
+struct InstanceParams {
+    float visc = 0.001f;
+    float diff = 0.0001f;
+    float sourceDensity = 500.0f;
+    float sourceVelocity = 50.0f;
+    float rotationSpeed = 0.5f;
+    float sourceRadius = 5.0f;
+    float sourceStart = 0.0f;
+    float sourceStop = INFINITY;
+};
+
+struct InstanceStats {
+    double mass = 0;            // sum of density over interior cells
+    double kineticEnergy = 0;   // 0.5 * sum(u^2 + v^2)
+    float maxDensity = 0;
+    float maxSpeed = 0;
+};
+
+// Steps M independent N x N simulations together. Every field stores the M
+// values of a cell next to each other (index IX(i,j) * M + m), so the inner
+// loop of each kernel runs across instances with no per-instance branching.
+// Each instance follows FluidSolver's default step exactly: with the same
+// params its fields match a FluidSolver bit for bit.
+//
+// dt, iterations and threads come from the shared FluidParams; the other
+// shared settings are ignored. Workers take disjoint blocks of instances and
+// step them without synchronizing.
+class Ensemble {
+public:
+    Ensemble(int n, const std::vector<InstanceParams>& instances,
+             const FluidParams& shared = FluidParams());
+
+    int n() const { return n_; }
+    int instances() const { return m_; }
+    const InstanceParams& instance(int m) const { return instances_[m]; }
+
+    void step();
+    InstanceStats stats(int m) const;
+    // Copies one instance's density, (N+2)^2 values in FluidSolver layout.
+    void sampleDensity(int m, std::vector<float>& out) const;
+
+    FluidParams shared;
+    float simulationTime = 0.0f;
+
+private:
+    void stepLanes(int first, int last);
+
+    int n_, m_;
+    std::vector<InstanceParams> instances_;
+    std::vector<float> u_, v_, uPrev_, vPrev_, dens_, densPrev_;
+    std::unique_ptr<ThreadPool> pool_;
+};
+
+#endif
@@ -1,30 +1,384 @@
 #include "fluid.hpp"
+#include "advect.hpp"
+#include "profiler.hpp"
+#include "relax.hpp"
 #include "utils.hpp"
 #include <algorithm>
 #include <cmath>
 
-// Simulation parameters
-float dt = 0.01f;
-float diff = 0.0001f;
-float visc = 0.001f;
+// Kernels are written once against a Grid and instantiated both for a
+// runtime N and for each production size, where N and the row stride are
+// compile-time constants.
+namespace {
 
-// Fluid data
-std::vector<float> u(SIZE), v(SIZE), u_prev(SIZE), v_prev(SIZE);
-std::vector<float> dens(SIZE), dens_prev(SIZE);
+// The solid-cell paths of the Gauss-Seidel row loops, kept out of line with
+// everything passed by value like relax_fluid_runs() in relax.cpp.
+void relax_fluid_runs(const ObstacleMap& solids, int j, int n, const float* down, float* row,
+                      const float* up, const float* rhs, float a, float c) {
+    solids.forEachRun(j, 1, n, [=](int lo, int hi, bool solid) {
+        if (solid) {
+            return;
+        }
+        for (int i = lo; i <= hi; i++) {
+            row[i] = (rhs[i] + a * (row[i-1] + row[i+1] + down[i] + up[i])) / c;
+        }
+    });
+}
+
+void pressure_fluid_runs(const ObstacleMap& solids, int j, int n, const float* down,
+                         float* row, const float* up, const float* rhs) {
+    solids.forEachRun(j, 1, n, [=](int lo, int hi, bool solid) {
+        if (solid) {
+            return;
+        }
+        for (int i = lo; i <= hi; i++) {
+            row[i] = (rhs[i] + row[i-1] + row[i+1] + down[i] + up[i]) / 4;
+        }
+    });
+}
+
+// Line buffers the Gauss-Seidel kernels below need, on top of relax_lines().
+const int kGaussSeidelLines = 6;
+
+// One Gauss-Seidel sweep in row order: every cell reads its left and lower
+// neighbors already relaxed this sweep, its right and upper ones not yet.
+// Rows are taken in pairs, the upper one a cell behind, so the two chains
+// through row[i-1] overlap; each cell still reads exactly the neighbors row
+// order gives it. Rows with solid cells go one at a time through fluid(),
+// the run-walking path. lines holds kGaussSeidelLines rows.
+template <class G, class Rows, class Update, class Fluid>
+void gauss_seidel_sweep(G IX, Rows x, Rows x0, const ObstacleMap* solids, float* lines,
+                        Update update, Fluid fluid) {
+    const int N = IX.n();
+    const int S = IX.stride();
+    int j = 1;
+    for (; !solids && j < N; j += 2) {
+        const float* down = x.row(j - 1, lines);
+        float* row = x.edit(j, lines + S);
+        float* next = x.edit(j + 1, lines + 2 * S);
+        const float* up = x.row(j + 2, lines + 3 * S);
+        const float* rhs = x0.row(j, lines + 4 * S);
+        const float* rhsNext = x0.row(j + 1, lines + 5 * S);
+        row[1] = update(rhs[1], row[0], row[2], down[1], next[1]);
+        for (int i = 2; i <= N; i++) {
+            row[i] = update(rhs[i], row[i-1], row[i+1], down[i], next[i]);
+            next[i-1] = update(rhsNext[i-1], next[i-2], next[i], row[i-1], up[i-1]);
+        }
+        next[N] = update(rhsNext[N], next[N-1], next[N+1], row[N], up[N]);
+        x.store(j, row, 1, N);
+        x.store(j + 1, next, 1, N);
+    }
+    for (; j <= N; j++) {
+        const float* down = x.row(j - 1, lines);
+        float* row = x.edit(j, lines + S);
+        const float* up = x.row(j + 1, lines + 2 * S);
+        const float* rhs = x0.row(j, lines + 3 * S);
+        if (solids) {
+            fluid(j, down, row, up, rhs);
+        } else {
+            for (int i = 1; i <= N; i++) {
+                row[i] = update(rhs[i], row[i-1], row[i+1], down[i], up[i]);
+            }
+        }
+        x.store(j, row, 1, N);
+    }
+}
+
+// Gauss-Seidel for x = (x0 + a * sum(neighbors)) / c. Solid cells are
+// skipped; the boundary ones are set after every sweep, as in relax.hpp.
+template <class G, class Rows>
+void lin_solve(G IX, int b, Rows x, Rows x0, float a, float c, int iters,
+               const ObstacleMap* solids, float* lines) {
+    const int N = IX.n();
+    for (int k = 0; k < iters; k++) {
+        gauss_seidel_sweep(IX, x, x0, solids, lines,
+            [=](float rhs, float left, float right, float down, float up) {
+                return (rhs + a * (left + right + down + up)) / c;
+            },
+            [=](int j, const float* down, float* row, const float* up, const float* rhs) {
+                relax_fluid_runs(*solids, j, N, down, row, up, rhs, a, c);
+            });
+        if (solids) {
+            solids->apply(b, x);
+        }
+        set_bnd(IX, b, x);
+    }
+}
+
+// The pressure case a = 1, c = 4, spelled out so the divide folds.
+template <class G, class Rows>
+void pressure_gs(G IX, int, Rows p, Rows div, float, float, int iters,
+                 const ObstacleMap* solids, float* lines) {
+    const int N = IX.n();
+    for (int k = 0; k < iters; k++) {
+        gauss_seidel_sweep(IX, p, div, solids, lines,
+            [](float rhs, float left, float right, float down, float up) {
+                return (rhs + left + right + down + up) / 4;
+            },
+            [=](int j, const float* down, float* row, const float* up, const float* rhs) {
+                pressure_fluid_runs(*solids, j, N, down, row, up, rhs);
+            });
+        if (solids) {
+            solids->apply(0, p);
+        }
+        set_bnd(IX, 0, p);
+    }
+}
+
+// Returns the largest u^2 + v^2 it read. Cells are sampled in place; only
+// the output row goes through lines.
+template <class G, class Rows>
+float advect(G IX, int b, Rows d, Rows d0, Rows u, Rows v, float dt, float* lines) {
+    const int N = IX.n();
+    float dt0 = dt * N;
+    float maxSq = 0.0f;
+    for (int j = 1; j <= N; j++) {
+        float* out = d.out(j, lines);
+        for (int i = 1; i <= N; i++) {
+            maxSq = std::max(maxSq, u[IX(i,j)] * u[IX(i,j)] + v[IX(i,j)] * v[IX(i,j)]);
+            out[i] = advect_cell(IX, i, j, d0, u, v, dt0);
+        }
+        d.store(j, out, 1, N);
+    }
+    set_bnd(IX, b, d);
+    return maxSq;
+}
+
+// Also zeroes p unless it is null (warm-started solves keep the old field).
+template <class G, class Rows>
+void divergence(G IX, Rows u, Rows v, const Rows* p, Rows div, float* lines) {
+    const int N = IX.n();
+    const int S = IX.stride();
+    float h = 1.0f / N;
+    for (int j = 1; j <= N; j++) {
+        const float* row = u.row(j, lines);
+        const float* down = v.row(j - 1, lines + S);
+        const float* up = v.row(j + 1, lines + 2 * S);
+        float* out = div.out(j, lines + 3 * S);
+        for (int i = 1; i <= N; i++) {
+            out[i] = -0.5f * h * (row[i+1] - row[i-1] + up[i] - down[i]);
+        }
+        div.store(j, out, 1, N);
+        if (p) p->clear(IX(1,j), IX(N,j));
+    }
+    set_bnd(IX, 0, div);
+    if (p) set_bnd(IX, 0, *p);
+}
+
+template <class G, class Rows>
+void subtract_gradient(G IX, Rows u, Rows v, Rows p, float* lines) {
+    const int N = IX.n();
+    const int S = IX.stride();
+    float h = 1.0f / N;
+    for (int j = 1; j <= N; j++) {
+        const float* down = p.row(j - 1, lines);
+        const float* row = p.row(j, lines + S);
+        const float* up = p.row(j + 1, lines + 2 * S);
+        float* ur = u.edit(j, lines + 3 * S);
+        float* vr = v.edit(j, lines + 4 * S);
+        for (int i = 1; i <= N; i++) {
+            ur[i] -= 0.5f * (row[i+1] - row[i-1]) / h;
+            vr[i] -= 0.5f * (up[i] - down[i]) / h;
+        }
+        u.store(j, ur, 1, N);
+        v.store(j, vr, 1, N);
+    }
+    set_bnd(IX, 1, u);
+    set_bnd(IX, 2, v);
+}
+
+// Fine-grid passes of one multigrid cycle: smoothing sweeps, the residual
+// and the prolongation. Coarse levels are not counted.
+int multigrid_passes(const MultigridSettings& mg) {
+    return mg.preSmooth + mg.postSmooth + 2;
+}
+
+} // namespace
+
+// Kernels over one row accessor type; lines holds FluidSolver::lines().
+template <class Rows>
+struct FluidKernels {
+    typedef void (*LinSolve)(int n, int b, Rows x, Rows x0, float a, float c, int iters,
+                             const ObstacleMap* solids, float* lines);
+    bool specialized;
+    void (*set_bnd)(int n, int b, Rows x);
+    void (*add_source)(int n, Rows x, Rows s, float dt, float* lines);
+    LinSolve lin_solve;
+    LinSolve pressure_gs;
+    float (*advect)(int n, int b, Rows d, Rows d0, Rows u, Rows v, float dt, float* lines);
+    void (*divergence)(int n, Rows u, Rows v, const Rows* p, Rows div, float* lines);
+    void (*subtract_gradient)(int n, Rows u, Rows v, Rows p, float* lines);
+};
+
+template <int FixedN, class Rows>
+struct KernelTable {
+    static void set_bnd(int n, int b, Rows x) {
+        ::set_bnd(Grid<FixedN>{n}, b, x);
+    }
+    static void add_source(int n, Rows x, Rows s, float dt, float* lines) {
+        ::add_source(Grid<FixedN>{n}, x, s, dt, lines);
+    }
+    static void lin_solve(int n, int b, Rows x, Rows x0, float a, float c, int iters,
+                          const ObstacleMap* solids, float* lines) {
+        ::lin_solve(Grid<FixedN>{n}, b, x, x0, a, c, iters, solids, lines);
+    }
+    static void pressure_gs(int n, int b, Rows x, Rows x0, float a, float c, int iters,
+                            const ObstacleMap* solids, float* lines) {
+        ::pressure_gs(Grid<FixedN>{n}, b, x, x0, a, c, iters, solids, lines);
+    }
+    static float advect(int n, int b, Rows d, Rows d0, Rows u, Rows v, float dt,
+                        float* lines) {
+        return ::advect(Grid<FixedN>{n}, b, d, d0, u, v, dt, lines);
+    }
+    static void divergence(int n, Rows u, Rows v, const Rows* p, Rows div, float* lines) {
+        ::divergence(Grid<FixedN>{n}, u, v, p, div, lines);
+    }
+    static void subtract_gradient(int n, Rows u, Rows v, Rows p, float* lines) {
+        ::subtract_gradient(Grid<FixedN>{n}, u, v, p, lines);
+    }
+    static constexpr FluidKernels<Rows> table = {
+        FixedN != 0, set_bnd, add_source, lin_solve, pressure_gs, advect,
+        divergence, subtract_gradient
+    };
+};
+
+template <class Rows>
+static const FluidKernels<Rows>* selectKernels(int n) {
+    switch (n) {
+    case 128: return &KernelTable<128, Rows>::table;
+    case 256: return &KernelTable<256, Rows>::table;
+    case 512: return &KernelTable<512, Rows>::table;
+    case 1024: return &KernelTable<1024, Rows>::table;
+    default: return &KernelTable<0, Rows>::table;
+    }
+}
+
+FluidSolver::FluidSolver(int n, const FluidParams& params)
+    : params(params),
+      u(Grid<0>{n}.size()), v(u.size()), u_prev(u.size()), v_prev(u.size()),
+      dens(u.size()), dens_prev(u.size()),
+      n_(n), kernels_(selectKernels<FloatRows>(n)), packedKernels_(selectKernels<PackedRows>(n)),
+      multigrid_(n), obstacles_(n) {}
+
+bool FluidSolver::specialized() const {
+    return kernels_->specialized;
+}
+
+template <>
+FluidSolver::Fields<float> FluidSolver::fields() {
+    return {u, v, u_prev, v_prev, dens, dens_prev, pressure_, scratch_};
+}
+
+template <>
+FluidSolver::Fields<uint16_t> FluidSolver::fields() {
+    PackedFields& f = *packed_;
+    return {f.u, f.v, f.u_prev, f.v_prev, f.dens, f.dens_prev, f.pressure, f.scratch};
+}
+
+template <>
+const FluidKernels<FloatRows>& FluidSolver::kernels() const {
+    return *kernels_;
+}
+
+template <>
+const FluidKernels<PackedRows>& FluidSolver::kernels() const {
+    return *packedKernels_;
+}
+
+FloatRows FluidSolver::rows(const std::vector<float>& x) const {
+    return FloatRows{const_cast<float*>(x.data()), n_ + 2};
+}
+
+PackedRows FluidSolver::rows(const std::vector<uint16_t>& x) const {
+    return PackedRows(const_cast<uint16_t*>(x.data()), n_ + 2,
+                      packed_ ? packed_->storage : params.storage, params.simd);
+}
+
+float* FluidSolver::lines() const {
+    lines_.resize(std::max(relax_lines(std::max(1, params.threads), n_),
+                           size_t(kGaussSeidelLines) * (n_ + 2)));
+    return lines_.data();
+}
+
+void FluidSolver::copyDensity(std::vector<float>& out) const {
+    if (packed_) {
+        out.resize(size());
+        rows(packed_->dens).read(0, 0, size() - 1, out.data());
+        return;
+    }
+    out = dens;
+}
+
+void FluidSolver::copyFields(std::vector<float>* const out[7]) const {
+    if (packed_) {
+        const PackedFields& f = *packed_;
+        const std::vector<uint16_t>* fields[7] = {&f.u, &f.v, &f.u_prev, &f.v_prev,
+                                                  &f.dens, &f.dens_prev, &f.pressure};
+        for (int k = 0; k < 7; k++) {
+            out[k]->assign(size(), 0.0f);
+            if (!fields[k]->empty()) {
+                rows(*fields[k]).read(0, 0, size() - 1, out[k]->data());
+            }
+        }
+        return;
+    }
+    const std::vector<float>* fields[6] = {&u, &v, &u_prev, &v_prev, &dens, &dens_prev};
+    for (int k = 0; k < 6; k++) {
+        *out[k] = *fields[k];
+    }
+    if (pressure_.empty()) {
+        out[6]->assign(size(), 0.0f);
+    } else {
+        *out[6] = pressure_;
+    }
+}
+
+void FluidSolver::restoreFields(const float* const fields[7]) {
+    packed_.reset();
+    tiles_.reset();
+    std::vector<float>* targets[7] = {&u, &v, &u_prev, &v_prev, &dens, &dens_prev, &pressure_};
+    for (int k = 0; k < 7; k++) {
+        targets[k]->assign(fields[k], fields[k] + size());
+    }
+    // maxSpeed() as if the restored velocity had just been advected
+    maxSpeedSq_ = 0.0f;
+    for (int j = 1; j <= n_; j++) {
+        for (int i = 1; i <= n_; i++) {
+            maxSpeedSq_ = std::max(maxSpeedSq_, u[IX(i,j)] * u[IX(i,j)] + v[IX(i,j)] * v[IX(i,j)]);
+        }
+    }
+}
+
+float FluidSolver::activeFraction() const {
+    const ActiveTiles* tiles = sparse();
+    if (!tiles) {
+        return 1.0f;
+    }
+    return float(tiles->activeCount()) / (tiles->tiles() * tiles->tiles());
+}
 
-void initFluid() {
+void FluidSolver::initFluid() {
     std::fill(u.begin(), u.end(), 0.0f);
     std::fill(v.begin(), v.end(), 0.0f);
     std::fill(dens.begin(), dens.end(), 0.0f);
     std::fill(u_prev.begin(), u_prev.end(), 0.0f);
     std::fill(v_prev.begin(), v_prev.end(), 0.0f);
     std::fill(dens_prev.begin(), dens_prev.end(), 0.0f);
+    std::fill(pressure_.begin(), pressure_.end(), 0.0f);
+    simulationTime = 0.0f;
+    maxSpeedSq_ = 0.0f;
+    tiles_.reset();
+    if (packed_) {
+        PackedFields& f = *packed_;
+        for (std::vector<uint16_t>* x : {&f.u, &f.v, &f.u_prev, &f.v_prev, &f.dens,
+                                         &f.dens_prev, &f.pressure}) {
+            std::fill(x->begin(), x->end(), 0);
+        }
+    }
 }
 
-void add_fixed_circular_source(std::vector<float>& dens_prev, 
-    std::vector<float>& u_prev, 
-    std::vector<float>& v_prev, 
-    float dt, float simulationTime) {
+Splat circular_source(int n, float simulationTime, float dt) {
+    const int N = n;
     float centerX = N * 0.5f + 1.0f;
     float centerY = N * 0.5f + 1.0f;
     float radius = 5.0f;
@@ -32,8 +386,6 @@ void add_fixed_circular_source(std::vector<float>& dens_prev,
 
     // Velocity parameters
     float velocityStrength = 50.0f; // Strength of the velocity field
-    // float velocityDirection = 3.0f; // Direction in radians (0 = right, PI/2 = up)
-            // You can change this or make it change over time
 
     // Calculate velocity components
     float rotationSpeed = 0.5f;
@@ -42,131 +394,455 @@ void add_fixed_circular_source(std::vector<float>& dens_prev,
     float velocityX = velocityStrength * std::cos(velocityDirection);
     float velocityY = velocityStrength * std::sin(velocityDirection);
 
-    int minI = std::max(1, static_cast<int>(centerX - radius));
-    int maxI = std::min(N, static_cast<int>(centerX + radius));
-    int minJ = std::max(1, static_cast<int>(centerY - radius));
-    int maxJ = std::min(N, static_cast<int>(centerY + radius));
-
-    for (int i = minI; i <= maxI; i++) {
-        for (int j = minJ; j <= maxJ; j++) {
-            float dx = (i - centerX);
-            float dy = (j - centerY);
-            float distance = std::sqrt(dx * dx + dy * dy);
-            if (distance <= radius) {
-                // float falloff = std::exp(-distance * distance / (radius * radius));
-
-                // Add density
-                dens_prev[IX(i,j)] += maxDensity * 1 * dt;
-
-                // Add velocity with the same falloff pattern
-                u_prev[IX(i,j)] += velocityX * 1 * dt;
-                v_prev[IX(i,j)] += velocityY * 1 * dt;
-            }
+    Splat source;
+    source.x = centerX;
+    source.y = centerY;
+    source.radius = radius;
+    source.du = velocityX * dt;
+    source.dv = velocityY * dt;
+    source.density = maxDensity * dt;
+    return source;
+}
+
+void FluidSolver::add_fixed_circular_source(float dt) {
+    pendingSplats_.push_back(circular_source(n_, simulationTime, dt));
+}
+
+ThreadPool& FluidSolver::pool() {
+    int threads = std::max(1, params.threads);
+    if (!pool_ || pool_->size() != threads) {
+        pool_.reset(new ThreadPool(threads));
+    }
+    return *pool_;
+}
+
+const ActiveTiles* FluidSolver::sparse() const {
+    if (!params.activeTiles || !tiles_ ||
+        tiles_->tile() != ActiveTiles::clampTile(n_, params.activeTileSize)) {
+        return nullptr;
+    }
+    return tiles_.get();
+}
+
+template <class T>
+void FluidSolver::updateActiveTiles(float dt) {
+    if (!params.activeTiles) {
+        tiles_.reset();
+        return;
+    }
+    ProfileScope scope("active_tiles");
+    if (!sparse()) {
+        // Nothing is known about the fields yet, so start from a full grid.
+        tiles_.reset(new ActiveTiles(n_, params.activeTileSize));
+        tiles_->activateAll();
+    }
+    for (const Splat& s : pendingSplats_) {
+        int minI, maxI, minJ, maxJ;
+        splat_bounds(n_, s, minI, maxI, minJ, maxJ);
+        tiles_->touch(minI, minJ, maxI, maxJ);
+    }
+    // Obstacle boundaries write into their tiles every step.
+    for (const SolidCell& c : obstacles_.boundary()) {
+        int i = c.cell % (n_ + 2);
+        int j = c.cell / (n_ + 2);
+        tiles_->touch(i, j, i, j);
+    }
+    Fields<T> f = fields<T>();
+    tiles_->update(rows(f.u), rows(f.v), rows(f.dens), params.activeEpsilon, dt * n_);
+    for (std::vector<T>* x : {&f.u, &f.v, &f.u_prev, &f.v_prev, &f.dens, &f.dens_prev,
+                              &f.pressure}) {
+        if (!x->empty()) {
+            tiles_->clearDropped(rows(*x));
         }
     }
 }
 
-void diffuse(int b, std::vector<float>& x, std::vector<float>& x0, float diff, float dt) {
-    float a = dt * diff * N * N;
-    for (int k = 0; k < 20; k++) {
-        for (int i = 1; i <= N; i++) {
-            for (int j = 1; j <= N; j++) {
-                x[IX(i,j)] = (x0[IX(i,j)] + a * (x[IX(i-1,j)] + x[IX(i+1,j)] +
-                              x[IX(i,j-1)] + x[IX(i,j+1)])) / (1 + 4 * a);
-            }
+void FluidSolver::syncStorage() {
+    if (packed_ ? packed_->storage == params.storage
+                : params.storage == FieldStorage::Float32) {
+        return;
+    }
+    std::vector<float>* fp32[7] = {&u, &v, &u_prev, &v_prev, &dens, &dens_prev, &pressure_};
+    if (packed_) {
+        copyFields(fp32);
+        packed_.reset();
+    }
+    tiles_.reset();
+    if (params.storage == FieldStorage::Float32) {
+        return;
+    }
+    packed_.reset(new PackedFields);
+    packed_->storage = params.storage;
+    Fields<uint16_t> f = fields<uint16_t>();
+    std::vector<uint16_t>* packed[7] = {&f.u, &f.v, &f.u_prev, &f.v_prev, &f.dens,
+                                        &f.dens_prev, &f.pressure};
+    for (int k = 0; k < 7; k++) {
+        if (fp32[k]->empty()) {
+            continue;
         }
-        set_bnd(b, x);
+        packed[k]->resize(size());
+        rows(*packed[k]).write(0, 0, size() - 1, fp32[k]->data());
+        std::vector<float>().swap(*fp32[k]);
     }
 }
 
-void advect(int b, std::vector<float>& d, std::vector<float>& d0,
-            std::vector<float>& u, std::vector<float>& v, float dt) {
-    float dt0 = dt * N;
-    for (int i = 1; i <= N; i++) {
-        for (int j = 1; j <= N; j++) {
-            float x = i - dt0 * u[IX(i,j)];
-            float y = j - dt0 * v[IX(i,j)];
-            if (x < 0.5f) x = 0.5f;
-            if (x > N + 0.5f) x = N + 0.5f;
-            int i0 = (int)x;
-            int i1 = i0 + 1;
-            if (y < 0.5f) y = 0.5f;
-            if (y > N + 0.5f) y = N + 0.5f;
-            int j0 = (int)y;
-            int j1 = j0 + 1;
-            float s1 = x - i0;
-            float s0 = 1 - s1;
-            float t1 = y - j0;
-            float t0 = 1 - t1;
-            d[IX(i,j)] = s0 * (t0 * d0[IX(i0,j0)] + t1 * d0[IX(i0,j1)]) +
-                         s1 * (t0 * d0[IX(i1,j0)] + t1 * d0[IX(i1,j1)]);
-        }
-    }
-    set_bnd(b, d);
-}
-
-void project(std::vector<float>& u, std::vector<float>& v,
-             std::vector<float>& p, std::vector<float>& div) {
-    float h = 1.0f / N;
-    for (int i = 1; i <= N; i++) {
-        for (int j = 1; j <= N; j++) {
-            div[IX(i,j)] = -0.5f * h * (u[IX(i+1,j)] - u[IX(i-1,j)] +
-                                        v[IX(i,j+1)] - v[IX(i,j-1)]);
-            p[IX(i,j)] = 0;
+template <class T>
+void FluidSolver::set_bnd(int b, std::vector<T>& x) const {
+    ProfileScope scope("set_bnd");
+    passes_.boundary++;
+    kernels<decltype(rows(x))>().set_bnd(n_, b, rows(x));
+    obstacle_bnd(b, rows(x));
+}
+
+template <class Rows>
+void FluidSolver::obstacle_bnd(int b, Rows x) const {
+    if (obstacles_.empty()) {
+        return;
+    }
+    ProfileScope scope("obstacle_bnd");
+    passes_.boundary++;
+    obstacles_.apply(b, x);
+}
+
+template <class T>
+void FluidSolver::add_source(std::vector<T>& x, const std::vector<T>& s, float dt) const {
+    ProfileScope scope("add_source");
+    passes_.grid++;
+    if (const ActiveTiles* tiles = sparse()) {
+        sparse_add_source(*tiles, n_, rows(x), rows(s), dt, lines());
+        return;
+    }
+    kernels<decltype(rows(x))>().add_source(n_, rows(x), rows(s), dt, lines());
+}
+
+template <class T>
+SolveStats FluidSolver::lin_solve(int b, std::vector<T>& x, std::vector<T>& x0, float a,
+                                  float c, bool pressure, const char* stage) {
+    typedef decltype(rows(x)) Rows;
+    const ActiveTiles* tiles = sparse();
+    const ObstacleMap* solids = obstacles_.empty() ? nullptr : &obstacles_;
+    const Rows X = rows(x);
+    const Rows X0 = rows(x0);
+    auto sweeps = [&](int iters) {
+        ProfileScope scope(stage);
+        passes_.grid += iters;
+        passes_.boundary += solids ? 2 * iters : iters;
+        if (tiles) {
+            sparse_lin_solve(*tiles, n_, b, X, X0, a, c, iters, lines(), solids);
+            return;
+        }
+        std::vector<T>& spare = fields<T>().scratch;
+        switch (params.relaxation) {
+        case Relaxation::GaussSeidel: {
+            const FluidKernels<Rows>& k = kernels<Rows>();
+            (pressure ? k.pressure_gs : k.lin_solve)(n_, b, X, X0, a, c, iters, solids, lines());
+            break;
         }
+        case Relaxation::RedBlack:
+            lin_solve_red_black(pool(), n_, b, X, X0, a, c, iters, lines(), solids);
+            break;
+        case Relaxation::Jacobi:
+            spare.resize(size());
+            lin_solve_jacobi(pool(), n_, b, X, X0, a, c, iters, rows(spare), lines(), solids);
+            break;
+        case Relaxation::TiledJacobi:
+            spare.resize(size());
+            blocks_.resize(jacobi_tiled_scratch(pool().size(), n_, params.tileSize,
+                                                params.fusedSweeps));
+            lin_solve_jacobi_tiled(pool(), n_, b, X, X0, a, c, iters, params.tileSize,
+                                   params.fusedSweeps, rows(spare), blocks_.data(), lines(),
+                                   solids);
+            break;
+        }
+    };
+
+    SolveStats stats;
+    if (params.tolerance <= 0) {
+        sweeps(params.iterations);
+        stats.iterations = params.iterations;
+        return stats;
     }
-    set_bnd(0, div);
-    set_bnd(0, p);
-    for (int k = 0; k < 20; k++) {
-        for (int i = 1; i <= N; i++) {
-            for (int j = 1; j <= N; j++) {
-                p[IX(i,j)] = (div[IX(i,j)] + p[IX(i-1,j)] + p[IX(i+1,j)] +
-                              p[IX(i,j-1)] + p[IX(i,j+1)]) / 4;
-            }
+    const int every = std::max(1, params.checkEvery);
+    while (stats.iterations < params.iterations) {
+        int k = std::min(every, params.iterations - stats.iterations);
+        sweeps(k);
+        stats.iterations += k;
+        {
+            ProfileScope scope("residual");
+            stats.residual = lin_residual(n_, X, X0, a, c, lines(), solids);
+        }
+        passes_.grid++;
+        if (stats.residual <= params.tolerance) {
+            break;
         }
-        set_bnd(0, p);
     }
-    for (int i = 1; i <= N; i++) {
-        for (int j = 1; j <= N; j++) {
-            u[IX(i,j)] -= 0.5f * (p[IX(i+1,j)] - p[IX(i-1,j)]) / h;
-            v[IX(i,j)] -= 0.5f * (p[IX(i,j+1)] - p[IX(i,j-1)]) / h;
+    return stats;
+}
+
+template <class T>
+void FluidSolver::diffuse(int b, std::vector<T>& x, std::vector<T>& x0, float diff, float dt) {
+    float a = dt * diff * n_ * n_;
+    lastDiffuse = lin_solve(b, x, x0, a, 1 + 4 * a, false, "diffuse_sweeps");
+}
+
+float FluidSolver::advect_high_order(int b, std::vector<float>& d, std::vector<float>& d0,
+                                     std::vector<float>& u, std::vector<float>& v,
+                                     float dt) const {
+    advectScratch_.resize(2 * size() + 3 * (n_ + 2));
+    return ::advect_high_order(params.advection, params.simd, n_, b, d.data(), d0.data(),
+                               u.data(), v.data(), dt, advectScratch_.data());
+}
+
+float FluidSolver::advect_high_order(int b, std::vector<uint16_t>& d, std::vector<uint16_t>& d0,
+                                     std::vector<uint16_t>& u, std::vector<uint16_t>& v,
+                                     float dt) const {
+    const int cells = size();
+    staging_.resize(4 * (size_t)cells);
+    float* stage[4] = {staging_.data(), staging_.data() + cells, staging_.data() + 2 * cells,
+                       staging_.data() + 3 * cells};
+    rows(d0).read(0, 0, cells - 1, stage[1]);
+    rows(u).read(0, 0, cells - 1, stage[2]);
+    rows(v).read(0, 0, cells - 1, stage[3]);
+    advectScratch_.resize(2 * size() + 3 * (n_ + 2));
+    float maxSq = ::advect_high_order(params.advection, params.simd, n_, b, stage[0], stage[1],
+                                      stage[2], stage[3], dt, advectScratch_.data());
+    rows(d).write(0, 0, cells - 1, stage[0]);
+    return maxSq;
+}
+
+template <class T>
+void FluidSolver::advect(int b, std::vector<T>& d, std::vector<T>& d0,
+                         std::vector<T>& u, std::vector<T>& v, float dt) const {
+    ProfileScope scope("advect");
+    passes_.grid++;
+    passes_.boundary++;
+    if (const ActiveTiles* tiles = sparse()) {
+        maxSpeedSq_ = sparse_advect(*tiles, n_, b, rows(d), rows(d0), rows(u), rows(v), dt,
+                                    lines());
+        obstacle_bnd(b, rows(d));
+        return;
+    }
+    if (params.advection != AdvectScheme::SemiLagrangian) {
+        const bool bfecc = params.advection == AdvectScheme::BFECC;
+        passes_.grid += bfecc ? 3 : 2;
+        passes_.boundary += bfecc ? 2 : 1;
+        maxSpeedSq_ = advect_high_order(b, d, d0, u, v, dt);
+        obstacle_bnd(b, rows(d));
+        return;
+    }
+    if (resolve_simd(params.simd) != SimdLevel::Scalar) {
+        maxSpeedSq_ = advect_simd(params.simd, n_, rows(d), rows(d0), rows(u), rows(v), dt,
+                                  lines());
+        kernels<decltype(rows(d))>().set_bnd(n_, b, rows(d));
+        obstacle_bnd(b, rows(d));
+        return;
+    }
+    maxSpeedSq_ = kernels<decltype(rows(d))>().advect(n_, b, rows(d), rows(d0), rows(u),
+                                                      rows(v), dt, lines());
+    obstacle_bnd(b, rows(d));
+}
+
+void FluidSolver::multigrid(std::vector<float>& p, std::vector<float>& div,
+                            const MultigridSettings& mg) {
+    multigrid_.solve(p.data(), div.data(), mg, &obstacles_);
+}
+
+void FluidSolver::multigrid(std::vector<uint16_t>& p, std::vector<uint16_t>& div,
+                            const MultigridSettings& mg) {
+    const int cells = size();
+    staging_.resize(2 * (size_t)cells);
+    rows(p).read(0, 0, cells - 1, staging_.data());
+    rows(div).read(0, 0, cells - 1, staging_.data() + cells);
+    multigrid_.solve(staging_.data(), staging_.data() + cells, mg, &obstacles_);
+    rows(p).write(0, 0, cells - 1, staging_.data());
+}
+
+template <class T>
+void FluidSolver::project(std::vector<T>& u, std::vector<T>& v, std::vector<T>& p,
+                          std::vector<T>& div) {
+    ProfileScope scope("project");
+    std::vector<T>* pp = &p;
+    if (params.warmStart) {
+        // Start from the previous solve; the pressure field persists across steps.
+        pp = &fields<T>().pressure;
+        pp->resize(size());
+    }
+    typedef decltype(rows(p)) Rows;
+    const Rows P = rows(*pp);
+    const Rows* clear = params.warmStart ? nullptr : &P;
+    // divergence and subtract_gradient; the pressure solve counts its own
+    passes_.grid += 2;
+    passes_.boundary += params.warmStart ? 3 : 4;
+    if (const ActiveTiles* tiles = sparse()) {
+        sparse_divergence(*tiles, n_, rows(u), rows(v), clear, rows(div), lines());
+        lastPressure = lin_solve(0, *pp, div, 1, 4, true, "pressure_sweeps");
+        sparse_subtract_gradient(*tiles, n_, rows(u), rows(v), P, lines());
+        obstacle_bnd(1, rows(u));
+        obstacle_bnd(2, rows(v));
+        return;
+    }
+    const FluidKernels<Rows>& k = kernels<Rows>();
+    {
+        ProfileScope divergence("divergence");
+        k.divergence(n_, rows(u), rows(v), clear, rows(div), lines());
+    }
+    switch (params.pressureSolver) {
+    case PressureSolver::GaussSeidel:
+        lastPressure = lin_solve(0, *pp, div, 1, 4, true, "pressure_sweeps");
+        break;
+    case PressureSolver::Multigrid: {
+        MultigridSettings mg = params.multigrid;
+        lastPressure = SolveStats();
+        if (params.tolerance <= 0) {
+            ProfileScope cycles("multigrid");
+            multigrid(*pp, div, mg);
+            obstacle_bnd(0, P);
+            lastPressure.iterations = mg.cycles;
+            passes_.grid += mg.cycles * multigrid_passes(mg);
+            break;
+        }
+        // Early exit is checked after every cycle.
+        int cycles = mg.cycles;
+        mg.cycles = 1;
+        while (lastPressure.iterations < cycles) {
+            ProfileScope cycle("multigrid");
+            multigrid(*pp, div, mg);
+            obstacle_bnd(0, P);
+            lastPressure.iterations++;
+            lastPressure.residual = lin_residual(n_, P, rows(div), 1, 4, lines());
+            passes_.grid += multigrid_passes(mg) + 1;
+            if (lastPressure.residual <= params.tolerance) {
+                break;
+            }
         }
+        break;
     }
-    set_bnd(1, u);
-    set_bnd(2, v);
+    }
+    ProfileScope gradient("subtract_gradient");
+    k.subtract_gradient(n_, rows(u), rows(v), P, lines());
+    obstacle_bnd(1, rows(u));
+    obstacle_bnd(2, rows(v));
 }
 
-void dens_step(std::vector<float>& x, std::vector<float>& x0,
-               std::vector<float>& u, std::vector<float>& v, float diff, float dt) {
+template <class T>
+void FluidSolver::density(float diff, float dt) {
+    ProfileScope scope("dens_step");
+    Fields<T> f = fields<T>();
+    std::vector<T>& x = f.dens;
+    std::vector<T>& x0 = f.dens_prev;
     add_source(x, x0, dt);
-    SWAP(x0, x);
+    std::swap(x0, x);
     diffuse(0, x, x0, diff, dt);
-    SWAP(x0, x);
-    advect(0, x, x0, u, v, dt);
+    std::swap(x0, x);
+    advect(0, x, x0, f.u, f.v, dt);
 }
 
-void vel_step(std::vector<float>& u, std::vector<float>& v,
-              std::vector<float>& u0, std::vector<float>& v0, float visc, float dt) {
+template <class T>
+void FluidSolver::velocity(float visc, float dt) {
+    ProfileScope scope("vel_step");
+    Fields<T> f = fields<T>();
+    std::vector<T>& u = f.u;
+    std::vector<T>& v = f.v;
+    std::vector<T>& u0 = f.u_prev;
+    std::vector<T>& v0 = f.v_prev;
     add_source(u, u0, dt);
     add_source(v, v0, dt);
-    SWAP(u0, u);
+    std::swap(u0, u);
     diffuse(1, u, u0, visc, dt);
-    SWAP(v0, v);
+    std::swap(v0, v);
     diffuse(2, v, v0, visc, dt);
     project(u, v, u0, v0);
-    SWAP(u0, u);
-    SWAP(v0, v);
+    std::swap(u0, u);
+    std::swap(v0, v);
     advect(1, u, u0, u, v, dt);
     advect(2, v, v0, u, v, dt);
     project(u, v, u0, v0);
 }
-float simulationTime = 0.0f;
-void updateFluid(float dt) {
+
+void FluidSolver::dens_step(float diff, float dt) {
+    if (packed_) {
+        density<uint16_t>(diff, dt);
+    } else {
+        density<float>(diff, dt);
+    }
+}
+
+void FluidSolver::vel_step(float visc, float dt) {
+    if (packed_) {
+        velocity<uint16_t>(visc, dt);
+    } else {
+        velocity<float>(visc, dt);
+    }
+}
+
+template <class T>
+void FluidSolver::updateObstacles(float dt) {
+    if (!obstacles_.update(dt)) {
+        return;
+    }
+    // Cells that just turned solid take the obstacle's velocity and lose
+    // their density.
+    Fields<T> f = fields<T>();
+    obstacles_.fillInterior(1, rows(f.u));
+    obstacles_.fillInterior(2, rows(f.v));
+    obstacles_.fillInterior(0, rows(f.dens));
+}
+
+template <class T>
+void FluidSolver::step(float dt) {
+    Fields<T> f = fields<T>();
+    updateObstacles<T>(dt);
+    {
+        ProfileScope splats("splats");
+        rasterize_splats(n_, pendingSplats_, rows(f.u_prev), rows(f.v_prev), rows(f.dens_prev));
+    }
+    updateActiveTiles<T>(dt);
+    velocity<T>(params.visc, dt);
+    density<T>(params.diff, dt);
+    ProfileScope clear("clear_sources");
+    if (const ActiveTiles* tiles = sparse()) {
+        tiles->clearActive(rows(f.u_prev));
+        tiles->clearActive(rows(f.v_prev));
+        tiles->clearActive(rows(f.dens_prev));
+    } else {
+        std::fill(f.u_prev.begin(), f.u_prev.end(), T(0));
+        std::fill(f.v_prev.begin(), f.v_prev.end(), T(0));
+        std::fill(f.dens_prev.begin(), f.dens_prev.end(), T(0));
+    }
+    passes_.grid += 3;
+}
+
+void FluidSolver::updateFluid(float dt) {
+    ProfileScope scope("step");
+    passes_ = PassCount();
+    syncStorage();
     simulationTime += dt;
-    add_fixed_circular_source(dens_prev, u_prev, v_prev, dt, simulationTime);
-    vel_step(u, v, u_prev, v_prev, visc, dt);
-    dens_step(dens, dens_prev, u, v, diff, dt);
-    std::fill(u_prev.begin(), u_prev.end(), 0.0f);
-    std::fill(v_prev.begin(), v_prev.end(), 0.0f);
-    std::fill(dens_prev.begin(), dens_prev.end(), 0.0f);
-}
\ No newline at end of file
+    pendingSplats_.clear();
+    splats_.drain(pendingSplats_);
+    add_fixed_circular_source(dt);
+    if (packed_) {
+        step<uint16_t>(dt);
+    } else {
+        step<float>(dt);
+    }
+    lastPasses = passes_;
+}
+
+// The stages for both storages.
+template void FluidSolver::set_bnd(int, std::vector<float>&) const;
+template void FluidSolver::add_source(std::vector<float>&, const std::vector<float>&,
+                                      float) const;
+template void FluidSolver::diffuse(int, std::vector<float>&, std::vector<float>&, float, float);
+template void FluidSolver::advect(int, std::vector<float>&, std::vector<float>&,
+                                  std::vector<float>&, std::vector<float>&, float) const;
+template void FluidSolver::project(std::vector<float>&, std::vector<float>&,
+                                   std::vector<float>&, std::vector<float>&);
+template void FluidSolver::set_bnd(int, std::vector<uint16_t>&) const;
+template void FluidSolver::add_source(std::vector<uint16_t>&, const std::vector<uint16_t>&,
+                                      float) const;
+template void FluidSolver::diffuse(int, std::vector<uint16_t>&, std::vector<uint16_t>&, float,
+                                   float);
+template void FluidSolver::advect(int, std::vector<uint16_t>&, std::vector<uint16_t>&,
+                                  std::vector<uint16_t>&, std::vector<uint16_t>&, float) const;
+template void FluidSolver::project(std::vector<uint16_t>&, std::vector<uint16_t>&,
+                                   std::vector<uint16_t>&, std::vector<uint16_t>&);
@@ -1,27 +1,223 @@
 #ifndef FLUID_HPP
 #define FLUID_HPP
+#include <cmath>
+#include <memory>
 #include <vector>
+#include "active_tiles.hpp"
+#include "advect.hpp"
+#include "multigrid.hpp"
+#include "obstacles.hpp"
+#include "packed_fields.hpp"
+#include "splat_queue.hpp"
+#include "thread_pool.hpp"
+#include "utils.hpp"
 
-// Grid parameters
-#define N 200
-#define SIZE ((N+2)*(N+2))
-#define IX(i,j) ((i)+(N+2)*(j))
+enum class PressureSolver { GaussSeidel, Multigrid };
+
+// Relaxation used by diffuse() and the Gauss-Seidel pressure solve.
+// RedBlack splits each color across params.threads workers; TiledJacobi
+// gives the same result as Jacobi but fuses params.fusedSweeps sweeps per
+// params.tileSize block so the working set stays in cache.
+enum class Relaxation { GaussSeidel, RedBlack, Jacobi, TiledJacobi };
 
 // Simulation parameters
-extern float dt;
-extern float diff;
-extern float visc;
-
-// Fluid data
-extern std::vector<float> u, v, u_prev, v_prev;
-extern std::vector<float> dens, dens_prev;
-
-void initFluid();
-void updateFluid(float dt);
-void add_fixed_circular_source(std::vector<float>& dens_prev, float dt);
-void vel_step(std::vector<float>& u, std::vector<float>& v,
-              std::vector<float>& u0, std::vector<float>& v0, float visc, float dt);
-void dens_step(std::vector<float>& x, std::vector<float>& x0,
-               std::vector<float>& u, std::vector<float>& v, float diff, float dt);
-
-#endif
\ No newline at end of file
+struct FluidParams {
+    float dt = 0.01f;
+    float diff = 0.0001f;
+    float visc = 0.001f;
+    int iterations = 20;
+    Relaxation relaxation = Relaxation::GaussSeidel;
+    int threads = 1;
+    int tileSize = 128;
+    int fusedSweeps = 10;
+    SimdLevel simd = SimdLevel::Auto;   // advect() vector width
+    // advect() scheme. MacCormack and BFECC take two and three extra grid
+    // passes; their limiter pass is scalar.
+    AdvectScheme advection = AdvectScheme::SemiLagrangian;
+    PressureSolver pressureSolver = PressureSolver::GaussSeidel;
+    MultigridSettings multigrid;
+
+    // Convergence control for diffuse() and project(). With tolerance > 0
+    // the RMS residual is checked every checkEvery sweeps (every cycle for
+    // multigrid) and the solve stops once it is at or below tolerance.
+    // warmStart keeps the pressure field between calls instead of zeroing it.
+    float tolerance = 0.0f;
+    int checkEvery = 5;
+    bool warmStart = false;
+
+    // Skip activeTileSize blocks whose u, v and dens all stay at or below
+    // activeEpsilon. Approximate: dropped tiles are flushed to zero and the
+    // pressure solve only covers active tiles. Runs the scalar row-order
+    // Gauss-Seidel kernels whatever relaxation, pressureSolver, simd and
+    // advection are set to.
+    bool activeTiles = false;
+    int activeTileSize = 16;
+    float activeEpsilon = 1e-3f;
+
+    // 16-bit storage for all six fields and the warm-start pressure,
+    // applied at the next updateFluid(). While packed, the fp32 vectors are
+    // released and copyDensity() reads the density out. Every setting above
+    // applies: the kernels read and write rows through a storage-typed
+    // accessor (utils.hpp, packed_fields.hpp) and compute in fp32, so both
+    // storages take the same path. Multigrid and the MacCormack and BFECC
+    // advection widen their inputs to fp32 scratch and narrow the result.
+    FieldStorage storage = FieldStorage::Float32;
+};
+
+// Sweeps (or multigrid cycles) used by the last solve, and its final RMS
+// residual; residual is -1 when no check ran (tolerance == 0).
+struct SolveStats {
+    int iterations = 0;
+    float residual = -1.0f;
+};
+
+// Passes made by the last updateFluid(): grid passes sweep the interior,
+// boundary passes only the ghost ring (a set_bnd call). An active-tile pass
+// counts as a full one.
+struct PassCount {
+    int grid = 0;
+    int boundary = 0;
+};
+
+// The rotating source at the grid center that updateFluid() injects.
+Splat circular_source(int n, float simulationTime, float dt);
+
+template <class Rows>
+struct FluidKernels;
+
+// Owns the fields of one N x N simulation. The resolution is chosen at
+// runtime; 128, 256, 512 and 1024 run kernels compiled for that exact size.
+class FluidSolver {
+public:
+    explicit FluidSolver(int n, const FluidParams& params = FluidParams());
+
+    int n() const { return n_; }
+    int size() const { return (n_ + 2) * (n_ + 2); }
+    int IX(int i, int j) const { return i + (n_ + 2) * j; }
+    bool specialized() const;
+    // Widens the density into out; works with any storage.
+    void copyDensity(std::vector<float>& out) const;
+    // All state as fp32 in the order u, v, u_prev, v_prev, dens, dens_prev
+    // and the warm-start pressure (zeros unless params.warmStart kept one).
+    void copyFields(std::vector<float>* const out[7]) const;
+    // Replaces all seven fields with (N+2)^2 values each. 16-bit storage is
+    // reapplied at the next updateFluid(); active tiles start over.
+    void restoreFields(const float* const fields[7]);
+    // Share of tiles stepped last update; 1 unless params.activeTiles is set.
+    float activeFraction() const;
+    // Largest |(u,v)| read by the last advect(). After updateFluid() that is
+    // the final velocity of the step, as the density advection reads it.
+    float maxSpeed() const { return std::sqrt(maxSpeedSq_); }
+
+    // Source injections for the next updateFluid(); safe to push from any thread.
+    SplatQueue& splats() { return splats_; }
+    // Solid cells. updateFluid() moves the moving obstacles and applies the
+    // mask after every set_bnd. The relaxation kernels and every multigrid
+    // level skip solid cells; see relax.hpp and multigrid.hpp.
+    // Not thread safe: edit between steps.
+    ObstacleMap& obstacles() { return obstacles_; }
+    const ObstacleMap& obstacles() const { return obstacles_; }
+
+    void initFluid();
+    // Drains splats() into the source fields, then steps velocity and density.
+    void updateFluid(float dt);
+    // Adds the rotating source at the grid center to this step's splats,
+    // after the drained ones. It bypasses splats(), so a queue filled by
+    // input cannot drop it.
+    void add_fixed_circular_source(float dt);
+    // Step the fields in their current storage.
+    void vel_step(float visc, float dt);
+    void dens_step(float diff, float dt);
+
+    // Individual solver stages, for fields of T = float, or of T = uint16_t
+    // holding params.storage.
+    template <class T>
+    void set_bnd(int b, std::vector<T>& x) const;
+    template <class T>
+    void add_source(std::vector<T>& x, const std::vector<T>& s, float dt) const;
+    template <class T>
+    void diffuse(int b, std::vector<T>& x, std::vector<T>& x0, float diff, float dt);
+    template <class T>
+    void advect(int b, std::vector<T>& d, std::vector<T>& d0,
+                std::vector<T>& u, std::vector<T>& v, float dt) const;
+    template <class T>
+    void project(std::vector<T>& u, std::vector<T>& v, std::vector<T>& p, std::vector<T>& div);
+
+    FluidParams params;
+    float simulationTime = 0.0f;
+    SolveStats lastDiffuse, lastPressure;
+    PassCount lastPasses;
+
+    // Fluid data
+    std::vector<float> u, v, u_prev, v_prev;
+    std::vector<float> dens, dens_prev;
+
+private:
+    // The fields of one storage: the public vectors, pressure_ and scratch_,
+    // or their 16-bit counterparts in PackedFields.
+    template <class T>
+    struct Fields {
+        std::vector<T>& u, &v, &u_prev, &v_prev, &dens, &dens_prev, &pressure, &scratch;
+    };
+    struct PackedFields {
+        FieldStorage storage;
+        std::vector<uint16_t> u, v, u_prev, v_prev, dens, dens_prev, pressure, scratch;
+    };
+
+    ThreadPool& pool();
+    const ActiveTiles* sparse() const;
+    template <class T>
+    Fields<T> fields();
+    template <class Rows>
+    const FluidKernels<Rows>& kernels() const;
+    // Row accessors; sources are only read through them.
+    FloatRows rows(const std::vector<float>& x) const;
+    PackedRows rows(const std::vector<uint16_t>& x) const;
+    // Line buffers for every kernel: relax_lines() floats, or the six rows
+    // the Gauss-Seidel kernels use if that is more.
+    float* lines() const;
+    template <class T>
+    void step(float dt);
+    template <class T>
+    void velocity(float visc, float dt);
+    template <class T>
+    void density(float diff, float dt);
+    template <class T>
+    void updateActiveTiles(float dt);
+    void syncStorage();
+    template <class T>
+    void updateObstacles(float dt);
+    // Obstacle boundary for field type b, after the outer walls.
+    template <class Rows>
+    void obstacle_bnd(int b, Rows x) const;
+    template <class T>
+    SolveStats lin_solve(int b, std::vector<T>& x, std::vector<T>& x0, float a, float c,
+                         bool pressure, const char* stage);
+    // The fp32-only solvers; 16-bit fields are widened into staging_ first.
+    float advect_high_order(int b, std::vector<float>& d, std::vector<float>& d0,
+                            std::vector<float>& u, std::vector<float>& v, float dt) const;
+    float advect_high_order(int b, std::vector<uint16_t>& d, std::vector<uint16_t>& d0,
+                            std::vector<uint16_t>& u, std::vector<uint16_t>& v, float dt) const;
+    void multigrid(std::vector<float>& p, std::vector<float>& div, const MultigridSettings& mg);
+    void multigrid(std::vector<uint16_t>& p, std::vector<uint16_t>& div,
+                   const MultigridSettings& mg);
+
+    int n_;
+    const FluidKernels<FloatRows>* kernels_;
+    const FluidKernels<PackedRows>* packedKernels_;
+    Multigrid multigrid_;
+    std::unique_ptr<ThreadPool> pool_;
+    std::vector<float> scratch_, blocks_;
+    mutable std::vector<float> lines_;
+    mutable std::vector<float> advectScratch_, staging_;
+    mutable float maxSpeedSq_ = 0.0f;
+    std::vector<float> pressure_;
+    mutable PassCount passes_;
+    std::unique_ptr<ActiveTiles> tiles_;
+    std::unique_ptr<PackedFields> packed_;
+    SplatQueue splats_;
+    std::vector<Splat> pendingSplats_;
+    ObstacleMap obstacles_;
+};
+
+#endif
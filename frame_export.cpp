@@ -0,0 +1,495 @@
+#include "frame_export.hpp"
+#include "profiler.hpp"
+#include "utils.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace {
+
+const size_t kBlock = 4096;   // O_DIRECT alignment for buffers, offsets and sizes
+
+// Header of a compressed raw frame (.f32.lz); base == step for keyframes.
+struct LzHeader {
+    char magic[4];
+    uint32_t n;
+    uint64_t step;
+    uint64_t base;
+    uint32_t rawBytes;
+    uint32_t payloadBytes;
+};
+
+uint32_t read32(const uint8_t* p) {
+    uint32_t v;
+    std::memcpy(&v, p, 4);
+    return v;
+}
+
+uint8_t* put_length(uint8_t* op, size_t length) {
+    for (; length >= 255; length -= 255) {
+        *op++ = 255;
+    }
+    *op++ = (uint8_t)length;
+    return op;
+}
+
+float clamp01(float x) {
+    return std::min(std::max(x, 0.0f), 1.0f);
+}
+
+uint8_t to_byte(float x) {
+    return (uint8_t)(clamp01(x) * 255.0f + 0.5f);
+}
+
+// Interior of x as float bits, rows bottom to top.
+void interior_bits(int n, const std::vector<float>& x, uint32_t* out) {
+    Grid<0> IX{n};
+    for (int j = 1; j <= n; j++) {
+        std::memcpy(out + (size_t)(j - 1) * n, &x[IX(1,j)], n * sizeof(float));
+    }
+}
+
+} // namespace
+
+size_t lz_bound(size_t size) {
+    return size + size / 255 + 16;
+}
+
+// Greedy single-probe matcher over a 64K-entry hash of 4-byte sequences.
+// Follows the LZ4 end-of-block rules: the last match starts at least 12
+// bytes before the end and the last 5 bytes are literals.
+size_t lz_compress(const uint8_t* src, size_t size, uint8_t* dst) {
+    const int hashBits = 16;
+    std::vector<int64_t> table((size_t)1 << hashBits, -1);
+    uint8_t* op = dst;
+    size_t anchor = 0;
+    size_t ip = 0;
+    const size_t matchLimit = size > 12 ? size - 12 : 0;
+    const size_t endLimit = size > 5 ? size - 5 : 0;
+
+    while (ip < matchLimit) {
+        uint32_t seq = read32(src + ip);
+        uint32_t h = (seq * 2654435761u) >> (32 - hashBits);
+        int64_t ref = table[h];
+        table[h] = (int64_t)ip;
+        if (ref < 0 || ip - ref > 65535 || read32(src + ref) != seq) {
+            ip++;
+            continue;
+        }
+        size_t match = (size_t)ref;
+        while (ip > anchor && match > 0 && src[ip - 1] == src[match - 1]) {
+            ip--;
+            match--;
+        }
+        size_t length = 4;
+        while (ip + length < endLimit && src[ip + length] == src[match + length]) {
+            length++;
+        }
+
+        size_t literals = ip - anchor;
+        uint8_t* token = op++;
+        *token = (uint8_t)((std::min<size_t>(literals, 15) << 4) | std::min<size_t>(length - 4, 15));
+        if (literals >= 15) {
+            op = put_length(op, literals - 15);
+        }
+        std::memcpy(op, src + anchor, literals);
+        op += literals;
+        uint16_t offset = (uint16_t)(ip - match);
+        *op++ = (uint8_t)offset;
+        *op++ = (uint8_t)(offset >> 8);
+        if (length - 4 >= 15) {
+            op = put_length(op, length - 4 - 15);
+        }
+        ip += length;
+        anchor = ip;
+    }
+
+    size_t literals = size - anchor;
+    *op++ = (uint8_t)(std::min<size_t>(literals, 15) << 4);
+    if (literals >= 15) {
+        op = put_length(op, literals - 15);
+    }
+    std::memcpy(op, src + anchor, literals);
+    op += literals;
+    return (size_t)(op - dst);
+}
+
+bool lz_decompress(const uint8_t* src, size_t size, uint8_t* dst, size_t dstSize) {
+    const uint8_t* ip = src;
+    const uint8_t* end = src + size;
+    size_t op = 0;
+    while (ip < end) {
+        uint8_t token = *ip++;
+        size_t literals = token >> 4;
+        if (literals == 15) {
+            uint8_t b;
+            do {
+                if (ip == end) {
+                    return false;
+                }
+                b = *ip++;
+                literals += b;
+            } while (b == 255);
+        }
+        if ((size_t)(end - ip) < literals || dstSize - op < literals) {
+            return false;
+        }
+        std::memcpy(dst + op, ip, literals);
+        ip += literals;
+        op += literals;
+        if (ip == end) {
+            return op == dstSize;
+        }
+        if (end - ip < 2) {
+            return false;
+        }
+        size_t offset = ip[0] | (ip[1] << 8);
+        ip += 2;
+        if (offset == 0 || offset > op) {
+            return false;
+        }
+        size_t matchLength = (token & 15) + 4;
+        if ((token & 15) == 15) {
+            uint8_t b;
+            do {
+                if (ip == end) {
+                    return false;
+                }
+                b = *ip++;
+                matchLength += b;
+            } while (b == 255);
+        }
+        if (dstSize - op < matchLength) {
+            return false;
+        }
+        // Byte by byte: the match may overlap the bytes it produces.
+        for (size_t k = 0; k < matchLength; k++, op++) {
+            dst[op] = dst[op - offset];
+        }
+    }
+    return false;
+}
+
+FrameExporter::FrameExporter(const ExportSettings& settings)
+    : settings_(settings), slots_(std::max(1, settings.queueDepth)),
+      lastStats_(std::chrono::steady_clock::now()) {
+    settings_.every = std::max(1, settings_.every);
+    settings_.keyframeEvery = std::max(1, settings_.keyframeEvery);
+    mkdir(settings_.directory.c_str(), 0755);
+    for (int k = 0; k < (int)slots_.size(); k++) {
+        free_.push_back(k);
+    }
+    writer_ = std::thread(&FrameExporter::writerLoop, this);
+}
+
+FrameExporter::~FrameExporter() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stop_ = true;
+    }
+    queued_.notify_one();
+    writer_.join();
+    std::free(out_);
+}
+
+void FrameExporter::submit(const FluidSolver& solver, uint64_t step) {
+    ProfileScope scope("export_submit");
+    int index;
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        if (free_.empty()) {
+            auto t0 = std::chrono::steady_clock::now();
+            freed_.wait(lock, [&] { return !free_.empty(); });
+            stalls_.fetch_add(1, std::memory_order_relaxed);
+            stallNs_.fetch_add(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now() - t0).count(), std::memory_order_relaxed);
+        }
+        index = free_.front();
+        free_.pop_front();
+    }
+
+    Slot& slot = slots_[index];
+    slot.n = solver.n();
+    slot.step = step;
+    solver.copyDensity(slot.dens);
+    if (settings_.velocity && !solver.u.empty()) {
+        slot.u = solver.u;
+        slot.v = solver.v;
+    } else {
+        slot.u.clear();
+        slot.v.clear();
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        ready_.push_back(index);
+    }
+    queued_.notify_one();
+}
+
+void FrameExporter::flush() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    freed_.wait(lock, [&] { return ready_.empty() && writing_ == 0; });
+}
+
+ExportStats FrameExporter::stats() {
+    auto now = std::chrono::steady_clock::now();
+    ExportStats s;
+    s.frames = frames_.load(std::memory_order_relaxed);
+    s.bytes = bytes_.load(std::memory_order_relaxed);
+    s.rawBytes = rawBytes_.load(std::memory_order_relaxed);
+    s.stalls = stalls_.load(std::memory_order_relaxed);
+    s.stallMs = stallNs_.load(std::memory_order_relaxed) * 1e-6;
+    s.errors = errors_.load(std::memory_order_relaxed);
+    s.direct = direct_.load(std::memory_order_relaxed);
+    double elapsed = std::chrono::duration<double>(now - lastStats_).count();
+    if (elapsed > 0) {
+        s.bytesPerSec = (s.bytes - lastBytes_) / elapsed;
+    }
+    lastBytes_ = s.bytes;
+    lastStats_ = now;
+    return s;
+}
+
+void FrameExporter::writerLoop() {
+    profile_thread_name("frame writer");
+    for (;;) {
+        int index;
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            queued_.wait(lock, [&] { return stop_ || !ready_.empty(); });
+            if (ready_.empty()) {
+                return;
+            }
+            index = ready_.front();
+            ready_.pop_front();
+            writing_++;
+        }
+        writeSlot(slots_[index]);
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            writing_--;
+            free_.push_back(index);
+        }
+        freed_.notify_all();
+    }
+}
+
+void FrameExporter::writeSlot(const Slot& slot) {
+    ProfileScope scope("export_write");
+    const int n = slot.n;
+    const size_t cells = (size_t)n * n;
+    size_t needed = std::max(sizeof(LzHeader) + lz_bound(cells * 4), cells * 3 + 64);
+    needed = (needed + kBlock - 1) / kBlock * kBlock;
+    if (needed > outCapacity_) {
+        std::free(out_);
+        void* p = nullptr;
+        if (posix_memalign(&p, kBlock, needed) != 0) {
+            out_ = nullptr;
+            outCapacity_ = 0;
+            errors_.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+        out_ = (uint8_t*)p;
+        outCapacity_ = needed;
+    }
+
+    if (settings_.format == ExportFormat::Raw) {
+        writeField("dens", n, slot.step, slot.dens, prevDens_);
+        if (!slot.u.empty()) {
+            writeField("u", n, slot.step, slot.u, prevU_);
+            writeField("v", n, slot.step, slot.v, prevV_);
+        }
+        lastStep_ = slot.step;
+        written_++;
+        frames_.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+
+    // Colorized: PPM rows run top to bottom, the grid's j runs upward.
+    Grid<0> IX{n};
+    char path[512];
+    int header = std::snprintf((char*)out_, 64, "P6\n%d %d\n255\n", n, n);
+    uint8_t* rgb = out_ + header;
+    for (int j = n; j >= 1; j--) {
+        for (int i = 1; i <= n; i++, rgb += 3) {
+            float d = slot.dens[IX(i,j)];
+            rgb[0] = to_byte(3 * d);
+            rgb[1] = to_byte(3 * d - 1);
+            rgb[2] = to_byte(3 * d - 2);
+        }
+    }
+    std::snprintf(path, sizeof(path), "%s/dens_%08llu.ppm", settings_.directory.c_str(),
+                  (unsigned long long)slot.step);
+    writeFile(path, header + cells * 3);
+    rawBytes_.fetch_add(cells * 4, std::memory_order_relaxed);
+
+    if (!slot.u.empty()) {
+        float scale = 0.5f / std::max(settings_.velocityScale, 1e-20f);
+        rgb = out_ + header;
+        for (int j = n; j >= 1; j--) {
+            for (int i = 1; i <= n; i++, rgb += 3) {
+                rgb[0] = to_byte(0.5f + slot.u[IX(i,j)] * scale);
+                rgb[1] = to_byte(0.5f + slot.v[IX(i,j)] * scale);
+                rgb[2] = 128;
+            }
+        }
+        std::snprintf(path, sizeof(path), "%s/uv_%08llu.ppm", settings_.directory.c_str(),
+                      (unsigned long long)slot.step);
+        writeFile(path, header + cells * 3);
+        rawBytes_.fetch_add(cells * 8, std::memory_order_relaxed);
+    }
+    written_++;
+    frames_.fetch_add(1, std::memory_order_relaxed);
+}
+
+void FrameExporter::writeField(const char* field, int n, uint64_t step,
+                               const std::vector<float>& x, std::vector<uint32_t>& previous) {
+    const size_t cells = (size_t)n * n;
+    char path[512];
+    rawBytes_.fetch_add(cells * 4, std::memory_order_relaxed);
+    if (!settings_.compress) {
+        interior_bits(n, x, (uint32_t*)out_);
+        std::snprintf(path, sizeof(path), "%s/%s_%08llu.f32", settings_.directory.c_str(),
+                      field, (unsigned long long)step);
+        writeFile(path, cells * 4);
+        return;
+    }
+
+    bool key = previous.size() != cells || written_ % settings_.keyframeEvery == 0;
+    std::vector<uint32_t> bits(cells);
+    interior_bits(n, x, bits.data());
+    // Byte planes of the XOR delta: unchanged high bytes become long zero runs.
+    scratch_.resize(cells * 4);
+    for (size_t k = 0; k < cells; k++) {
+        uint32_t d = key ? bits[k] : bits[k] ^ previous[k];
+        scratch_[k] = (uint8_t)d;
+        scratch_[cells + k] = (uint8_t)(d >> 8);
+        scratch_[2 * cells + k] = (uint8_t)(d >> 16);
+        scratch_[3 * cells + k] = (uint8_t)(d >> 24);
+    }
+
+    LzHeader h;
+    std::memcpy(h.magic, "FLZ1", 4);
+    h.n = (uint32_t)n;
+    h.step = step;
+    h.base = key ? step : lastStep_;
+    h.rawBytes = (uint32_t)(cells * 4);
+    h.payloadBytes = (uint32_t)lz_compress(scratch_.data(), cells * 4, out_ + sizeof(LzHeader));
+    std::memcpy(out_, &h, sizeof(h));
+    std::snprintf(path, sizeof(path), "%s/%s_%08llu.f32.lz", settings_.directory.c_str(),
+                  field, (unsigned long long)step);
+    writeFile(path, sizeof(LzHeader) + h.payloadBytes);
+    previous.swap(bits);
+}
+
+bool FrameExporter::writeFile(const std::string& path, size_t bytes) {
+    const int flags = O_WRONLY | O_CREAT | O_TRUNC;
+    int fd = -1;
+    bool direct = false;
+#ifdef O_DIRECT
+    if (settings_.directIO) {
+        fd = open(path.c_str(), flags | O_DIRECT, 0644);
+        direct = fd >= 0;
+    }
+#endif
+    if (fd < 0) {
+        fd = open(path.c_str(), flags, 0644);
+    }
+    if (fd < 0) {
+        errors_.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+#ifdef F_NOCACHE
+    if (settings_.directIO) {
+        fcntl(fd, F_NOCACHE, 1);
+    }
+#endif
+
+    // O_DIRECT writes whole blocks from the aligned buffer, then trims.
+    size_t length = bytes;
+    if (direct) {
+        length = (bytes + kBlock - 1) / kBlock * kBlock;
+        std::memset(out_ + bytes, 0, length - bytes);
+    }
+    size_t done = 0;
+    while (done < length) {
+        ssize_t w = write(fd, out_ + done, length - done);
+        if (w < 0 && errno == EINTR) {
+            continue;
+        }
+        if (w < 0 && direct && errno == EINVAL && done == 0) {
+            // The filesystem accepted O_DIRECT at open but not for writes.
+            close(fd);
+            fd = open(path.c_str(), flags, 0644);
+            direct = false;
+            length = bytes;
+            if (fd >= 0) {
+                continue;
+            }
+        }
+        if (w <= 0) {
+            if (fd >= 0) {
+                close(fd);
+            }
+            errors_.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+        done += (size_t)w;
+    }
+    bool ok = length == bytes || ftruncate(fd, (off_t)bytes) == 0;
+    ok = close(fd) == 0 && ok;
+    if (!ok) {
+        errors_.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+    bytes_.fetch_add(bytes, std::memory_order_relaxed);
+    direct_.store(direct, std::memory_order_relaxed);
+    return true;
+}
+
+bool FrameReader::read(const std::string& path, std::vector<float>& out, int& n,
+                       uint64_t& step) {
+    FILE* f = std::fopen(path.c_str(), "rb");
+    if (!f) {
+        return false;
+    }
+    LzHeader h;
+    std::vector<uint8_t> payload;
+    bool ok = std::fread(&h, sizeof(h), 1, f) == 1 && !std::memcmp(h.magic, "FLZ1", 4) &&
+              h.rawBytes == (uint64_t)h.n * h.n * 4;
+    if (ok) {
+        payload.resize(h.payloadBytes);
+        ok = std::fread(payload.data(), 1, payload.size(), f) == payload.size();
+    }
+    std::fclose(f);
+    bool key = ok && h.base == h.step;
+    if (!ok || (!key && (!havePrevious_ || previousStep_ != h.base ||
+                         previous_.size() != (size_t)h.n * h.n))) {
+        return false;
+    }
+
+    const size_t cells = (size_t)h.n * h.n;
+    std::vector<uint8_t> planes(cells * 4);
+    if (!lz_decompress(payload.data(), payload.size(), planes.data(), planes.size())) {
+        return false;
+    }
+    previous_.resize(cells);
+    out.resize(cells);
+    for (size_t k = 0; k < cells; k++) {
+        uint32_t d = planes[k] | (uint32_t)planes[cells + k] << 8 |
+                     (uint32_t)planes[2 * cells + k] << 16 | (uint32_t)planes[3 * cells + k] << 24;
+        previous_[k] = key ? d : d ^ previous_[k];
+        std::memcpy(&out[k], &previous_[k], 4);
+    }
+    previousStep_ = h.step;
+    havePrevious_ = true;
+    n = (int)h.n;
+    step = h.step;
+    return true;
+}
@@ -0,0 +1,120 @@
+#ifndef FRAME_EXPORT_HPP
+#define FRAME_EXPORT_HPP
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "fluid.hpp"
+
+// Raw writes the N x N interior as native float32, rows bottom to top.
+// Colorized writes binary PPMs: density through a heat ramp, velocity as
+// u in red and v in green around mid gray.
+enum class ExportFormat { Raw, Colorized };
+
+struct ExportSettings {
+    std::string directory = "frames";
+    int every = 1;              // export every this many steps
+    bool velocity = false;      // also write u and v (fp32 storage only)
+    ExportFormat format = ExportFormat::Raw;
+    float velocityScale = 1.0f; // |u| mapped to full color range
+    // Raw only: XOR against the previous frame of the same field, split the
+    // result into byte planes and LZ4-block compress it. Every keyframeEvery
+    // frames is stored without the XOR so a sequence can be entered there.
+    bool compress = false;
+    int keyframeEvery = 30;
+    // Bypass the page cache (O_DIRECT, F_NOCACHE on macOS). Falls back to
+    // buffered writes where the filesystem refuses it.
+    bool directIO = false;
+    int queueDepth = 2;         // frames buffered between solver and writer
+};
+
+struct ExportStats {
+    uint64_t frames = 0;        // frames written
+    uint64_t bytes = 0;         // bytes written to disk
+    uint64_t rawBytes = 0;      // field bytes before encoding
+    double bytesPerSec = 0;     // since the previous stats() call
+    uint64_t stalls = 0;        // submits that waited for a free slot
+    double stallMs = 0;         // total time spent waiting
+    uint64_t errors = 0;        // files that could not be written
+    bool direct = false;        // the last file went through O_DIRECT
+};
+
+// Hands fields from the stepping thread to a background writer through
+// queueDepth preallocated slots. submit() only copies; it blocks only while
+// every slot is still waiting to be written.
+class FrameExporter {
+public:
+    explicit FrameExporter(const ExportSettings& settings);
+    ~FrameExporter();
+
+    FrameExporter(const FrameExporter&) = delete;
+    FrameExporter& operator=(const FrameExporter&) = delete;
+
+    bool due(uint64_t step) const { return step % settings_.every == 0; }
+    void submit(const FluidSolver& solver, uint64_t step);
+    // Waits until everything submitted so far is on disk.
+    void flush();
+    ExportStats stats();
+
+private:
+    struct Slot {
+        int n = 0;
+        uint64_t step = 0;
+        std::vector<float> dens, u, v;
+    };
+
+    void writerLoop();
+    void writeSlot(const Slot& slot);
+    void writeField(const char* field, int n, uint64_t step, const std::vector<float>& x,
+                    std::vector<uint32_t>& previous);
+    bool writeFile(const std::string& path, size_t bytes);
+
+    ExportSettings settings_;
+    std::vector<Slot> slots_;
+    std::deque<int> free_, ready_;
+    std::mutex mutex_;
+    std::condition_variable freed_, queued_;
+    bool stop_ = false;
+    int writing_ = 0;
+    std::thread writer_;
+
+    // Writer thread only
+    uint64_t written_ = 0;
+    uint64_t lastStep_ = 0;
+    std::vector<uint32_t> prevDens_, prevU_, prevV_;
+    std::vector<uint8_t> scratch_;
+    uint8_t* out_ = nullptr;    // page-aligned output buffer
+    size_t outCapacity_ = 0;
+
+    std::atomic<uint64_t> frames_{0}, bytes_{0}, rawBytes_{0}, stalls_{0}, errors_{0};
+    std::atomic<uint64_t> stallNs_{0};
+    std::atomic<bool> direct_{false};
+    uint64_t lastBytes_ = 0;
+    std::chrono::steady_clock::time_point lastStats_;
+};
+
+// LZ4 block format. dst needs lz_bound(size) bytes; returns the
+// compressed size. lz_decompress returns false on malformed input.
+size_t lz_bound(size_t size);
+size_t lz_compress(const uint8_t* src, size_t size, uint8_t* dst);
+bool lz_decompress(const uint8_t* src, size_t size, uint8_t* dst, size_t dstSize);
+
+// Decodes a compressed raw sequence of one field in step order. Delta
+// frames need the frame before them; read() fails if it was not read.
+class FrameReader {
+public:
+    bool read(const std::string& path, std::vector<float>& out, int& n, uint64_t& step);
+
+private:
+    std::vector<uint32_t> previous_;
+    uint64_t previousStep_ = 0;
+    bool havePrevious_ = false;
+};
+
+#endif
@@ -0,0 +1,334 @@
+#include "halo_exchange.hpp"
+#include "profiler.hpp"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <csignal>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <new>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+namespace {
+
+const int kMaxRanks = 64;
+const size_t kLine = 64;
+
+// Spins a little for short waits, then gives the core away: ranks often
+// outnumber cores, and a spinning rank would starve the one it waits for.
+template <class F>
+void wait_until(F ready) {
+    for (int spin = 0; !ready(); spin++) {
+        if (spin >= 64) {
+            sched_yield();
+        }
+    }
+}
+
+size_t round_up(size_t bytes) {
+    return (bytes + kLine - 1) / kLine * kLine;
+}
+
+// Shared memory layout: ShmHeader, then 2 * (ranks - 1) rings, each a
+// ShmRing followed by its data. Ring 2r carries rank r to r+1, ring 2r+1
+// carries rank r+1 to r.
+struct ShmHeader {
+    char magic[8];
+    std::atomic<uint32_t> ready;
+    std::atomic<uint32_t> aborted;
+    uint32_t ranks;
+    uint64_t ringBytes;
+    alignas(kLine) std::atomic<uint32_t> arrived;
+    std::atomic<uint32_t> phase;
+    alignas(kLine) double sums[kMaxRanks];
+    float maxima[kMaxRanks];
+};
+
+struct ShmRing {
+    alignas(kLine) std::atomic<uint64_t> head;  // bytes written, by the sender only
+    alignas(kLine) std::atomic<uint64_t> tail;  // bytes read, by the receiver only
+};
+
+// wait_until for the transport's own waits, which give up once any rank
+// has aborted the run.
+template <class F>
+void wait_live(const ShmHeader* h, F ready) {
+    wait_until([&] {
+        if (h->aborted.load(std::memory_order_acquire)) {
+            throw HaloAborted();
+        }
+        return ready();
+    });
+}
+
+size_t ring_stride(size_t ringBytes) {
+    return sizeof(ShmRing) + round_up(ringBytes);
+}
+
+size_t segment_bytes(int ranks, size_t ringBytes) {
+    return round_up(sizeof(ShmHeader)) + 2 * (ranks - 1) * ring_stride(ringBytes);
+}
+
+ShmRing* ring_at(void* map, size_t ringBytes, int from, int to) {
+    int index = from < to ? 2 * from : 2 * to + 1;
+    char* rings = (char*)map + round_up(sizeof(ShmHeader));
+    return (ShmRing*)(rings + index * ring_stride(ringBytes));
+}
+
+} // namespace
+
+ShmTransport::ShmTransport(void* map, size_t bytes, int rank)
+    : map_(map), bytes_(bytes), rank_(rank) {
+    const ShmHeader* h = (const ShmHeader*)map_;
+    ranks_ = (int)h->ranks;
+    ringBytes_ = h->ringBytes;
+}
+
+ShmTransport::~ShmTransport() {
+    munmap(map_, bytes_);
+}
+
+std::unique_ptr<ShmTransport> ShmTransport::create(const std::string& name, int ranks,
+                                                   size_t ringBytes) {
+    if (ranks < 1 || ranks > kMaxRanks || ringBytes == 0) {
+        return nullptr;
+    }
+    ringBytes = round_up(ringBytes);
+    const size_t bytes = segment_bytes(ranks, ringBytes);
+    int fd = shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+    if (fd < 0) {
+        return nullptr;
+    }
+    void* map = MAP_FAILED;
+    if (ftruncate(fd, (off_t)bytes) == 0) {
+        map = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    }
+    close(fd);
+    if (map == MAP_FAILED) {
+        shm_unlink(name.c_str());
+        return nullptr;
+    }
+    ShmHeader* h = new (map) ShmHeader;
+    std::memcpy(h->magic, "FLUIDSHM", 8);
+    h->aborted.store(0, std::memory_order_relaxed);
+    h->ranks = (uint32_t)ranks;
+    h->ringBytes = ringBytes;
+    h->arrived.store(0, std::memory_order_relaxed);
+    h->phase.store(0, std::memory_order_relaxed);
+    char* rings = (char*)map + round_up(sizeof(ShmHeader));
+    for (int k = 0; k < 2 * (ranks - 1); k++) {
+        ShmRing* r = new (rings + k * ring_stride(ringBytes)) ShmRing;
+        r->head.store(0, std::memory_order_relaxed);
+        r->tail.store(0, std::memory_order_relaxed);
+    }
+    h->ready.store(1, std::memory_order_release);
+    return std::unique_ptr<ShmTransport>(new ShmTransport(map, bytes, 0));
+}
+
+std::unique_ptr<ShmTransport> ShmTransport::attach(const std::string& name, int rank) {
+    int fd = shm_open(name.c_str(), O_RDWR, 0600);
+    if (fd < 0) {
+        return nullptr;
+    }
+    // The creator may still be sizing the segment.
+    struct stat st;
+    wait_until([&] { return fstat(fd, &st) != 0 || (size_t)st.st_size >= sizeof(ShmHeader); });
+    void* map = MAP_FAILED;
+    if ((size_t)st.st_size >= sizeof(ShmHeader)) {
+        map = mmap(nullptr, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    }
+    close(fd);
+    if (map == MAP_FAILED) {
+        return nullptr;
+    }
+    const ShmHeader* h = (const ShmHeader*)map;
+    wait_until([&] { return h->ready.load(std::memory_order_acquire) != 0; });
+    if (std::memcmp(h->magic, "FLUIDSHM", 8) || rank < 0 || rank >= (int)h->ranks ||
+        (size_t)st.st_size < segment_bytes(h->ranks, h->ringBytes)) {
+        munmap(map, st.st_size);
+        return nullptr;
+    }
+    return std::unique_ptr<ShmTransport>(new ShmTransport(map, st.st_size, rank));
+}
+
+void ShmTransport::send(int to, const void* data, size_t bytes) {
+    ShmRing* r = ring_at(map_, ringBytes_, rank_, to);
+    uint8_t* buffer = (uint8_t*)(r + 1);
+    const uint8_t* src = (const uint8_t*)data;
+    uint64_t head = r->head.load(std::memory_order_relaxed);
+    while (bytes > 0) {
+        uint64_t tail;
+        wait_live((const ShmHeader*)map_, [&] {
+            tail = r->tail.load(std::memory_order_acquire);
+            return head - tail < ringBytes_;
+        });
+        size_t offset = head % ringBytes_;
+        size_t chunk = std::min({bytes, (size_t)(ringBytes_ - (head - tail)),
+                                 ringBytes_ - offset});
+        std::memcpy(buffer + offset, src, chunk);
+        head += chunk;
+        src += chunk;
+        bytes -= chunk;
+        r->head.store(head, std::memory_order_release);
+    }
+}
+
+void ShmTransport::receive(int from, void* data, size_t bytes) {
+    ShmRing* r = ring_at(map_, ringBytes_, from, rank_);
+    const uint8_t* buffer = (const uint8_t*)(r + 1);
+    uint8_t* dst = (uint8_t*)data;
+    uint64_t tail = r->tail.load(std::memory_order_relaxed);
+    while (bytes > 0) {
+        uint64_t head;
+        wait_live((const ShmHeader*)map_, [&] {
+            head = r->head.load(std::memory_order_acquire);
+            return head != tail;
+        });
+        size_t offset = tail % ringBytes_;
+        size_t chunk = std::min({bytes, (size_t)(head - tail), ringBytes_ - offset});
+        std::memcpy(dst, buffer + offset, chunk);
+        tail += chunk;
+        dst += chunk;
+        bytes -= chunk;
+        r->tail.store(tail, std::memory_order_release);
+    }
+}
+
+void ShmTransport::barrier() {
+    ShmHeader* h = (ShmHeader*)map_;
+    uint32_t phase = h->phase.load(std::memory_order_acquire);
+    if (h->arrived.fetch_add(1, std::memory_order_acq_rel) + 1 == (uint32_t)ranks_) {
+        h->arrived.store(0, std::memory_order_relaxed);
+        h->phase.fetch_add(1, std::memory_order_release);
+        return;
+    }
+    wait_live(h, [&] { return h->phase.load(std::memory_order_acquire) != phase; });
+}
+
+void ShmTransport::abort() {
+    ((ShmHeader*)map_)->aborted.store(1, std::memory_order_release);
+}
+
+// Publish, wait for everyone, combine, and wait again before the slots can
+// be reused.
+double ShmTransport::allreduceSum(double value) {
+    ProfileScope scope("allreduce");
+    ShmHeader* h = (ShmHeader*)map_;
+    h->sums[rank_] = value;
+    barrier();
+    double total = 0.0;
+    for (int r = 0; r < ranks_; r++) {
+        total += h->sums[r];
+    }
+    barrier();
+    return total;
+}
+
+float ShmTransport::allreduceMax(float value) {
+    ProfileScope scope("allreduce");
+    ShmHeader* h = (ShmHeader*)map_;
+    h->maxima[rank_] = value;
+    barrier();
+    float result = h->maxima[0];
+    for (int r = 1; r < ranks_; r++) {
+        result = std::max(result, h->maxima[r]);
+    }
+    barrier();
+    return result;
+}
+
+bool run_ranks(int ranks, size_t ringBytes, const std::function<void(HaloTransport&)>& body) {
+    static std::atomic<int> runs{0};
+    const std::string name = "/fluid-halo-" + std::to_string(getpid()) + "-" +
+                             std::to_string(runs++);
+    std::unique_ptr<ShmTransport> transport = ShmTransport::create(name, ranks, ringBytes);
+    if (!transport) {
+        return false;
+    }
+    // Children must not replay output the parent has buffered.
+    std::fflush(nullptr);
+    std::vector<pid_t> children;
+    bool ok = true;
+    for (int r = 1; r < ranks; r++) {
+        pid_t pid = fork();
+        if (pid == 0) {
+            int status = 1;
+            // Never let an exception unwind into the caller's copy of the stack.
+            try {
+                if (std::unique_ptr<ShmTransport> child = ShmTransport::attach(name, r)) {
+                    child->barrier();
+                    body(*child);
+                    status = 0;
+                }
+            } catch (...) {
+            }
+            if (status) {
+                // The mapping inherited from the parent works even when
+                // attaching did not.
+                transport->abort();
+            }
+            std::fflush(nullptr);
+            _exit(status);
+        }
+        if (pid < 0) {
+            ok = false;
+            break;
+        }
+        children.push_back(pid);
+    }
+    if (!ok) {
+        // A missing rank would hang the others at the first barrier.
+        for (pid_t pid : children) {
+            kill(pid, SIGKILL);
+        }
+        shm_unlink(name.c_str());
+        for (pid_t pid : children) {
+            waitpid(pid, nullptr, 0);
+        }
+        return false;
+    }
+
+    // Rank 0 is busy in body, so another thread reaps the children and
+    // aborts the run as soon as one of them fails, crashes included.
+    std::atomic<bool> childFailed{false};
+    std::thread watcher([&] {
+        std::vector<pid_t> running = children;
+        while (!running.empty()) {
+            for (size_t k = 0; k < running.size();) {
+                int status = 0;
+                pid_t done = waitpid(running[k], &status, WNOHANG);
+                if (done == 0) {
+                    k++;
+                    continue;
+                }
+                if (done != running[k] || !WIFEXITED(status) || WEXITSTATUS(status)) {
+                    childFailed = true;
+                    transport->abort();
+                }
+                running.erase(running.begin() + k);
+            }
+            if (!running.empty()) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            }
+        }
+    });
+    try {
+        // Everyone has the segment mapped; the name is no longer needed.
+        transport->barrier();
+        shm_unlink(name.c_str());
+        body(*transport);
+    } catch (...) {
+        ok = false;
+        transport->abort();
+    }
+    shm_unlink(name.c_str());
+    watcher.join();
+    return ok && !childFailed;
+}
@@ -0,0 +1,81 @@
+#ifndef HALO_EXCHANGE_HPP
+#define HALO_EXCHANGE_HPP
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <stdexcept>
+#include <string>
+
+// Message layer between the ranks of a decomposed run. Point-to-point
+// traffic is an ordered byte stream per (sender, receiver) pair: send()
+// may block until the receiver has made room, receive() blocks until all
+// bytes arrived. Collectives must be called by every rank in the same order
+// and return the same value everywhere.
+//
+// If a rank fails, the run is aborted: blocking calls on the other ranks
+// throw HaloAborted instead of waiting for it forever.
+struct HaloAborted : std::runtime_error {
+    HaloAborted() : std::runtime_error("halo exchange aborted: a rank failed") {}
+};
+
+class HaloTransport {
+public:
+    virtual ~HaloTransport() = default;
+
+    virtual int rank() const = 0;
+    virtual int size() const = 0;
+    virtual void send(int to, const void* data, size_t bytes) = 0;
+    virtual void receive(int from, void* data, size_t bytes) = 0;
+    // Combined in rank order, so sums are reproducible run to run.
+    virtual double allreduceSum(double value) = 0;
+    virtual float allreduceMax(float value) = 0;
+    virtual void barrier() = 0;
+};
+
+// Ranks on one machine talking through a POSIX shared memory segment: one
+// single-producer, single-consumer ring per direction between neighboring
+// ranks, plus slots for the reductions and a barrier. Only rank +-1 may be
+// addressed. Waits spin briefly, then yield the CPU.
+class ShmTransport : public HaloTransport {
+public:
+    // The creating rank sizes and initializes the segment; the others attach
+    // to it by name and wait until it is ready. Both return null on failure.
+    static std::unique_ptr<ShmTransport> create(const std::string& name, int ranks,
+                                                size_t ringBytes);
+    static std::unique_ptr<ShmTransport> attach(const std::string& name, int rank);
+    ~ShmTransport() override;
+
+    ShmTransport(const ShmTransport&) = delete;
+    ShmTransport& operator=(const ShmTransport&) = delete;
+
+    int rank() const override { return rank_; }
+    int size() const override { return ranks_; }
+    void send(int to, const void* data, size_t bytes) override;
+    void receive(int from, void* data, size_t bytes) override;
+    double allreduceSum(double value) override;
+    float allreduceMax(float value) override;
+    void barrier() override;
+    // Marks the run failed; every rank's pending and later waits throw.
+    void abort();
+
+private:
+    ShmTransport(void* map, size_t bytes, int rank);
+
+    void* map_;
+    size_t bytes_;
+    int rank_;
+    int ranks_;
+    size_t ringBytes_;
+};
+
+// Runs body on `ranks` processes joined by a fresh ShmTransport: the caller
+// is rank 0, the others are forked children. Returns false if the segment
+// could not be set up or any rank failed. A rank that throws, cannot attach
+// or dies aborts the transport, so the others unwind out of body instead of
+// hanging; the caller polls its children for that while rank 0 runs.
+// Forking copies the caller, so state set up before the call is visible to
+// every rank.
+bool run_ranks(int ranks, size_t ringBytes, const std::function<void(HaloTransport&)>& body);
+
+#endif
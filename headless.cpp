@@ -0,0 +1,182 @@
+#include "checkpoint.hpp"
+#include "fluid.hpp"
+#include "frame_export.hpp"
+#include "step_control.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <memory>
+
+// Offline runs without a window: steps the solver as fast as it goes and
+// hands every --every'th frame to the background exporter.
+static void usage() {
+    std::cerr << "usage: fluid_headless [--size n] [--steps k] [--every k] [--out dir] "
+                 "[--velocity] [--color] [--compress] [--direct] [--queue depth] "
+                 "[--storage fp32|fp16|bf16] [--checkpoint path] [--checkpoint-every sec] "
+                 "[--resume] [--advect sl|maccormack|bfecc] [--adaptive] [--budget ms] "
+                 "[--obstacle]"
+              << std::endl;
+}
+
+int main(int argc, char** argv) {
+    int n = 200;
+    long steps = 600;
+    ExportSettings settings;
+    FieldStorage storage = FieldStorage::Float32;
+    std::string checkpoint;
+    double checkpointEvery = 30;
+    bool resume = false;
+    AdvectScheme advection = AdvectScheme::SemiLagrangian;
+    bool adaptive = false;
+    bool obstacle = false;
+    StepControl control;
+    for (int i = 1; i < argc; i++) {
+        if (!std::strcmp(argv[i], "--size") && i + 1 < argc) {
+            n = std::atoi(argv[++i]);
+        } else if (!std::strcmp(argv[i], "--steps") && i + 1 < argc) {
+            steps = std::atol(argv[++i]);
+        } else if (!std::strcmp(argv[i], "--every") && i + 1 < argc) {
+            settings.every = std::atoi(argv[++i]);
+        } else if (!std::strcmp(argv[i], "--out") && i + 1 < argc) {
+            settings.directory = argv[++i];
+        } else if (!std::strcmp(argv[i], "--velocity")) {
+            settings.velocity = true;
+        } else if (!std::strcmp(argv[i], "--color")) {
+            settings.format = ExportFormat::Colorized;
+        } else if (!std::strcmp(argv[i], "--compress")) {
+            settings.compress = true;
+        } else if (!std::strcmp(argv[i], "--direct")) {
+            settings.directIO = true;
+        } else if (!std::strcmp(argv[i], "--queue") && i + 1 < argc) {
+            settings.queueDepth = std::atoi(argv[++i]);
+        } else if (!std::strcmp(argv[i], "--checkpoint") && i + 1 < argc) {
+            checkpoint = argv[++i];
+        } else if (!std::strcmp(argv[i], "--checkpoint-every") && i + 1 < argc) {
+            checkpointEvery = std::atof(argv[++i]);
+        } else if (!std::strcmp(argv[i], "--resume")) {
+            resume = true;
+        } else if (!std::strcmp(argv[i], "--adaptive")) {
+            adaptive = true;
+        } else if (!std::strcmp(argv[i], "--obstacle")) {
+            obstacle = true;
+        } else if (!std::strcmp(argv[i], "--budget") && i + 1 < argc) {
+            control.budgetMs = std::atof(argv[++i]);
+        } else if (!std::strcmp(argv[i], "--advect") && i + 1 < argc) {
+            const char* s = argv[++i];
+            advection = !std::strcmp(s, "maccormack") ? AdvectScheme::MacCormack
+                      : !std::strcmp(s, "bfecc")      ? AdvectScheme::BFECC
+                                                      : AdvectScheme::SemiLagrangian;
+        } else if (!std::strcmp(argv[i], "--storage") && i + 1 < argc) {
+            const char* s = argv[++i];
+            storage = !std::strcmp(s, "fp16") ? FieldStorage::Float16
+                    : !std::strcmp(s, "bf16") ? FieldStorage::BFloat16
+                                              : FieldStorage::Float32;
+        } else {
+            usage();
+            return 1;
+        }
+    }
+    if (n < 4 || steps < 0) {
+        usage();
+        return 1;
+    }
+
+    // --resume takes the grid size, time and parameters from the checkpoint.
+    CheckpointView view;
+    if (resume && !view.open(checkpoint)) {
+        std::cerr << "No checkpoint to resume at '" << checkpoint << "'" << std::endl;
+        return 1;
+    }
+    FluidSolver solver(resume ? view.n() : n);
+    solver.params.storage = storage;
+    solver.params.advection = advection;
+    solver.initFluid();
+    long first = 1;
+    if (resume) {
+        auto t0 = std::chrono::steady_clock::now();
+        const float* fields[kCheckpointFields];
+        for (int k = 0; k < kCheckpointFields; k++) {
+            fields[k] = view.field(k);
+        }
+        solver.params = view.params();
+        solver.simulationTime = view.simulationTime();
+        solver.restoreFields(fields);
+        view.close();
+        first = std::lround(solver.simulationTime / solver.params.dt) + 1;
+        std::printf("resumed at step %ld (t = %.3f) in %.1f ms\n", first - 1,
+                    solver.simulationTime, std::chrono::duration<double, std::milli>(
+                        std::chrono::steady_clock::now() - t0).count());
+    }
+    if (obstacle) {
+        // A disk in the path of the rotating source
+        const int N = solver.n();
+        solver.obstacles().addDisk(N * 0.75f, N * 0.5f + 1.0f, N * 0.1f);
+    }
+    control.maxDt = solver.params.dt;
+    StepController controller(control);
+    uint64_t substeps = 0, overBudget = 0;
+    FrameExporter exporter(settings);
+    std::unique_ptr<CheckpointWriter> checkpoints;
+    if (!checkpoint.empty()) {
+        checkpoints.reset(new CheckpointWriter(checkpoint, checkpointEvery));
+    }
+
+    using clock = std::chrono::steady_clock;
+    auto start = clock::now();
+    auto lastReport = start;
+    for (long step = first; step <= steps; step++) {
+        if (adaptive) {
+            StepReport r = controller.advance(solver, solver.params.dt);
+            substeps += r.substeps;
+            overBudget += r.overBudget;
+        } else {
+            solver.updateFluid(solver.params.dt);
+            substeps++;
+        }
+        if (exporter.due(step)) {
+            exporter.submit(solver, step);
+        }
+        if (checkpoints) {
+            checkpoints->maybeSave(solver);
+        }
+        auto now = clock::now();
+        if (now - lastReport >= std::chrono::seconds(1)) {
+            lastReport = now;
+            ExportStats s = exporter.stats();
+            std::printf("step %ld: %llu frames, %.1f MB/s, %llu stalls (%.1f ms)\n", step,
+                        (unsigned long long)s.frames, s.bytesPerSec / 1e6,
+                        (unsigned long long)s.stalls, s.stallMs);
+        }
+    }
+    exporter.flush();
+    if (checkpoints && !checkpoints->save(solver)) {
+        std::cerr << "Failed to write checkpoint '" << checkpoint << "'" << std::endl;
+    }
+    double elapsed = std::chrono::duration<double>(clock::now() - start).count();
+    long ran = std::max(0L, steps - first + 1);
+    ExportStats s = exporter.stats();
+    std::printf("%ld steps in %.2f s (%.1f steps/s); %llu frames, %.1f MB written "
+                "(%.2fx of raw), %.1f MB/s, %llu stalls (%.1f ms)%s%s\n",
+                ran, elapsed, ran / elapsed, (unsigned long long)s.frames, s.bytes / 1e6,
+                s.rawBytes ? double(s.bytes) / s.rawBytes : 0.0, s.bytes / 1e6 / elapsed,
+                (unsigned long long)s.stalls, s.stallMs, s.direct ? ", O_DIRECT" : "",
+                s.errors ? ", write errors" : "");
+    if (adaptive) {
+        std::printf("%.2f substeps per step, %llu steps over budget, %d sweeps at the end\n",
+                    ran ? double(substeps) / ran : 0.0, (unsigned long long)overBudget,
+                    solver.params.iterations);
+    }
+    if (checkpoints) {
+        CheckpointStats c = checkpoints->stats();
+        std::printf("%llu checkpoints, %llu pages written, %llu unchanged, %llu skipped "
+                    "while busy; last snapshot %.2f ms, write %.1f ms\n",
+                    (unsigned long long)c.checkpoints, (unsigned long long)c.pagesWritten,
+                    (unsigned long long)c.pagesUnchanged, (unsigned long long)c.busy,
+                    c.snapshotMs, c.writeMs);
+    }
+    return s.errors ? 1 : 0;
+}
@@ -1,10 +1,41 @@
 #include <GL/glew.h>
 #include <GLFW/glfw3.h>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
 #include <iostream>
+#include <memory>
+#include "checkpoint.hpp"
 #include "fluid.hpp"
+#include "profiler.hpp"
 #include "render.hpp"
+#include "sim_thread.hpp"
+#include "step_control.hpp"
+
+int main(int argc, char** argv) {
+    int gridN = 200;
+    RenderMode mode = RenderMode::Texture;
+    const char* profilePrefix = nullptr;
+    const char* checkpointPath = nullptr;
+    bool adaptive = false;
+    for (int i = 1; i < argc; i++) {
+        if (!std::strcmp(argv[i], "--quads")) {
+            mode = RenderMode::Quads;
+        } else if (!std::strcmp(argv[i], "--profile") && i + 1 < argc) {
+            profilePrefix = argv[++i];
+        } else if (!std::strcmp(argv[i], "--checkpoint") && i + 1 < argc) {
+            checkpointPath = argv[++i];
+        } else if (!std::strcmp(argv[i], "--adaptive")) {
+            adaptive = true;
+        } else {
+            gridN = std::atoi(argv[i]);
+        }
+    }
+    if (gridN < 4) {
+        std::cerr << "Usage: FluidSimulation [--quads] [--profile prefix] [--checkpoint path] [--adaptive] [grid size >= 4]" << std::endl;
+        return -1;
+    }
 
-int main() {
     if (!glfwInit()) {
         std::cerr << "Failed to initialize GLFW" << std::endl;
         return -1;
@@ -25,33 +56,96 @@ int main() {
     }
 
     glfwMakeContextCurrent(window);
+    // Rendering no longer waits on the solver; pace it to the display
+    // instead of spinning next to the simulation thread.
+    glfwSwapInterval(1);
 
-    if (!initGL()) {
+    if (!initGL(mode)) {
         glfwDestroyWindow(window);
         glfwTerminate();
         std::cerr << "Failed to initialize OpenGL" << std::endl;
         return -1;
     }
 
-    initFluid();
-    setupInputCallbacks(window);
+    if (profilePrefix) {
+        profiler_enable(true);
+        profile_thread_name("render");
+    }
 
-    double lastTime = glfwGetTime();
-    while (!glfwWindowShouldClose(window)) {
-        double currentTime = glfwGetTime();
-        double frameTime = currentTime - lastTime;
-        lastTime = currentTime;
+    // An existing checkpoint of the same grid size is resumed; either way
+    // the run is checkpointed to it every 30 seconds and on exit.
+    FluidSolver solver(gridN);
+    solver.initFluid();
+    std::unique_ptr<CheckpointWriter> checkpoints;
+    if (checkpointPath) {
+        if (load_checkpoint(checkpointPath, solver)) {
+            std::cout << "Resumed from " << checkpointPath << " at t = "
+                      << solver.simulationTime << std::endl;
+        }
+        checkpoints.reset(new CheckpointWriter(checkpointPath, 30.0));
+    }
+    SimulationThread sim(solver, solver.params.dt);
+    sim.setCheckpointWriter(checkpoints.get());
+    // Substeps sized by the flow's speed, within the frame period
+    StepControl control;
+    control.maxDt = solver.params.dt;
+    StepController controller(control);
+    if (adaptive) {
+        sim.setStepController(&controller);
+    }
+    setupInputCallbacks(window, &solver);
+    sim.start();
 
-        float adjustedDt = std::min(dt, float(frameTime * 5.0));
-        updateFluid(adjustedDt);
-        updateVBO();
-        render();
+    double lastReport = glfwGetTime();
+    std::vector<StageSummary> stages;
+    while (!glfwWindowShouldClose(window)) {
+        bool fresh;
+        const DensityFrame& frame = sim.latest(fresh);
+        if (frame.n > 0) {
+            if (fresh) {
+                updateFrame(frame.dens.data(), frame.n);
+            }
+            render(frame.n);
+        }
+        if (profilePrefix) {
+            int width, height;
+            glfwGetFramebufferSize(window, &width, &height);
+            drawProfileHud(stages, width, height);
+        }
 
-        glfwSwapBuffers(window);
+        {
+            ProfileScope scope("swap_buffers");
+            glfwSwapBuffers(window);
+        }
         glfwPollEvents();
         checkGLError("main loop");
+
+        double now = glfwGetTime();
+        if (now - lastReport >= 1.0) {
+            lastReport = now;
+            SimStats stats = sim.stats();
+            char title[192];
+            std::snprintf(title, sizeof(title),
+                          "Fluid Simulation - %.0f steps/s, %.1f substeps, dropped %llu, duplicated %llu, latency %.1f ms",
+                          stats.stepRate, stats.substeps, (unsigned long long)stats.dropped,
+                          (unsigned long long)stats.duplicated, stats.latencyMs);
+            glfwSetWindowTitle(window, title);
+            if (profilePrefix) {
+                stages = profile_summary(1.0);
+            }
+        }
     }
 
+    sim.stop();
+    if (checkpoints && !checkpoints->save(solver)) {
+        std::cerr << "Failed to write checkpoint " << checkpointPath << std::endl;
+    }
+    if (profilePrefix) {
+        std::string prefix = profilePrefix;
+        if (!write_profile_csv(prefix + ".csv") || !write_chrome_trace(prefix + ".json")) {
+            std::cerr << "Failed to write profile " << prefix << ".csv/.json" << std::endl;
+        }
+    }
     cleanupGL();
     glfwDestroyWindow(window);
     glfwTerminate();
@@ -0,0 +1,456 @@
+#include "multigrid.hpp"
+#include "utils.hpp"
+#include <algorithm>
+#include <cmath>
+
+namespace {
+
+// Levels stop halving once N is at most this.
+constexpr int kCoarsestN = 4;
+
+// The coarsest level is relaxed until its residual has dropped by
+// kCoarseReduction, or kCoarseMaxSweeps sweeps have run.
+constexpr float kCoarseReduction = 1e-4f;
+constexpr int kCoarseMaxSweeps = 200;
+
+// Red-black Gauss-Seidel on the fine level, 4x - sum(neighbors) = rhs.
+// Solid cells are skipped; the boundary ones are reset after every half
+// sweep, before set_bnd.
+void smooth(int N, float* x, const float* rhs, int sweeps, const ObstacleMap* solids) {
+    Grid<0> IX{N};
+    for (int k = 0; k < sweeps; k++) {
+        for (int color = 0; color < 2; color++) {
+            auto span = [&](int j, int lo, int hi) {
+                for (int i = lo + ((lo + 1 + j + color) & 1); i <= hi; i += 2) {
+                    x[IX(i,j)] = (rhs[IX(i,j)] + x[IX(i-1,j)] + x[IX(i+1,j)] +
+                                  x[IX(i,j-1)] + x[IX(i,j+1)]) * 0.25f;
+                }
+            };
+            for (int j = 1; j <= N; j++) {
+                if (!solids) {
+                    span(j, 1, N);
+                    continue;
+                }
+                solids->forEachRun(j, 1, N, [&](int lo, int hi, bool solid) {
+                    if (!solid) {
+                        span(j, lo, hi);
+                    }
+                });
+            }
+            if (solids) {
+                solids->apply(0, x);
+            }
+            set_bnd(N, 0, x);
+        }
+    }
+}
+
+// Solid cells have no pressure equation; their residual is 0 so none of it
+// reaches the coarse levels.
+void residual(int N, const float* x, const float* rhs, float* r, const ObstacleMap* solids) {
+    Grid<0> IX{N};
+    for (int j = 1; j <= N; j++) {
+        for (int i = 1; i <= N; i++) {
+            r[IX(i,j)] = rhs[IX(i,j)] - (4 * x[IX(i,j)] - x[IX(i-1,j)] - x[IX(i+1,j)] -
+                                         x[IX(i,j-1)] - x[IX(i,j+1)]);
+            if (solids && solids->solid(i, j)) {
+                r[IX(i,j)] = 0.0f;
+            }
+        }
+    }
+}
+
+float rms(int N, const float* r) {
+    Grid<0> IX{N};
+    double sum = 0.0;
+    for (int j = 1; j <= N; j++) {
+        for (int i = 1; i <= N; i++) {
+            sum += double(r[IX(i,j)]) * r[IX(i,j)];
+        }
+    }
+    return float(std::sqrt(sum / (double(N) * N)));
+}
+
+// Coarse levels are finite-volume discretizations over cells of width w
+// (in fine cells): the flux through a face is its length times the
+// difference of the two cell values over the distance between their
+// centers, and rhs holds the residual integrated over the cell. Walls carry
+// no flux, so ghost cells are never read. Neither do faces between a fluid
+// and a solid cell, and solid cells are not relaxed.
+
+// Coefficients of the left, right, down and up faces of (i,j).
+template <class Level>
+void coarse_faces(const Level& l, int i, int j, float f[4]) {
+    f[0] = l.a[i-1];
+    f[1] = l.a[i];
+    f[2] = l.a[j-1];
+    f[3] = l.a[j];
+    if (!l.solid.empty()) {
+        Grid<0> IX{l.n};
+        if (l.solid[IX(i-1,j)]) f[0] = 0.0f;
+        if (l.solid[IX(i+1,j)]) f[1] = 0.0f;
+        if (l.solid[IX(i,j-1)]) f[2] = 0.0f;
+        if (l.solid[IX(i,j+1)]) f[3] = 0.0f;
+    }
+}
+
+template <class Level>
+float coarse_diag(const Level& l, const float f[4], int i, int j) {
+    return l.w[j] * (f[0] + f[1]) + l.w[i] * (f[2] + f[3]);
+}
+
+template <class Level>
+float coarse_flux(const Level& l, const float f[4], const float* x, int i, int j) {
+    Grid<0> IX{l.n};
+    return l.w[j] * (f[0] * x[IX(i-1,j)] + f[1] * x[IX(i+1,j)]) +
+           l.w[i] * (f[2] * x[IX(i,j-1)] + f[3] * x[IX(i,j+1)]);
+}
+
+template <class Level>
+bool coarse_solid(const Level& l, int i, int j) {
+    return !l.solid.empty() && l.solid[Grid<0>{l.n}(i,j)];
+}
+
+template <class Level>
+void smooth_coarse(const Level& l, float* x, const float* rhs, int sweeps) {
+    Grid<0> IX{l.n};
+    for (int k = 0; k < sweeps; k++) {
+        for (int color = 0; color < 2; color++) {
+            for (int j = 1; j <= l.n; j++) {
+                for (int i = 1 + ((j + color) & 1); i <= l.n; i += 2) {
+                    if (coarse_solid(l, i, j)) {
+                        continue;
+                    }
+                    float f[4];
+                    coarse_faces(l, i, j, f);
+                    // A fluid pocket walled in by solids has no equation.
+                    const float d = coarse_diag(l, f, i, j);
+                    if (d > 0.0f) {
+                        x[IX(i,j)] = (rhs[IX(i,j)] + coarse_flux(l, f, x, i, j)) / d;
+                    }
+                }
+            }
+        }
+    }
+}
+
+template <class Level>
+void residual_coarse(const Level& l, const float* x, const float* rhs, float* r) {
+    Grid<0> IX{l.n};
+    for (int j = 1; j <= l.n; j++) {
+        for (int i = 1; i <= l.n; i++) {
+            if (coarse_solid(l, i, j)) {
+                r[IX(i,j)] = 0.0f;
+                continue;
+            }
+            float f[4];
+            coarse_faces(l, i, j, f);
+            r[IX(i,j)] = rhs[IX(i,j)] - (coarse_diag(l, f, i, j) * x[IX(i,j)] -
+                                         coarse_flux(l, f, x, i, j));
+        }
+    }
+}
+
+// Sums each 2x2 block of fine residuals into one coarse cell; when the fine
+// size is odd the last coarse row and column take a single fine cell.
+void restrict_residual(int nf, int nc, const float* rf, float* rc) {
+    Grid<0> C{nc};
+    Grid<0> F{nf};
+    for (int J = 1; J <= nc; J++) {
+        int j0 = 2 * J - 1, j1 = std::min(2 * J, nf);
+        for (int I = 1; I <= nc; I++) {
+            int i0 = 2 * I - 1, i1 = std::min(2 * I, nf);
+            float sum = 0.0f;
+            for (int j = j0; j <= j1; j++) {
+                for (int i = i0; i <= i1; i++) {
+                    sum += rf[F(i,j)];
+                }
+            }
+            rc[C(I,J)] = sum;
+        }
+    }
+}
+
+// Adds the coarse correction, bilinearly interpolated between coarse cell
+// centers and held constant past the outermost ones, to the fine cells
+// solidAt() says are fluid.
+template <class Level, class Solid>
+void prolong_add(int nf, const Level& coarse, const float* ec, float* xf, Solid solidAt) {
+    Grid<0> C{coarse.n};
+    Grid<0> F{nf};
+    for (int j = 1; j <= nf; j++) {
+        int J = coarse.lo[j];
+        float tj = coarse.t[j];
+        for (int i = 1; i <= nf; i++) {
+            if (solidAt(i, j)) {
+                continue;
+            }
+            int I = coarse.lo[i];
+            float ti = coarse.t[i];
+            xf[F(i,j)] += (1 - tj) * ((1 - ti) * ec[C(I,J)] + ti * ec[C(I+1,J)]) +
+                          tj * ((1 - ti) * ec[C(I,J+1)] + ti * ec[C(I+1,J+1)]);
+        }
+    }
+}
+
+} // namespace
+
+Multigrid::Multigrid(int n) : n_(n), r0_(Grid<0>{n}.size()) {
+    // Cell edges of the finer level, in fine-grid cells.
+    std::vector<float> edges(n + 1);
+    for (int i = 0; i <= n; i++) {
+        edges[i] = float(i);
+    }
+    while (n > kCoarsestN) {
+        int nf = n;
+        n = (n + 1) / 2;
+        Level level;
+        level.n = n;
+        level.x.assign(Grid<0>{n}.size(), 0.0f);
+        level.rhs.assign(level.x.size(), 0.0f);
+        level.r.assign(level.x.size(), 0.0f);
+
+        std::vector<float> coarseEdges(n + 1);
+        coarseEdges[0] = edges[0];
+        for (int I = 1; I <= n; I++) {
+            coarseEdges[I] = edges[std::min(2 * I, nf)];
+        }
+        level.w.assign(n + 2, 0.0f);
+        std::vector<float> center(n + 2);
+        for (int I = 1; I <= n; I++) {
+            level.w[I] = coarseEdges[I] - coarseEdges[I-1];
+            center[I] = 0.5f * (coarseEdges[I] + coarseEdges[I-1]);
+        }
+        level.a.assign(n + 1, 0.0f);
+        for (int I = 1; I < n; I++) {
+            level.a[I] = 1.0f / (center[I+1] - center[I]);
+        }
+
+        level.lo.assign(nf + 1, 1);
+        level.t.assign(nf + 1, 0.0f);
+        int I = 1;
+        for (int i = 1; i <= nf; i++) {
+            float c = 0.5f * (edges[i] + edges[i-1]);
+            while (I < n && center[I+1] <= c) {
+                I++;
+            }
+            level.lo[i] = I;
+            if (I < n && c > center[I]) {
+                level.t[i] = (c - center[I]) / (center[I+1] - center[I]);
+            }
+        }
+
+        levels_.push_back(std::move(level));
+        edges = std::move(coarseEdges);
+    }
+}
+
+void Multigrid::solve(float* p, const float* div, const MultigridSettings& settings,
+                      const ObstacleMap* solids) {
+    solids_ = solids && !solids->empty() ? solids : nullptr;
+    if (!solids_) {
+        if (maskVersion_) {
+            for (Level& l : levels_) {
+                l.solid.clear();
+                l.ring1.clear();
+                l.ring2.clear();
+            }
+            maskVersion_ = 0;
+        }
+    } else if (maskVersion_ != solids_->version()) {
+        restrictSolids();
+        maskVersion_ = solids_->version();
+    }
+    for (int c = 0; c < settings.cycles; c++) {
+        cycle(0, p, div, settings);
+    }
+}
+
+// A coarse cell is solid when all the finer cells it covers are. Solid
+// cells next to fluid (ring1) and those next to ring1 (ring2) are listed so
+// fillSolids() can extend a correction into them.
+void Multigrid::restrictSolids() {
+    int nf = n_;
+    for (Level& l : levels_) {
+        Grid<0> C{l.n};
+        Grid<0> F{nf};
+        const std::vector<uint8_t>* fine = &l == &levels_[0] ? nullptr : &(&l - 1)->solid;
+        auto fineSolid = [&](int i, int j) {
+            return fine ? (*fine)[F(i,j)] != 0 : solids_->solid(i, j);
+        };
+        l.solid.assign(C.size(), 0);
+        for (int J = 1; J <= l.n; J++) {
+            for (int I = 1; I <= l.n; I++) {
+                bool all = true;
+                for (int j = 2 * J - 1; j <= std::min(2 * J, nf); j++) {
+                    for (int i = 2 * I - 1; i <= std::min(2 * I, nf); i++) {
+                        all = all && fineSolid(i, j);
+                    }
+                }
+                l.solid[C(I,J)] = all;
+            }
+        }
+        // Ghost cells count as solid here, so walls never join a ring.
+        auto fluid = [&](int k) {
+            int i = k % C.stride(), j = k / C.stride();
+            return i >= 1 && i <= l.n && j >= 1 && j <= l.n && !l.solid[k];
+        };
+        l.ring1.clear();
+        l.ring2.clear();
+        for (int J = 1; J <= l.n; J++) {
+            for (int I = 1; I <= l.n; I++) {
+                const int k = C(I,J);
+                if (l.solid[k] && (fluid(k - 1) || fluid(k + 1) ||
+                                   fluid(k - C.stride()) || fluid(k + C.stride()))) {
+                    l.ring1.push_back(k);
+                    l.solid[k] = 2;
+                }
+            }
+        }
+        for (int J = 1; J <= l.n; J++) {
+            for (int I = 1; I <= l.n; I++) {
+                const int k = C(I,J);
+                if (l.solid[k] == 1 && (l.solid[k - 1] == 2 || l.solid[k + 1] == 2 ||
+                                        l.solid[k - C.stride()] == 2 ||
+                                        l.solid[k + C.stride()] == 2)) {
+                    l.ring2.push_back(k);
+                }
+            }
+        }
+        nf = l.n;
+    }
+}
+
+// Sets the solid cells next to fluid to the mean of their fluid neighbors
+// and the ring behind them to the mean of those, so interpolating the
+// correction near a solid does not blend in zeros.
+void Multigrid::fillSolids(Level& l) const {
+    const int s = l.n + 2;
+    auto fill = [&](const std::vector<int>& cells, uint8_t from) {
+        for (int k : cells) {
+            float sum = 0.0f;
+            int count = 0;
+            for (int d : {k - 1, k + 1, k - s, k + s}) {
+                int i = d % s, j = d / s;
+                if (i >= 1 && i <= l.n && j >= 1 && j <= l.n && l.solid[d] == from) {
+                    sum += l.x[d];
+                    count++;
+                }
+            }
+            l.x[k] = count ? sum / count : 0.0f;
+        }
+    };
+    fill(l.ring1, 0);
+    fill(l.ring2, 2);
+}
+
+void Multigrid::cycle(int level, float* x, const float* rhs, const MultigridSettings& settings) {
+    if (level == (int)levels_.size()) {
+        solveCoarsest(level, x, rhs);
+        return;
+    }
+
+    int n;
+    float* r;
+    if (level == 0) {
+        n = n_;
+        r = r0_.data();
+        smooth(n, x, rhs, settings.preSmooth, solids_);
+        residual(n, x, rhs, r, solids_);
+    } else {
+        const Level& fine = levels_[level - 1];
+        n = fine.n;
+        r = levels_[level - 1].r.data();
+        smooth_coarse(fine, x, rhs, settings.preSmooth);
+        residual_coarse(fine, x, rhs, r);
+    }
+
+    Level& coarse = levels_[level];
+    restrict_residual(n, coarse.n, r, coarse.rhs.data());
+    if (level + 1 == (int)levels_.size()) {
+        // Pure Neumann problem: make the coarsest right-hand side compatible
+        // by removing its total in proportion to cell area.
+        // Solid cells are outside the domain.
+        Grid<0> IX{coarse.n};
+        double sum = 0.0, area = 0.0;
+        for (int j = 1; j <= coarse.n; j++) {
+            for (int i = 1; i <= coarse.n; i++) {
+                if (!coarse_solid(coarse, i, j)) {
+                    sum += coarse.rhs[IX(i,j)];
+                    area += double(coarse.w[i]) * coarse.w[j];
+                }
+            }
+        }
+        float density = area > 0 ? float(sum / area) : 0.0f;
+        for (int j = 1; j <= coarse.n; j++) {
+            for (int i = 1; i <= coarse.n; i++) {
+                if (!coarse_solid(coarse, i, j)) {
+                    coarse.rhs[IX(i,j)] -= density * coarse.w[i] * coarse.w[j];
+                }
+            }
+        }
+    }
+    std::fill(coarse.x.begin(), coarse.x.end(), 0.0f);
+    int gamma = settings.cycle == CycleType::W ? 2 : 1;
+    for (int g = 0; g < gamma; g++) {
+        cycle(level + 1, coarse.x.data(), coarse.rhs.data(), settings);
+    }
+    if (solids_) {
+        fillSolids(coarse);
+    }
+
+    if (level == 0) {
+        prolong_add(n, coarse, coarse.x.data(), x, [&](int i, int j) {
+            return solids_ && solids_->solid(i, j);
+        });
+        if (solids_) {
+            solids_->apply(0, x);
+        }
+        set_bnd(n, 0, x);
+        smooth(n, x, rhs, settings.postSmooth, solids_);
+    } else {
+        const Level& fine = levels_[level - 1];
+        prolong_add(n, coarse, coarse.x.data(), x, [&](int i, int j) {
+            return coarse_solid(fine, i, j);
+        });
+        smooth_coarse(levels_[level - 1], x, rhs, settings.postSmooth);
+    }
+}
+
+void Multigrid::solveCoarsest(int level, float* x, const float* rhs) {
+    if (level == 0) {
+        residual(n_, x, rhs, r0_.data(), solids_);
+        const float target = rms(n_, r0_.data()) * kCoarseReduction;
+        for (int sweeps = 0; sweeps < kCoarseMaxSweeps; sweeps += 4) {
+            smooth(n_, x, rhs, 4, solids_);
+            residual(n_, x, rhs, r0_.data(), solids_);
+            if (rms(n_, r0_.data()) <= target) {
+                break;
+            }
+        }
+        return;
+    }
+    Level& l = levels_[level - 1];
+    residual_coarse(l, x, rhs, l.r.data());
+    const float target = rms(l.n, l.r.data()) * kCoarseReduction;
+    for (int sweeps = 0; sweeps < kCoarseMaxSweeps; sweeps += 4) {
+        smooth_coarse(l, x, rhs, 4);
+        residual_coarse(l, x, rhs, l.r.data());
+        if (rms(l.n, l.r.data()) <= target) {
+            break;
+        }
+    }
+}
+
+float pressure_residual(int N, const float* p, const float* div) {
+    Grid<0> IX{N};
+    double sum = 0.0;
+    for (int j = 1; j <= N; j++) {
+        for (int i = 1; i <= N; i++) {
+            float r = div[IX(i,j)] - (4 * p[IX(i,j)] - p[IX(i-1,j)] - p[IX(i+1,j)] -
+                                      p[IX(i,j-1)] - p[IX(i,j+1)]);
+            sum += double(r) * r;
+        }
+    }
+    return float(std::sqrt(sum / (double(N) * N)));
+}
@@ -0,0 +1,66 @@
+#ifndef MULTIGRID_HPP
+#define MULTIGRID_HPP
+#include <cstdint>
+#include <vector>
+#include "obstacles.hpp"
+
+enum class CycleType { V, W };
+
+struct MultigridSettings {
+    CycleType cycle = CycleType::V;
+    int cycles = 2;
+    int preSmooth = 2;
+    int postSmooth = 2;
+};
+
+// Geometric multigrid for the pressure equation solved by project():
+//   4 p(i,j) - p(i-1,j) - p(i+1,j) - p(i,j-1) - p(i,j+1) = div(i,j)
+// on a cell-centered grid with the set_bnd(0, ...) ghost-cell convention.
+// Levels halve the grid down to N <= 4; odd sizes round up, leaving a
+// narrower last row and column, so coarse levels are finite-volume grids
+// over their actual cell widths. Red-black Gauss-Seidel smooths each level
+// and the coarsest is relaxed until its residual has dropped 10^4-fold.
+class Multigrid {
+public:
+    explicit Multigrid(int n);
+
+    int levels() const { return (int)levels_.size() + 1; }
+    // Solid cells, when given, are skipped by the smoother on every level
+    // and their boundary is applied on the finest level after every half
+    // sweep. Coarse levels get the mask restricted to them (a coarse cell is
+    // solid when all the cells it covers are) and no flux crosses a
+    // fluid-solid face there.
+    void solve(float* p, const float* div, const MultigridSettings& settings,
+               const ObstacleMap* solids = nullptr);
+
+private:
+    struct Level {
+        int n;
+        std::vector<float> x, rhs, r;
+        std::vector<float> w;   // cell widths in fine cells, [1..n]
+        std::vector<float> a;   // 1 / center distance across face i|i+1, 0 at walls
+        std::vector<int> lo;    // finer cell i interpolates from lo[i], lo[i]+1
+        std::vector<float> t;   // with weight t[i] on lo[i]+1
+        // With solids: 0 fluid, 1 solid, 2 solid next to fluid; empty
+        // without. ring1 and ring2 list the solid cells next to fluid and
+        // next to those.
+        std::vector<uint8_t> solid;
+        std::vector<int> ring1, ring2;
+    };
+
+    void cycle(int level, float* x, const float* rhs, const MultigridSettings& settings);
+    void solveCoarsest(int level, float* x, const float* rhs);
+    void restrictSolids();
+    void fillSolids(Level& l) const;
+
+    int n_;
+    std::vector<float> r0_;
+    std::vector<Level> levels_;  // coarse levels, levels_[0] is (N+1)/2
+    const ObstacleMap* solids_ = nullptr;   // during solve()
+    uint64_t maskVersion_ = 0;   // solids_->version() the levels' masks are for
+};
+
+// RMS of div - A p over interior cells.
+float pressure_residual(int n, const float* p, const float* div);
+
+#endif
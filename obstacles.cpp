@@ -0,0 +1,184 @@
+#include "obstacles.hpp"
+#include "profiler.hpp"
+#include "utils.hpp"
+#include <algorithm>
+#include <cmath>
+
+ObstacleMap::ObstacleMap(int n)
+    : n_(n), words_((n + 2 + 63) / 64),
+      static_((size_t)(n + 2) * words_, 0), mask_((size_t)(n + 2) * words_, 0) {
+    // Boundary stencils: the mean of the fluid neighbors, with the velocity
+    // component normal to the face reflected about the wall velocity.
+    for (int b = 0; b < 3; b++) {
+        for (int code = 0; code < 16; code++) {
+            float* w = weights_[b][code];
+            std::fill(w, w + 5, 0.0f);
+            int count = 0;
+            for (int d = 0; d < 4; d++) {
+                count += (code >> d) & 1;
+            }
+            if (count == 0) {
+                continue;
+            }
+            for (int d = 0; d < 4; d++) {
+                if (!((code >> d) & 1)) {
+                    continue;
+                }
+                bool normal = (b == 1 && d < 2) || (b == 2 && d >= 2);
+                w[d] = (normal ? -1.0f : 1.0f) / count;
+                w[4] += normal ? 2.0f / count : 0.0f;
+            }
+        }
+    }
+}
+
+void ObstacleMap::setSolid(int i, int j, bool solid) {
+    if (i < 1 || i > n_ || j < 1 || j > n_) {
+        return;
+    }
+    uint64_t& word = static_[j * words_ + (i >> 6)];
+    const uint64_t bit = uint64_t(1) << (i & 63);
+    word = solid ? word | bit : word & ~bit;
+    dirty_ = true;
+}
+
+void ObstacleMap::addDisk(float x, float y, float radius) {
+    int minI = std::max(1, (int)std::ceil(x - radius));
+    int maxI = std::min(n_, (int)std::floor(x + radius));
+    int minJ = std::max(1, (int)std::ceil(y - radius));
+    int maxJ = std::min(n_, (int)std::floor(y + radius));
+    for (int j = minJ; j <= maxJ; j++) {
+        for (int i = minI; i <= maxI; i++) {
+            float dx = i - x;
+            float dy = j - y;
+            if (dx * dx + dy * dy <= radius * radius) {
+                setSolid(i, j, true);
+            }
+        }
+    }
+}
+
+void ObstacleMap::clear() {
+    std::fill(static_.begin(), static_.end(), 0);
+    moving.clear();
+    dirty_ = true;
+}
+
+void ObstacleMap::footprint(const MovingObstacle& m, std::vector<int>& out) const {
+    int minJ = std::max(1, (int)std::ceil(m.y - m.radius));
+    int maxJ = std::min(n_, (int)std::floor(m.y + m.radius));
+    out.clear();
+    out.push_back(minJ);
+    for (int j = minJ; j <= maxJ; j++) {
+        float dy = j - m.y;
+        float h = std::sqrt(std::max(0.0f, m.radius * m.radius - dy * dy));
+        out.push_back(std::max(1, (int)std::ceil(m.x - h)));
+        out.push_back(std::min(n_, (int)std::floor(m.x + h)));
+    }
+}
+
+bool ObstacleMap::update(float dt) {
+    if (footprints_.size() != moving.size()) {
+        footprints_.resize(moving.size());
+        dirty_ = true;
+    }
+    for (size_t k = 0; k < moving.size(); k++) {
+        MovingObstacle& m = moving[k];
+        m.x += m.du * dt * n_;
+        m.y += m.dv * dt * n_;
+        footprint(m, scratch_);
+        if (scratch_ != footprints_[k]) {
+            footprints_[k].swap(scratch_);
+            dirty_ = true;
+        }
+    }
+    if (dirty_) {
+        rebuild();
+        dirty_ = false;
+        return true;
+    }
+    // Same cells; only the wall velocities may have changed.
+    if (!moving.empty()) {
+        for (SolidCell& c : boundary_) {
+            if (c.owner >= 0) {
+                c.wall[1] = moving[c.owner].du;
+                c.wall[2] = moving[c.owner].dv;
+            }
+        }
+    }
+    return false;
+}
+
+void ObstacleMap::rebuild() {
+    ProfileScope scope("obstacle_rebuild");
+    version_++;
+    mask_ = static_;
+    for (const std::vector<int>& f : footprints_) {
+        for (size_t r = 0; 2 * r + 2 < f.size(); r++) {
+            const int j = f[0] + (int)r;
+            for (int i = f[2 * r + 1]; i <= f[2 * r + 2]; i++) {
+                mask_[j * words_ + (i >> 6)] |= uint64_t(1) << (i & 63);
+            }
+        }
+    }
+    // The last moving obstacle covering (i,j), -1 if none does.
+    auto owner = [&](int i, int j) {
+        for (int k = (int)footprints_.size() - 1; k >= 0; k--) {
+            const std::vector<int>& f = footprints_[k];
+            const int r = j - f[0];
+            if (r >= 0 && 2 * r + 2 < (int)f.size() && i >= f[2 * r + 1] && i <= f[2 * r + 2]) {
+                return k;
+            }
+        }
+        return -1;
+    };
+
+    // Neighbor tests a word of cells at a time: bit i of left is set when
+    // (i-1,j) is fluid, and so on. Ghost cells count as solid.
+    std::vector<uint64_t> inside(words_, 0);
+    for (int i = 1; i <= n_; i++) {
+        inside[i >> 6] |= uint64_t(1) << (i & 63);
+    }
+    auto fluid = [&](int j, int w) -> uint64_t {
+        if (j < 1 || j > n_ || w < 0 || w >= words_) {
+            return 0;
+        }
+        return ~mask_[j * words_ + w] & inside[w];
+    };
+    boundary_.clear();
+    interior_.clear();
+    for (int j = 1; j <= n_; j++) {
+        for (int w = 0; w < words_; w++) {
+            const uint64_t solid = mask_[j * words_ + w];
+            if (!solid) {
+                continue;
+            }
+            const uint64_t left = (fluid(j, w) << 1) | (fluid(j, w - 1) >> 63);
+            const uint64_t right = (fluid(j, w) >> 1) | (fluid(j, w + 1) << 63);
+            const uint64_t down = fluid(j - 1, w);
+            const uint64_t up = fluid(j + 1, w);
+            const uint64_t any = left | right | down | up;
+            for (uint64_t bits = solid; bits; bits &= bits - 1) {
+                const int bit = __builtin_ctzll(bits);
+                const int i = w * 64 + bit;
+                SolidCell c;
+                c.cell = i + (n_ + 2) * j;
+                c.code = (int)(((left >> bit) & 1) | ((right >> bit) & 1) << 1 |
+                               ((down >> bit) & 1) << 2 | ((up >> bit) & 1) << 3);
+                c.owner = owner(i, j);
+                c.wall[0] = 0.0f;
+                c.wall[1] = c.owner >= 0 ? moving[c.owner].du : 0.0f;
+                c.wall[2] = c.owner >= 0 ? moving[c.owner].dv : 0.0f;
+                ((any >> bit) & 1 ? boundary_ : interior_).push_back(c);
+            }
+        }
+    }
+}
+
+void ObstacleMap::apply(int b, float* x) const {
+    apply(b, FloatRows{x, n_ + 2});
+}
+
+void ObstacleMap::fillInterior(int b, float* x) const {
+    fillInterior(b, FloatRows{x, n_ + 2});
+}
@@ -0,0 +1,131 @@
+#ifndef OBSTACLES_HPP
+#define OBSTACLES_HPP
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+// A solid disk in grid coordinates (interior is 1..N, as for Splat) that
+// moves with velocity (du, dv) in the solver's units and drags the fluid at
+// its surface along.
+struct MovingObstacle {
+    float x, y;
+    float radius;
+    float du = 0.0f, dv = 0.0f;
+};
+
+// A solid cell, IX(i,j). code has bit 0..3 set for a fluid neighbor at
+// (i-1,j), (i+1,j), (i,j-1), (i,j+1); wall is {0, du, dv} of the obstacle
+// it belongs to, indexed by the set_bnd field type.
+struct SolidCell {
+    int cell;
+    int code;
+    int owner;      // index into ObstacleMap::moving, -1 for static cells
+    float wall[3];
+};
+
+// Solid cells inside an N x N grid: a static mask plus moving disks. The
+// combined mask is kept as bits, cell (i,j) at bit i % 64 of word
+// j * wordsPerRow() + i / 64, ghost cells included and always clear.
+//
+// update() rebuilds two compacted lists when the mask changes: boundary
+// cells (solid, with a fluid 4-neighbor) and the solid cells behind them,
+// both in increasing cell order.
+// apply() then walks only the boundary list, so its cost follows the
+// obstacle perimeter; each cell's neighbor code picks its stencil weights
+// from a table, without branching per cell. Cells behind the boundary are
+// set once per rebuild by fillInterior(); sweeps may leave them with any
+// value, since nothing but boundary cells reads them.
+class ObstacleMap {
+public:
+    explicit ObstacleMap(int n);
+
+    int n() const { return n_; }
+    // True when the last update() found no solid cell.
+    bool empty() const { return boundary_.empty(); }
+    bool solid(int i, int j) const {
+        return (mask_[j * words_ + (i >> 6)] >> (i & 63)) & 1;
+    }
+    int wordsPerRow() const { return words_; }
+    const uint64_t* mask() const { return mask_.data(); }
+    // Calls f(first, last, solid) for each run of cells [first, last] in row
+    // j between lo and hi that are all solid or all fluid, left to right.
+    // Runs are found a mask word at a time.
+    template <class F>
+    void forEachRun(int j, int lo, int hi, F&& f) const {
+        const uint64_t* line = &mask_[j * words_];
+        for (int k = lo; k <= hi;) {
+            const bool s = (line[k >> 6] >> (k & 63)) & 1;
+            const uint64_t flip = s ? ~uint64_t(0) : 0;
+            int w = (k + 1) >> 6;
+            uint64_t bits = (line[w] ^ flip) & (~uint64_t(0) << ((k + 1) & 63));
+            while (!bits && ++w < words_) {
+                bits = line[w] ^ flip;
+            }
+            const int next = bits ? std::min(hi + 1, w * 64 + __builtin_ctzll(bits)) : hi + 1;
+            f(k, next - 1, s);
+            k = next;
+        }
+    }
+    const std::vector<SolidCell>& boundary() const { return boundary_; }
+    const std::vector<SolidCell>& interior() const { return interior_; }
+    // Bumped by every rebuild.
+    uint64_t version() const { return version_; }
+
+    // Static cells, in effect from the next update(). Ghost cells are
+    // ignored.
+    void setSolid(int i, int j, bool solid);
+    void addDisk(float x, float y, float radius);
+    // Drops the static cells and the moving obstacles.
+    void clear();
+
+    // Advanced by update(); edit freely between steps.
+    std::vector<MovingObstacle> moving;
+
+    // Moves the moving obstacles by dt and rebuilds the lists if any cell
+    // changed. Returns true after a rebuild.
+    bool update(float dt);
+    // Sets every boundary cell from its fluid neighbors, for field type b as
+    // in set_bnd: scalars take the mean, the normal velocity component is
+    // reflected about the wall's and the tangential one is copied. Rows is
+    // FloatRows or PackedRows; see utils.hpp.
+    template <class Rows>
+    void apply(int b, Rows x) const {
+        const int s = n_ + 2;
+        const float(*weights)[5] = weights_[b];
+        for (const SolidCell& c : boundary_) {
+            const float* w = weights[c.code];
+            const int k = c.cell;
+            x.set(k, w[0] * x[k - 1] + w[1] * x[k + 1] + w[2] * x[k - s] + w[3] * x[k + s] +
+                     w[4] * c.wall[b]);
+        }
+    }
+    void apply(int b, float* x) const;
+    // Sets the cells behind the boundary: 0 for b = 0, otherwise the wall
+    // velocity component.
+    template <class Rows>
+    void fillInterior(int b, Rows x) const {
+        for (const SolidCell& c : interior_) {
+            x.set(c.cell, c.wall[b]);
+        }
+    }
+    void fillInterior(int b, float* x) const;
+    // The stencil apply() uses for a boundary cell: left, right, down, up
+    // and wall weights.
+    const float* weights(int b, int code) const { return weights_[b][code]; }
+
+private:
+    // Cells a moving disk covers: its first row, then [first, last] per row.
+    void footprint(const MovingObstacle& m, std::vector<int>& out) const;
+    void rebuild();
+
+    int n_, words_;
+    std::vector<uint64_t> static_, mask_;
+    std::vector<std::vector<int>> footprints_;
+    std::vector<int> scratch_;
+    bool dirty_ = true;
+    uint64_t version_ = 0;
+    std::vector<SolidCell> boundary_, interior_;
+    float weights_[3][16][5];  // per b and code: left, right, down, up, wall
+};
+
+#endif
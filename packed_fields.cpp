@@ -0,0 +1,213 @@
+#include "packed_fields.hpp"
+#include <algorithm>
+#include <cstring>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define FLUID_X86 1
+#endif
+
+namespace {
+
+inline float bits_to_float(uint32_t x) {
+    float f;
+    std::memcpy(&f, &x, sizeof f);
+    return f;
+}
+
+inline uint32_t float_to_bits(float f) {
+    uint32_t x;
+    std::memcpy(&x, &f, sizeof x);
+    return x;
+}
+
+float half_to_float(uint16_t h) {
+    uint32_t sign = uint32_t(h & 0x8000) << 16;
+    uint32_t exp = (h >> 10) & 0x1F;
+    uint32_t mant = h & 0x3FF;
+    if (exp == 0) {
+        float f = mant * (1.0f / 16777216.0f);   // subnormal: mant * 2^-24
+        return bits_to_float(float_to_bits(f) | sign);
+    }
+    if (exp == 31) {
+        return bits_to_float(sign | 0x7F800000 | (mant << 13) | (mant ? 0x400000 : 0));
+    }
+    return bits_to_float(sign | ((exp + 112) << 23) | (mant << 13));
+}
+
+void widen_f16_scalar(const uint16_t* src, float* dst, int count) {
+    const float* table = half_table();
+    for (int i = 0; i < count; i++) {
+        dst[i] = table[src[i]];
+    }
+}
+
+void narrow_f16_scalar(const float* src, uint16_t* dst, int count) {
+    for (int i = 0; i < count; i++) {
+        dst[i] = float_to_half(src[i]);
+    }
+}
+
+inline void widen_bf16_scalar(const uint16_t* src, float* dst, int count) {
+    for (int i = 0; i < count; i++) {
+        dst[i] = bf16_to_float(src[i]);
+    }
+}
+
+inline void narrow_bf16_scalar(const float* src, uint16_t* dst, int count) {
+    for (int i = 0; i < count; i++) {
+        dst[i] = float_to_bf16(src[i]);
+    }
+}
+
+#ifdef FLUID_X86
+
+// Every AVX2 CPU also has F16C.
+__attribute__((target("avx2,f16c")))
+void widen_f16_avx2(const uint16_t* src, float* dst, int count) {
+    int i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m128i h = _mm_loadu_si128((const __m128i*)(src + i));
+        _mm256_storeu_ps(dst + i, _mm256_cvtph_ps(h));
+    }
+    widen_f16_scalar(src + i, dst + i, count - i);
+}
+
+__attribute__((target("avx2,f16c")))
+void narrow_f16_avx2(const float* src, uint16_t* dst, int count) {
+    int i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m128i h = _mm256_cvtps_ph(_mm256_loadu_ps(src + i), _MM_FROUND_TO_NEAREST_INT);
+        _mm_storeu_si128((__m128i*)(dst + i), h);
+    }
+    narrow_f16_scalar(src + i, dst + i, count - i);
+}
+
+__attribute__((target("avx512f")))
+void widen_f16_avx512(const uint16_t* src, float* dst, int count) {
+    int i = 0;
+    for (; i + 16 <= count; i += 16) {
+        __m256i h = _mm256_loadu_si256((const __m256i*)(src + i));
+        _mm512_storeu_ps(dst + i, _mm512_cvtph_ps(h));
+    }
+    widen_f16_scalar(src + i, dst + i, count - i);
+}
+
+__attribute__((target("avx512f")))
+void narrow_f16_avx512(const float* src, uint16_t* dst, int count) {
+    int i = 0;
+    for (; i + 16 <= count; i += 16) {
+        __m256i h = _mm512_cvtps_ph(_mm512_loadu_ps(src + i), _MM_FROUND_TO_NEAREST_INT);
+        _mm256_storeu_si256((__m256i*)(dst + i), h);
+    }
+    narrow_f16_scalar(src + i, dst + i, count - i);
+}
+
+// The bf16 loops are plain integer work; these just let them vectorize.
+// The AVX512 level only guarantees AVX-512F, so no wider target is enabled.
+__attribute__((target("avx2")))
+void widen_bf16_avx2(const uint16_t* src, float* dst, int count) {
+    widen_bf16_scalar(src, dst, count);
+}
+
+__attribute__((target("avx2")))
+void narrow_bf16_avx2(const float* src, uint16_t* dst, int count) {
+    narrow_bf16_scalar(src, dst, count);
+}
+
+__attribute__((target("avx512f")))
+void widen_bf16_avx512(const uint16_t* src, float* dst, int count) {
+    widen_bf16_scalar(src, dst, count);
+}
+
+__attribute__((target("avx512f")))
+void narrow_bf16_avx512(const float* src, uint16_t* dst, int count) {
+    narrow_bf16_scalar(src, dst, count);
+}
+
+#endif
+
+} // namespace
+
+// Matches vcvtps2ph with round to nearest even.
+uint16_t float_to_half(float f) {
+    uint32_t x = float_to_bits(f);
+    uint16_t sign = (x >> 16) & 0x8000;
+    uint32_t a = x & 0x7FFFFFFF;
+    if (a >= 0x7F800000) {
+        return sign | 0x7C00 | (a > 0x7F800000 ? 0x200 | ((a >> 13) & 0x3FF) : 0);
+    }
+    if (a >= 0x477FF000) {
+        return sign | 0x7C00;   // 65520 and up round to infinity
+    }
+    if (a < 0x38800000) {
+        uint32_t e = a >> 23;
+        if (e < 102) {
+            return sign;
+        }
+        uint32_t m = (a & 0x7FFFFF) | 0x800000;
+        uint32_t shift = 126 - e;
+        uint32_t h = m >> shift;
+        uint32_t rem = m & ((1u << shift) - 1);
+        uint32_t halfway = 1u << (shift - 1);
+        if (rem > halfway || (rem == halfway && (h & 1))) {
+            h++;
+        }
+        return sign | h;
+    }
+    uint32_t h = (a - 0x38000000) >> 13;
+    uint32_t rem = a & 0x1FFF;
+    if (rem > 0x1000 || (rem == 0x1000 && (h & 1))) {
+        h++;
+    }
+    return sign | h;
+}
+
+const float* half_table() {
+    static const std::vector<float> table = [] {
+        std::vector<float> t(65536);
+        for (uint32_t h = 0; h < 65536; h++) {
+            t[h] = half_to_float((uint16_t)h);
+        }
+        return t;
+    }();
+    return table.data();
+}
+
+const char* storage_name(FieldStorage storage) {
+    switch (storage) {
+    case FieldStorage::Float32: return "fp32";
+    case FieldStorage::Float16: return "fp16";
+    case FieldStorage::BFloat16: return "bf16";
+    }
+    return "?";
+}
+
+WidenRow widen_row(FieldStorage storage, SimdLevel level) {
+    bool half = storage == FieldStorage::Float16;
+    switch (resolve_simd(level)) {
+#ifdef FLUID_X86
+    case SimdLevel::AVX512:
+        return half ? widen_f16_avx512 : widen_bf16_avx512;
+    case SimdLevel::AVX2:
+        return half ? widen_f16_avx2 : widen_bf16_avx2;
+#endif
+    default:
+        return half ? widen_f16_scalar : widen_bf16_scalar;
+    }
+}
+
+NarrowRow narrow_row(FieldStorage storage, SimdLevel level) {
+    bool half = storage == FieldStorage::Float16;
+    switch (resolve_simd(level)) {
+#ifdef FLUID_X86
+    case SimdLevel::AVX512:
+        return half ? narrow_f16_avx512 : narrow_bf16_avx512;
+    case SimdLevel::AVX2:
+        return half ? narrow_f16_avx2 : narrow_bf16_avx2;
+#endif
+    default:
+        return half ? narrow_f16_scalar : narrow_bf16_scalar;
+    }
+}
@@ -0,0 +1,107 @@
+#ifndef PACKED_FIELDS_HPP
+#define PACKED_FIELDS_HPP
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include "advect.hpp"
+
+// Element type of the solver fields. The 16-bit formats only change
+// storage; every kernel widens rows to fp32, computes, and narrows back.
+enum class FieldStorage { Float32, Float16, BFloat16 };
+
+const char* storage_name(FieldStorage storage);
+
+// Row conversions, round to nearest even. Float16 uses F16C at the AVX2
+// level and AVX-512F at the AVX512 level; BFloat16 is integer bit work.
+typedef void (*WidenRow)(const uint16_t* src, float* dst, int count);
+typedef void (*NarrowRow)(const float* src, uint16_t* dst, int count);
+WidenRow widen_row(FieldStorage storage, SimdLevel level);
+NarrowRow narrow_row(FieldStorage storage, SimdLevel level);
+
+// Single values. half_table() maps every fp16 bit pattern to its value;
+// float_to_half() rounds as vcvtps2ph does.
+const float* half_table();
+uint16_t float_to_half(float f);
+
+inline float bf16_to_float(uint16_t h) {
+    uint32_t x = uint32_t(h) << 16;
+    float f;
+    std::memcpy(&f, &x, sizeof f);
+    return f;
+}
+
+inline uint16_t float_to_bf16(float f) {
+    uint32_t x;
+    std::memcpy(&x, &f, sizeof x);
+    uint32_t rounded = (x + 0x7FFF + ((x >> 16) & 1)) >> 16;
+    bool nan = (x & 0x7FFFFFFF) > 0x7F800000;
+    return nan ? uint16_t((x >> 16) | 0x40) : uint16_t(rounded);
+}
+
+// FloatRows (utils.hpp) over a 16-bit field: rows are widened into the
+// caller's line buffers and narrowed back by store().
+struct PackedRows {
+    uint16_t* data;
+    int stride;
+    const float* table;   // half_table() for Float16, null for BFloat16
+    WidenRow widen;
+    NarrowRow narrow;
+
+    PackedRows(uint16_t* data, int stride, FieldStorage storage, SimdLevel simd)
+        : data(data), stride(stride),
+          table(storage == FieldStorage::Float16 ? half_table() : nullptr),
+          widen(widen_row(storage, simd)), narrow(narrow_row(storage, simd)) {}
+
+    float operator[](int k) const { return table ? table[data[k]] : bf16_to_float(data[k]); }
+    void set(int k, float f) const { data[k] = table ? float_to_half(f) : float_to_bf16(f); }
+    // Negating a 16-bit float only flips its sign bit.
+    void mirror(int to, int from, bool negate) const {
+        data[to] = negate ? data[from] ^ 0x8000 : data[from];
+    }
+    const float* row(int j, float* line) const {
+        widen(data + j * stride, line, stride);
+        return line;
+    }
+    const float* row(int j, float* line, int lo, int hi) const {
+        widen(data + j * stride + lo, line + lo, hi - lo + 1);
+        return line;
+    }
+    const float* alternate(int j, float* line, int first, int last) const {
+        for (int i = first; i <= last; i += 2) {
+            line[i] = (*this)[j * stride + i];
+        }
+        return line;
+    }
+    float* edit(int j, float* line) const {
+        widen(data + j * stride, line, stride);
+        return line;
+    }
+    float* edit(int j, float* line, int lo, int hi) const {
+        widen(data + j * stride + lo, line + lo, hi - lo + 1);
+        return line;
+    }
+    float* out(int, float* line) const { return line; }
+    void store(int j, const float* row, int lo, int hi) const {
+        narrow(row + lo, data + j * stride + lo, hi - lo + 1);
+    }
+    // Narrows a chunk at a time, then keeps every other cell.
+    void storeAlternate(int j, const float* row, int first, int last) const {
+        uint16_t chunk[64];
+        for (int i = first; i <= last; i += 64) {
+            const int count = std::min(64, last - i + 1);
+            narrow(row + i, chunk, count);
+            for (int k = 0; k < count; k += 2) {
+                data[j * stride + i + k] = chunk[k];
+            }
+        }
+    }
+    void read(int j, int lo, int hi, float* dst) const {
+        widen(data + j * stride + lo, dst, hi - lo + 1);
+    }
+    void write(int j, int lo, int hi, const float* src) const {
+        narrow(src, data + j * stride + lo, hi - lo + 1);
+    }
+    void clear(int first, int last) const { std::fill(data + first, data + last + 1, 0); }
+};
+
+#endif
@@ -0,0 +1,204 @@
+#include "profiler.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <map>
+#include <memory>
+#include <mutex>
+
+std::atomic<bool> g_profilerEnabled{false};
+
+namespace {
+
+struct Slot {
+    const char* name;
+    uint64_t start, end;
+};
+
+// Single writer (the owning thread), any number of readers. head counts
+// events ever written; slot h & mask is being overwritten while head == h.
+struct Ring {
+    int index = 0;
+    std::string name;
+    std::atomic<uint64_t> head{0};
+    std::atomic<uint64_t> floor{0};   // events below this were cleared
+    std::vector<Slot> slots = std::vector<Slot>(kProfileRing);
+};
+
+std::mutex ringsMutex;
+// Rings outlive their threads so a trace still covers finished workers.
+std::vector<std::unique_ptr<Ring>> rings;
+thread_local Ring* threadRing = nullptr;
+thread_local const char* threadName = nullptr;
+
+Ring& ring() {
+    if (!threadRing) {
+        std::lock_guard<std::mutex> lock(ringsMutex);
+        rings.push_back(std::unique_ptr<Ring>(new Ring));
+        threadRing = rings.back().get();
+        threadRing->index = (int)rings.size() - 1;
+        if (threadName) {
+            threadRing->name = threadName;
+        }
+    }
+    return *threadRing;
+}
+
+double percentile(const std::vector<double>& sorted, double q) {
+    size_t k = (size_t)(q * (sorted.size() - 1) + 0.5);
+    return sorted[std::min(k, sorted.size() - 1)];
+}
+
+std::string thread_label(int index) {
+    std::lock_guard<std::mutex> lock(ringsMutex);
+    const std::string& name = rings[index]->name;
+    return name.empty() ? "thread " + std::to_string(index) : name;
+}
+
+} // namespace
+
+void profiler_enable(bool on) {
+    g_profilerEnabled.store(on, std::memory_order_relaxed);
+}
+
+uint64_t profile_now() {
+    return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void profile_record(const char* name, uint64_t start, uint64_t end) {
+    Ring& r = ring();
+    uint64_t h = r.head.load(std::memory_order_relaxed);
+    r.slots[h & (kProfileRing - 1)] = Slot{name, start, end};
+    r.head.store(h + 1, std::memory_order_release);
+}
+
+void profile_thread_name(const char* name) {
+    threadName = name;
+    if (threadRing) {
+        std::lock_guard<std::mutex> lock(ringsMutex);
+        threadRing->name = name;
+    }
+}
+
+std::vector<ProfileEvent> profile_snapshot() {
+    std::vector<Ring*> all;
+    {
+        std::lock_guard<std::mutex> lock(ringsMutex);
+        for (auto& r : rings) {
+            all.push_back(r.get());
+        }
+    }
+    std::vector<ProfileEvent> events;
+    std::vector<Slot> copy;
+    for (Ring* r : all) {
+        uint64_t head = r->head.load(std::memory_order_acquire);
+        uint64_t first = std::max(r->floor.load(std::memory_order_relaxed),
+                                  head > kProfileRing ? head - kProfileRing : 0);
+        copy.clear();
+        for (uint64_t k = first; k < head; k++) {
+            copy.push_back(r->slots[k & (kProfileRing - 1)]);
+        }
+        // Anything the writer reached while we copied may be torn.
+        std::atomic_thread_fence(std::memory_order_acquire);
+        uint64_t after = r->head.load(std::memory_order_relaxed);
+        uint64_t valid = after >= kProfileRing ? after - kProfileRing + 1 : 0;
+        for (uint64_t k = std::max(first, valid); k < head; k++) {
+            const Slot& s = copy[k - first];
+            events.push_back(ProfileEvent{s.name, s.start, s.end, r->index});
+        }
+    }
+    return events;
+}
+
+void profile_clear() {
+    std::lock_guard<std::mutex> lock(ringsMutex);
+    for (auto& r : rings) {
+        r->floor.store(r->head.load(std::memory_order_acquire), std::memory_order_relaxed);
+    }
+}
+
+std::vector<StageSummary> profile_summary(double windowSeconds) {
+    std::vector<ProfileEvent> events = profile_snapshot();
+    uint64_t now = profile_now();
+    uint64_t window = (uint64_t)(windowSeconds * 1e9);
+    uint64_t since = now > window ? now - window : 0;
+
+    // Group by text: the same literal may have several addresses.
+    std::map<std::string, std::pair<const char*, std::vector<double>>> stages;
+    for (const ProfileEvent& e : events) {
+        if (e.end >= since) {
+            auto& stage = stages[e.name];
+            stage.first = e.name;
+            stage.second.push_back((e.end - e.start) * 1e-6);
+        }
+    }
+    std::vector<StageSummary> out;
+    for (auto& entry : stages) {
+        std::vector<double>& ms = entry.second.second;
+        std::sort(ms.begin(), ms.end());
+        StageSummary s;
+        s.name = entry.second.first;
+        s.count = ms.size();
+        s.totalMs = 0;
+        for (double t : ms) {
+            s.totalMs += t;
+        }
+        s.p50Ms = percentile(ms, 0.50);
+        s.p95Ms = percentile(ms, 0.95);
+        s.p99Ms = percentile(ms, 0.99);
+        s.maxMs = ms.back();
+        out.push_back(s);
+    }
+    std::sort(out.begin(), out.end(), [](const StageSummary& a, const StageSummary& b) {
+        return a.totalMs > b.totalMs;
+    });
+    return out;
+}
+
+bool write_profile_csv(const std::string& path) {
+    std::vector<ProfileEvent> events = profile_snapshot();
+    FILE* f = std::fopen(path.c_str(), "w");
+    if (!f) {
+        return false;
+    }
+    uint64_t origin = UINT64_MAX;
+    for (const ProfileEvent& e : events) {
+        origin = std::min(origin, e.start);
+    }
+    std::fprintf(f, "name,thread,start_us,duration_us\n");
+    for (const ProfileEvent& e : events) {
+        std::fprintf(f, "%s,%d,%.3f,%.3f\n", e.name, e.thread, (e.start - origin) * 1e-3,
+                     (e.end - e.start) * 1e-3);
+    }
+    return std::fclose(f) == 0;
+}
+
+bool write_chrome_trace(const std::string& path) {
+    std::vector<ProfileEvent> events = profile_snapshot();
+    FILE* f = std::fopen(path.c_str(), "w");
+    if (!f) {
+        return false;
+    }
+    uint64_t origin = UINT64_MAX;
+    int threads = 0;
+    for (const ProfileEvent& e : events) {
+        origin = std::min(origin, e.start);
+        threads = std::max(threads, e.thread + 1);
+    }
+    std::fprintf(f, "{\"traceEvents\":[");
+    const char* sep = "\n";
+    for (int t = 0; t < threads; t++) {
+        std::fprintf(f, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,"
+                        "\"args\":{\"name\":\"%s\"}}", sep, t, thread_label(t).c_str());
+        sep = ",\n";
+    }
+    for (const ProfileEvent& e : events) {
+        std::fprintf(f, "%s{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,"
+                        "\"ts\":%.3f,\"dur\":%.3f}", sep, e.name, e.thread,
+                     (e.start - origin) * 1e-3, (e.end - e.start) * 1e-3);
+        sep = ",\n";
+    }
+    std::fprintf(f, "\n],\"displayTimeUnit\":\"ms\"}\n");
+    return std::fclose(f) == 0;
+}
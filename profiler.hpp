@@ -0,0 +1,73 @@
+#ifndef PROFILER_HPP
+#define PROFILER_HPP
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Scoped stage timers, off until profiler_enable(true). A disabled scope
+// costs one relaxed load; an enabled one two clock reads and a store into
+// the calling thread's ring of the last kProfileRing events. Stage names
+// must be string literals (only the pointer is kept).
+const size_t kProfileRing = 1 << 16;
+
+struct ProfileEvent {
+    const char* name;
+    uint64_t start;   // ns on the steady clock
+    uint64_t end;
+    int thread;       // registration order of the recording thread
+};
+
+// Rolling percentiles of one stage over a window of recent events.
+struct StageSummary {
+    const char* name;
+    size_t count;
+    double totalMs;
+    double p50Ms, p95Ms, p99Ms, maxMs;
+};
+
+extern std::atomic<bool> g_profilerEnabled;
+
+inline bool profiler_enabled() {
+    return g_profilerEnabled.load(std::memory_order_relaxed);
+}
+void profiler_enable(bool on);
+uint64_t profile_now();
+void profile_record(const char* name, uint64_t start, uint64_t end);
+// Names the calling thread in exports; otherwise it is "thread <index>".
+// Cheap to call while disabled: the ring is only allocated on first record.
+void profile_thread_name(const char* name);
+
+// Events still held by the rings, oldest first within each thread. Safe to
+// call while other threads record; events overwritten mid-copy are dropped.
+std::vector<ProfileEvent> profile_snapshot();
+void profile_clear();
+// Per-stage percentiles over events that ended in the last windowSeconds,
+// sorted by total time.
+std::vector<StageSummary> profile_summary(double windowSeconds);
+
+// name,thread,start_us,duration_us per event.
+bool write_profile_csv(const std::string& path);
+// Complete ("X") events for chrome://tracing and Perfetto.
+bool write_chrome_trace(const std::string& path);
+
+class ProfileScope {
+public:
+    explicit ProfileScope(const char* name)
+        : name_(profiler_enabled() ? name : nullptr), start_(name_ ? profile_now() : 0) {}
+    ~ProfileScope() {
+        if (name_) {
+            profile_record(name_, start_, profile_now());
+        }
+    }
+
+    ProfileScope(const ProfileScope&) = delete;
+    ProfileScope& operator=(const ProfileScope&) = delete;
+
+private:
+    const char* name_;
+    uint64_t start_;
+};
+
+#endif
@@ -0,0 +1,339 @@
+#include "relax.hpp"
+#include "obstacles.hpp"
+#include "packed_fields.hpp"
+#include "thread_pool.hpp"
+#include "utils.hpp"
+#include <algorithm>
+#include <cmath>
+
+namespace {
+
+// Line buffers per pool worker.
+const int kLines = 5;
+
+// Sets the ghost cells of a local block that lie on a domain wall, for the
+// rows/columns [lo, hi] currently valid. Mirrors set_bnd without corners,
+// which the 5-point stencil never reads.
+struct LocalBlock {
+    int i0, j0, w;  // global index of local (0,0) and row width
+    float* data;
+    float& at(int i, int j) const { return data[(i - i0) + w * (j - j0)]; }
+};
+
+void local_walls(const LocalBlock& blk, int n, int b, int ilo, int ihi, int jlo, int jhi) {
+    if (ilo == 1) {
+        for (int j = jlo; j <= jhi; j++) blk.at(0, j) = b == 1 ? -blk.at(1, j) : blk.at(1, j);
+    }
+    if (ihi == n) {
+        for (int j = jlo; j <= jhi; j++) blk.at(n + 1, j) = b == 1 ? -blk.at(n, j) : blk.at(n, j);
+    }
+    if (jlo == 1) {
+        for (int i = ilo; i <= ihi; i++) blk.at(i, 0) = b == 2 ? -blk.at(i, 1) : blk.at(i, 1);
+    }
+    if (jhi == n) {
+        for (int i = ilo; i <= ihi; i++) blk.at(i, n + 1) = b == 2 ? -blk.at(i, n) : blk.at(i, n);
+    }
+}
+
+// ObstacleMap::apply() for the boundary cells of a local block that lie in
+// [ilo, ihi] x [jlo, jhi]. The list is in cell order, so the block's rows
+// are one contiguous stretch of it.
+void local_obstacles(const LocalBlock& blk, const ObstacleMap& solids, int n, int b,
+                     int ilo, int ihi, int jlo, int jhi) {
+    Grid<0> IX{n};
+    const std::vector<SolidCell>& cells = solids.boundary();
+    auto first = std::lower_bound(cells.begin(), cells.end(), IX(ilo,jlo),
+                                  [](const SolidCell& c, int cell) { return c.cell < cell; });
+    const int end = IX(ihi,jhi);
+    for (auto it = first; it != cells.end() && it->cell <= end; ++it) {
+        const int i = it->cell % IX.stride();
+        if (i < ilo || i > ihi) {
+            continue;
+        }
+        const float* w = solids.weights(b, it->code);
+        float* p = &blk.at(i, it->cell / IX.stride());
+        *p = w[0] * p[-1] + w[1] * p[1] + w[2] * p[-blk.w] + w[3] * p[blk.w] +
+             w[4] * it->wall[b];
+    }
+}
+
+// One row of a tiled Jacobi sweep with solids: fluid runs are relaxed and
+// solid ones copied through. Kept out of line, with everything passed by
+// value, so the plain row loop does not see these pointers escape.
+void relax_fluid_runs(const ObstacleMap& solids, int j, int lo, int hi, const float* row,
+                      int w, const float* rhs, float* dest, float ka, float kInvC) {
+    const float* up = row - w;
+    const float* down = row + w;
+    solids.forEachRun(j, lo, hi, [=](int first, int last, bool solid) {
+        if (solid) {
+            std::copy(row + first, row + last + 1, dest + first);
+            return;
+        }
+        for (int i = first; i <= last; i++) {
+            dest[i] = (rhs[i] + ka * (row[i-1] + row[i+1] + up[i] + down[i])) * kInvC;
+        }
+    });
+}
+
+// Side of one block buffer: a tile plus a halo of up to 2 * depth cells on
+// each side, the width solids need.
+int block_width(int n, int tile, int depth) {
+    return std::max(1, std::min(tile, n)) + 4 * std::max(1, depth);
+}
+
+} // namespace
+
+size_t relax_lines(int workers, int n) {
+    return (size_t)workers * kLines * (n + 2);
+}
+
+template <class Rows>
+void lin_solve_red_black(ThreadPool& pool, int n, int b, Rows x, Rows x0, float a, float c,
+                         int iters, float* lines, const ObstacleMap* solids) {
+    Grid<0> IX{n};
+    const int S = IX.stride();
+    const float invC = 1.0f / c;
+    const int parts = pool.size();
+    pool.run([&](int worker) {
+        const float ka = a;
+        const float kInvC = invC;
+        float* line = lines + (size_t)worker * kLines * S;
+        int first, last;
+        row_band(n, parts, worker, first, last);
+        for (int k = 0; k < iters; k++) {
+            for (int color = 0; color < 2; color++) {
+                for (int j = first; j <= last; j++) {
+                    // Cells i0, i0 + 2, ... of row j have this color. Of
+                    // rows outside the band only those columns are read,
+                    // the cells their owner leaves alone.
+                    const int i0 = 1 + ((j + color) & 1);
+                    const float* down = j > first ? x.row(j - 1, line)
+                                                  : x.alternate(j - 1, line, i0, n);
+                    float* row = x.edit(j, line + S);
+                    const float* up = j < last ? x.row(j + 1, line + 2 * S)
+                                               : x.alternate(j + 1, line + 2 * S, i0, n);
+                    const float* rhs = x0.row(j, line + 3 * S);
+                    // Cells of this color in [lo, hi].
+                    auto span = [&](int lo, int hi) {
+                        for (int i = lo + ((lo + 1 + j + color) & 1); i <= hi; i += 2) {
+                            row[i] = (rhs[i] + ka * (row[i-1] + row[i+1] +
+                                      down[i] + up[i])) * kInvC;
+                        }
+                    };
+                    if (!solids) {
+                        span(1, n);
+                    } else {
+                        solids->forEachRun(j, 1, n, [&](int lo, int hi, bool solid) {
+                            if (!solid) {
+                                span(lo, hi);
+                            }
+                        });
+                    }
+                    x.storeAlternate(j, row, i0, n);
+                }
+                pool.barrier();
+            }
+            if (worker == 0) {
+                if (solids) {
+                    solids->apply(b, x);
+                }
+                set_bnd(IX, b, x);
+            }
+            pool.barrier();
+        }
+    });
+}
+
+template <class Rows>
+void lin_solve_jacobi(ThreadPool& pool, int n, int b, Rows x, Rows x0, float a, float c,
+                      int iters, Rows scratch, float* lines, const ObstacleMap* solids) {
+    Grid<0> IX{n};
+    const int S = IX.stride();
+    const float invC = 1.0f / c;
+    const int parts = pool.size();
+    pool.run([&](int worker) {
+        int first, last;
+        row_band(n, parts, worker, first, last);
+        const float ka = a;
+        const float kInvC = invC;
+        float* line = lines + (size_t)worker * kLines * S;
+        Rows in = x;
+        Rows out = scratch;
+        for (int k = 0; k < iters; k++) {
+            for (int j = first; j <= last; j++) {
+                const float* down = in.row(j - 1, line);
+                const float* row = in.row(j, line + S);
+                const float* up = in.row(j + 1, line + 2 * S);
+                const float* rhs = x0.row(j, line + 3 * S);
+                float* dest = out.out(j, line + 4 * S);
+                // One row run: relaxed if fluid, carried over if solid.
+                auto span = [&](int lo, int hi, bool solid) {
+                    if (solid) {
+                        std::copy(row + lo, row + hi + 1, dest + lo);
+                        return;
+                    }
+                    for (int i = lo; i <= hi; i++) {
+                        dest[i] = (rhs[i] + ka * (row[i-1] + row[i+1] +
+                                   down[i] + up[i])) * kInvC;
+                    }
+                };
+                if (solids) {
+                    solids->forEachRun(j, 1, n, span);
+                } else {
+                    span(1, n, false);
+                }
+                out.store(j, dest, 1, n);
+            }
+            pool.barrier();
+            if (worker == 0) {
+                if (solids) {
+                    solids->apply(b, out);
+                }
+                set_bnd(IX, b, out);
+            }
+            pool.barrier();
+            std::swap(in, out);
+        }
+    });
+    if (iters % 2) {
+        std::copy(scratch.data, scratch.data + IX.size(), x.data);
+    }
+}
+
+size_t jacobi_tiled_scratch(int workers, int n, int tile, int depth) {
+    const size_t w = block_width(n, tile, depth);
+    return 2 * (size_t)workers * w * w;
+}
+
+template <class Rows>
+void lin_solve_jacobi_tiled(ThreadPool& pool, int n, int b, Rows x, Rows x0, float a, float c,
+                            int iters, int tile, int depth, Rows scratch, float* blocks,
+                            float* lines, const ObstacleMap* solids) {
+    Grid<0> IX{n};
+    const float invC = 1.0f / c;
+    const int blockFloats = block_width(n, tile, depth) * block_width(n, tile, depth);
+    tile = std::max(1, std::min(tile, n));
+    depth = std::max(1, depth);
+    const int tilesPerRow = (n + tile - 1) / tile;
+    const int tiles = tilesPerRow * tilesPerRow;
+    const int parts = pool.size();
+    // Cells each sweep invalidates at the block edge: the stencil reaches
+    // one, and a boundary cell one more.
+    const int shrink = solids ? 2 : 1;
+    Rows src = x;
+    Rows dst = scratch;
+
+    for (int done = 0; done < iters; done += depth) {
+        const int sweeps = std::min(depth, iters - done);
+        const int halo = shrink * sweeps;
+        pool.run([&](int worker) {
+            // Local copies so stores through the block pointers cannot alias them
+            const float ka = a;
+            const float kInvC = invC;
+            const int w = tile + 2 * halo;
+            float* bufA = blocks + 2 * worker * blockFloats;
+            float* bufB = bufA + blockFloats;
+            float* line = lines + (size_t)worker * kLines * IX.stride();
+            for (int t = worker; t < tiles; t += parts) {
+                const int tx0 = 1 + (t % tilesPerRow) * tile;
+                const int ty0 = 1 + (t / tilesPerRow) * tile;
+                const int tx1 = std::min(n, tx0 + tile - 1);
+                const int ty1 = std::min(n, ty0 + tile - 1);
+                const int ri0 = std::max(0, tx0 - halo);
+                const int rj0 = std::max(0, ty0 - halo);
+                const int ri1 = std::min(n + 1, tx1 + halo);
+                const int rj1 = std::min(n + 1, ty1 + halo);
+                LocalBlock in{ri0, rj0, w, bufA};
+                LocalBlock out{ri0, rj0, w, bufB};
+                for (int j = rj0; j <= rj1; j++) {
+                    src.read(j, ri0, ri1, &in.at(ri0, j));
+                }
+                for (int k = 1; k <= sweeps; k++) {
+                    // The valid region shrinks by `shrink` cells per sweep,
+                    // except on domain walls where the ghosts are recomputed.
+                    const int e = halo - shrink * k + shrink - 1;
+                    const int ilo = std::max(1, tx0 - e);
+                    const int jlo = std::max(1, ty0 - e);
+                    const int ihi = std::min(n, tx1 + e);
+                    const int jhi = std::min(n, ty1 + e);
+                    if (solids) {
+                        for (int j = jlo; j <= jhi; j++) {
+                            relax_fluid_runs(*solids, j, ilo, ihi, &in.at(0, j), w,
+                                             x0.row(j, line, ilo, ihi), &out.at(0, j), ka, kInvC);
+                        }
+                    } else {
+                        for (int j = jlo; j <= jhi; j++) {
+                            const float* row = &in.at(0, j);
+                            const float* up = row - w;
+                            const float* down = row + w;
+                            const float* rhs = x0.row(j, line, ilo, ihi);
+                            float* dest = &out.at(0, j);
+                            for (int i = ilo; i <= ihi; i++) {
+                                dest[i] = (rhs[i] + ka * (row[i-1] + row[i+1] +
+                                           up[i] + down[i])) * kInvC;
+                            }
+                        }
+                    }
+                    if (solids) {
+                        // Boundary cells one in from the relaxed region
+                        // have all their fluid neighbors updated.
+                        local_obstacles(out, *solids, n, b, std::max(1, tx0 - e + 1),
+                                        std::min(n, tx1 + e - 1), std::max(1, ty0 - e + 1),
+                                        std::min(n, ty1 + e - 1));
+                    }
+                    local_walls(out, n, b, ilo, ihi, jlo, jhi);
+                    std::swap(in, out);
+                }
+                for (int j = ty0; j <= ty1; j++) {
+                    dst.write(j, tx0, tx1, &in.at(tx0, j));
+                }
+            }
+        });
+        set_bnd(IX, b, dst);
+        std::swap(src, dst);
+    }
+    if (src.data != x.data) {
+        std::copy(src.data, src.data + IX.size(), x.data);
+    }
+}
+
+template <class Rows>
+float lin_residual(int n, Rows x, Rows x0, float a, float c, float* lines,
+                   const ObstacleMap* solids) {
+    const int S = n + 2;
+    double sum = 0.0;
+    long cells = 0;
+    for (int j = 1; j <= n; j++) {
+        const float* down = x.row(j - 1, lines);
+        const float* row = x.row(j, lines + S);
+        const float* up = x.row(j + 1, lines + 2 * S);
+        const float* rhs = x0.row(j, lines + 3 * S);
+        for (int i = 1; i <= n; i++) {
+            if (solids && solids->solid(i, j)) {
+                continue;
+            }
+            float r = rhs[i] + a * (row[i-1] + row[i+1] + down[i] + up[i]) - c * row[i];
+            sum += double(r) * r;
+            cells++;
+        }
+    }
+    return cells ? float(std::sqrt(sum / double(cells))) : 0.0f;
+}
+
+// The two storages FluidSolver runs.
+template void lin_solve_red_black(ThreadPool&, int, int, FloatRows, FloatRows, float, float,
+                                  int, float*, const ObstacleMap*);
+template void lin_solve_jacobi(ThreadPool&, int, int, FloatRows, FloatRows, float, float, int,
+                               FloatRows, float*, const ObstacleMap*);
+template void lin_solve_jacobi_tiled(ThreadPool&, int, int, FloatRows, FloatRows, float, float,
+                                     int, int, int, FloatRows, float*, float*,
+                                     const ObstacleMap*);
+template float lin_residual(int, FloatRows, FloatRows, float, float, float*, const ObstacleMap*);
+template void lin_solve_red_black(ThreadPool&, int, int, PackedRows, PackedRows, float, float,
+                                  int, float*, const ObstacleMap*);
+template void lin_solve_jacobi(ThreadPool&, int, int, PackedRows, PackedRows, float, float, int,
+                               PackedRows, float*, const ObstacleMap*);
+template void lin_solve_jacobi_tiled(ThreadPool&, int, int, PackedRows, PackedRows, float, float,
+                                     int, int, int, PackedRows, float*, float*,
+                                     const ObstacleMap*);
+template float lin_residual(int, PackedRows, PackedRows, float, float, float*, const ObstacleMap*);
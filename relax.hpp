@@ -0,0 +1,54 @@
+#ifndef RELAX_HPP
+#define RELAX_HPP
+#include <cstddef>
+
+class ObstacleMap;
+class ThreadPool;
+
+// Every kernel here is written against a row accessor, Rows = FloatRows
+// (utils.hpp) or PackedRows (packed_fields.hpp), and instantiated for both,
+// so fp32 and 16-bit fields run the same sweeps in the same order. lines
+// holds relax_lines() floats: line buffers for rows widened from 16-bit
+// storage, unused for fp32.
+size_t relax_lines(int workers, int n);
+
+// Red-black Gauss-Seidel for the update shared by diffuse() and the pressure
+// solve, x = (x0 + a * sum(neighbors)) / c, followed by set_bnd(b, x) after
+// every sweep. Each color is split into one row band per pool worker.
+//
+// With solids, every kernel here skips solid cells, leaving them as they
+// were, and sets the boundary cells with solids->apply(b, x) after each
+// sweep, before set_bnd.
+template <class Rows>
+void lin_solve_red_black(ThreadPool& pool, int n, int b, Rows x, Rows x0, float a, float c,
+                         int iters, float* lines, const ObstacleMap* solids = nullptr);
+
+// Jacobi iterations of the same update, reading x and writing scratch (a
+// full-size field of the same storage) each sweep; the result ends up in x.
+template <class Rows>
+void lin_solve_jacobi(ThreadPool& pool, int n, int b, Rows x, Rows x0, float a, float c,
+                      int iters, Rows scratch, float* lines,
+                      const ObstacleMap* solids = nullptr);
+
+// Bit-identical to lin_solve_jacobi, but walks tile x tile blocks in
+// row-major order and runs up to `depth` sweeps per block before moving on.
+// Each block is widened with a depth-cell halo into a small fp32 buffer,
+// recomputing the overlap instead of streaming the whole grid every sweep.
+// With solids the halo is 2 * depth cells, since boundary cells need their
+// neighbors' new values, and each block applies the boundary cells inside
+// it after every local sweep. blocks holds jacobi_tiled_scratch() floats,
+// the two block buffers of every pool worker, so nothing is allocated per
+// call; scratch is a full-size field as for lin_solve_jacobi.
+template <class Rows>
+void lin_solve_jacobi_tiled(ThreadPool& pool, int n, int b, Rows x, Rows x0, float a, float c,
+                            int iters, int tile, int depth, Rows scratch, float* blocks,
+                            float* lines, const ObstacleMap* solids = nullptr);
+size_t jacobi_tiled_scratch(int workers, int n, int tile, int depth);
+
+// RMS over interior cells of x0 + a * sum(neighbors) - c * x; with solids,
+// over the fluid ones only.
+template <class Rows>
+float lin_residual(int n, Rows x, Rows x0, float a, float c, float* lines,
+                   const ObstacleMap* solids = nullptr);
+
+#endif
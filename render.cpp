@@ -1,12 +1,29 @@
 #include "render.hpp"
 #include "fluid.hpp"
+#include "profiler.hpp"
+#include "utils.hpp"
 #include <vector>
 #include <iostream>
 #include <algorithm>
+#include <cstdio>
+#include <cstring>
 
 // OpenGL variables
 GLuint vao, vbo, ebo, shaderProgram;
 GLint posAttrib, colorAttrib;
+RenderMode renderMode = RenderMode::Texture;
+
+// Texture path: density texture fed from two pixel unpack buffers, so the
+// CPU fills one while the GPU may still be reading the other.
+GLuint densityTex, quadVao, pbo[2];
+int texN = 0;
+int pboIndex = 0;
+bool persistentPbo = false;
+void* pboPtr[2] = {nullptr, nullptr};
+GLsync pboFence[2] = {nullptr, nullptr};
+
+// Profiler overlay, created on the first drawProfileHud()
+GLuint hudProgram = 0, hudVao, hudVbo;
 
 bool isDragging = false;
 double startX, startY;
@@ -32,6 +49,29 @@ const char* fragmentShaderSource = R"(
     }
 )";
 
+// Full-screen quad as a 4-vertex triangle strip generated from gl_VertexID;
+// the grayscale mapping of the quad path happens per fragment.
+const char* quadVertexShaderSource = R"(
+    #version 330 core
+    out vec2 uv;
+    void main() {
+        vec2 corner = vec2(gl_VertexID & 1, gl_VertexID >> 1);
+        uv = corner;
+        gl_Position = vec4(corner * 2.0 - 1.0, 0.0, 1.0);
+    }
+)";
+
+const char* quadFragmentShaderSource = R"(
+    #version 330 core
+    in vec2 uv;
+    uniform sampler2D density;
+    out vec4 outColor;
+    void main() {
+        float d = clamp(texture(density, uv).r, 0.0, 1.0);
+        outColor = vec4(d, d, d, 1.0);
+    }
+)";
+
 bool compileShader(GLuint shader, const char* source) {
     glShaderSource(shader, 1, &source, NULL);
     glCompileShader(shader);
@@ -46,58 +86,202 @@ bool compileShader(GLuint shader, const char* source) {
     return true;
 }
 
-bool initGL() {
-    GLenum glewStatus = glewInit();
-    if (glewStatus != GLEW_OK) {
-        std::cerr << "Failed to initialize GLEW: " << glewGetErrorString(glewStatus) << std::endl;
-        return false;
-    }
-    
-    glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
+GLuint linkProgram(const char* vertexSource, const char* fragmentSource) {
     GLuint vertexShader = glCreateShader(GL_VERTEX_SHADER);
-    if (!compileShader(vertexShader, vertexShaderSource)) {
-        return false;
+    if (!compileShader(vertexShader, vertexSource)) {
+        glDeleteShader(vertexShader);
+        return 0;
     }
 
     GLuint fragmentShader = glCreateShader(GL_FRAGMENT_SHADER);
-    if (!compileShader(fragmentShader, fragmentShaderSource)) {
+    if (!compileShader(fragmentShader, fragmentSource)) {
         glDeleteShader(vertexShader);
-        return false;
+        glDeleteShader(fragmentShader);
+        return 0;
     }
 
-    shaderProgram = glCreateProgram();
-    glAttachShader(shaderProgram, vertexShader);
-    glAttachShader(shaderProgram, fragmentShader);
-    glLinkProgram(shaderProgram);
+    GLuint program = glCreateProgram();
+    glAttachShader(program, vertexShader);
+    glAttachShader(program, fragmentShader);
+    glLinkProgram(program);
+    glDeleteShader(vertexShader);
+    glDeleteShader(fragmentShader);
 
     GLint success;
-    glGetProgramiv(shaderProgram, GL_LINK_STATUS, &success);
+    glGetProgramiv(program, GL_LINK_STATUS, &success);
     if (!success) {
         GLchar infoLog[512];
-        glGetProgramInfoLog(shaderProgram, 512, NULL, infoLog);
+        glGetProgramInfoLog(program, 512, NULL, infoLog);
         std::cerr << "Shader program linking error: " << infoLog << std::endl;
-        glDeleteShader(vertexShader);
-        glDeleteShader(fragmentShader);
+        glDeleteProgram(program);
+        return 0;
+    }
+    return program;
+}
+
+bool initGL(RenderMode mode) {
+    GLenum glewStatus = glewInit();
+    if (glewStatus != GLEW_OK) {
+        std::cerr << "Failed to initialize GLEW: " << glewGetErrorString(glewStatus) << std::endl;
         return false;
     }
+    
+    glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
+    renderMode = mode;
 
-    glDeleteShader(vertexShader);
-    glDeleteShader(fragmentShader);
+    if (mode == RenderMode::Texture) {
+        shaderProgram = linkProgram(quadVertexShaderSource, quadFragmentShaderSource);
+        if (!shaderProgram) {
+            return false;
+        }
+        glUseProgram(shaderProgram);
+        glUniform1i(glGetUniformLocation(shaderProgram, "density"), 0);
+        glUseProgram(0);
+
+        // Core profile needs a bound VAO even though the quad has no attributes
+        glGenVertexArrays(1, &quadVao);
+        glGenTextures(1, &densityTex);
+        glGenBuffers(2, pbo);
+        persistentPbo = GLEW_ARB_buffer_storage;
+        return true;
+    }
+
+    shaderProgram = linkProgram(vertexShaderSource, fragmentShaderSource);
+    if (!shaderProgram) {
+        return false;
+    }
 
     glGenVertexArrays(1, &vao);
     glGenBuffers(1, &vbo);
     glGenBuffers(1, &ebo);
+
+    // Attribute layout is fixed, so record it in the VAO once
+    glBindVertexArray(vao);
+    glBindBuffer(GL_ARRAY_BUFFER, vbo);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ebo);
+
+    posAttrib = glGetAttribLocation(shaderProgram, "position");
+    glEnableVertexAttribArray(posAttrib);
+    glVertexAttribPointer(posAttrib, 2, GL_FLOAT, GL_FALSE,
+                         5 * sizeof(float), (void*)0);
+
+    colorAttrib = glGetAttribLocation(shaderProgram, "color");
+    glEnableVertexAttribArray(colorAttrib);
+    glVertexAttribPointer(colorAttrib, 3, GL_FLOAT, GL_FALSE,
+                         5 * sizeof(float), (void*)(2 * sizeof(float)));
+
+    glBindVertexArray(0);
     return true;
 }
 
+void releasePbos() {
+    for (int k = 0; k < 2; k++) {
+        if (pboFence[k]) {
+            glDeleteSync(pboFence[k]);
+            pboFence[k] = nullptr;
+        }
+        if (pboPtr[k]) {
+            glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pbo[k]);
+            glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+            pboPtr[k] = nullptr;
+        }
+    }
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    glDeleteBuffers(2, pbo);
+}
+
 void cleanupGL() {
-    glDeleteVertexArrays(1, &vao);
-    glDeleteBuffers(1, &vbo);
-    glDeleteBuffers(1, &ebo);
+    if (hudProgram) {
+        glDeleteVertexArrays(1, &hudVao);
+        glDeleteBuffers(1, &hudVbo);
+        glDeleteProgram(hudProgram);
+        hudProgram = 0;
+    }
+    if (renderMode == RenderMode::Texture) {
+        releasePbos();
+        glDeleteTextures(1, &densityTex);
+        glDeleteVertexArrays(1, &quadVao);
+    } else {
+        glDeleteVertexArrays(1, &vao);
+        glDeleteBuffers(1, &vbo);
+        glDeleteBuffers(1, &ebo);
+    }
     glDeleteProgram(shaderProgram);
 }
 
-void updateVBO() {
+// (Re)creates the N x N R32F texture and its upload buffers. Each buffer
+// holds the full padded grid so a frame is one memcpy of the density.
+void allocateDensityTexture(int N) {
+    glBindTexture(GL_TEXTURE_2D, densityTex);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_R32F, N, N, 0, GL_RED, GL_FLOAT, nullptr);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glBindTexture(GL_TEXTURE_2D, 0);
+
+    // Immutable storage can't be resized, so always start from fresh buffers
+    releasePbos();
+    glGenBuffers(2, pbo);
+    GLsizeiptr bytes = GLsizeiptr(N + 2) * (N + 2) * sizeof(float);
+    for (int k = 0; k < 2; k++) {
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pbo[k]);
+        if (persistentPbo) {
+            GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+            glBufferStorage(GL_PIXEL_UNPACK_BUFFER, bytes, nullptr, flags);
+            pboPtr[k] = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, bytes, flags);
+        } else {
+            glBufferData(GL_PIXEL_UNPACK_BUFFER, bytes, nullptr, GL_STREAM_DRAW);
+        }
+    }
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    texN = N;
+    checkGLError("allocateDensityTexture");
+}
+
+void updateTexture(const float* dens, int N) {
+    if (N != texN) {
+        allocateDensityTexture(N);
+    }
+    Grid<0> IX{N};
+    size_t bytes = IX.size() * sizeof(float);
+
+    pboIndex ^= 1;
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pbo[pboIndex]);
+    if (persistentPbo) {
+        // Wait for the upload that last used this buffer, two frames ago
+        if (pboFence[pboIndex]) {
+            glClientWaitSync(pboFence[pboIndex], GL_SYNC_FLUSH_COMMANDS_BIT, GL_TIMEOUT_IGNORED);
+            glDeleteSync(pboFence[pboIndex]);
+            pboFence[pboIndex] = nullptr;
+        }
+        std::memcpy(pboPtr[pboIndex], dens, bytes);
+    } else {
+        void* ptr = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, bytes,
+                                     GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+        if (ptr) {
+            std::memcpy(ptr, dens, bytes);
+            glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+        }
+    }
+
+    // Upload the interior only: skip the ghost ring with the row length
+    // and the offset of cell (1,1).
+    glBindTexture(GL_TEXTURE_2D, densityTex);
+    glPixelStorei(GL_UNPACK_ROW_LENGTH, N + 2);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, N, N, GL_RED, GL_FLOAT,
+                    (void*)(IX(1,1) * sizeof(float)));
+    glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    if (persistentPbo) {
+        pboFence[pboIndex] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    }
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    checkGLError("updateTexture");
+}
+
+void updateVBO(const float* dens, int N) {
+    Grid<0> IX{N};
     std::vector<float> vertices;
     std::vector<unsigned int> indices;
     float scale = 2.0f / N;
@@ -144,35 +328,144 @@ void updateVBO() {
     glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ebo);
     glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(unsigned int),
                  indices.data(), GL_DYNAMIC_DRAW);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    checkGLError("updateVBO");
+}
 
-    glBindVertexArray(vao);
-    glBindBuffer(GL_ARRAY_BUFFER, vbo);
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ebo);
-    
-    posAttrib = glGetAttribLocation(shaderProgram, "position");
-    glEnableVertexAttribArray(posAttrib);
-    glVertexAttribPointer(posAttrib, 2, GL_FLOAT, GL_FALSE,
-                         5 * sizeof(float), (void*)0);
-
-    colorAttrib = glGetAttribLocation(shaderProgram, "color");
-    glEnableVertexAttribArray(colorAttrib);
-    glVertexAttribPointer(colorAttrib, 3, GL_FLOAT, GL_FALSE,
-                         5 * sizeof(float), (void*)(2 * sizeof(float)));
+void checkGLError(const std::string& place) {
+    GLenum error = glGetError();
+    if (error != GL_NO_ERROR) {
+        std::cerr << "OpenGL error at " << place << ": " << error << std::endl;
+    }
+}
 
-    glBindVertexArray(0);
-    checkGLError("updateVBO");
+void updateFrame(const float* dens, int N) {
+    ProfileScope scope("upload_frame");
+    if (renderMode == RenderMode::Texture) {
+        updateTexture(dens, N);
+    } else {
+        updateVBO(dens, N);
+    }
 }
 
-void render() {
+void render(int N) {
+    ProfileScope scope("render");
     glClear(GL_COLOR_BUFFER_BIT);
     glUseProgram(shaderProgram);
-    glBindVertexArray(vao);
-    glDrawElements(GL_TRIANGLES, N * N * 6, GL_UNSIGNED_INT, 0);
+    if (renderMode == RenderMode::Texture) {
+        glActiveTexture(GL_TEXTURE0);
+        glBindTexture(GL_TEXTURE_2D, densityTex);
+        glBindVertexArray(quadVao);
+        glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+        glBindTexture(GL_TEXTURE_2D, 0);
+    } else {
+        glBindVertexArray(vao);
+        glDrawElements(GL_TRIANGLES, N * N * 6, GL_UNSIGNED_INT, 0);
+    }
     glBindVertexArray(0);
     checkGLError("render");
 }
 
-bool isValidGridCell(int i, int j) {
+// 3x5 glyphs, one bit per pixel, rows top to bottom, MSB on the left.
+uint16_t glyphBits(char c) {
+    static const uint16_t digits[10] = {
+        075557, 026227, 071747, 071717, 055711, 074717, 074757, 071111, 075757, 075717};
+    static const uint16_t letters[26] = {
+        025755, 065656, 034443, 065556, 074647, 074644, 034553, 055755, 072227, 011152,
+        055655, 044447, 057755, 065555, 025552, 065644, 025563, 065655, 034216, 072222,
+        055557, 055552, 055775, 055255, 055222, 071247};
+    if (c >= '0' && c <= '9') return digits[c - '0'];
+    if (c >= 'a' && c <= 'z') return letters[c - 'a'];
+    if (c == '_') return 000007;
+    if (c == '.') return 000002;
+    if (c == '/') return 011244;
+    return 0;
+}
+
+void pushRect(std::vector<float>& out, float x0, float y0, float x1, float y1,
+              float r, float g, float b) {
+    const float corners[6][2] = {{x0, y0}, {x1, y0}, {x1, y1}, {x0, y0}, {x1, y1}, {x0, y1}};
+    for (const auto& p : corners) {
+        out.insert(out.end(), {p[0], p[1], r, g, b});
+    }
+}
+
+// Text with its top-left corner at (x, y); px is one glyph pixel in NDC.
+void pushText(std::vector<float>& out, const char* text, float x, float y,
+              float px, float py) {
+    for (; *text; text++, x += 4 * px) {
+        uint16_t bits = glyphBits(*text);
+        for (int row = 0; row < 5; row++) {
+            for (int col = 0; col < 3; col++) {
+                if (bits & (1 << (14 - 3 * row - col))) {
+                    float cx = x + col * px, cy = y - row * py;
+                    pushRect(out, cx, cy - py, cx + px, cy, 0.9f, 0.9f, 0.9f);
+                }
+            }
+        }
+    }
+}
+
+void drawProfileHud(const std::vector<StageSummary>& stages, int width, int height) {
+    if (!hudProgram) {
+        hudProgram = linkProgram(vertexShaderSource, fragmentShaderSource);
+        if (!hudProgram) {
+            return;
+        }
+        glGenVertexArrays(1, &hudVao);
+        glGenBuffers(1, &hudVbo);
+        glBindVertexArray(hudVao);
+        glBindBuffer(GL_ARRAY_BUFFER, hudVbo);
+        glEnableVertexAttribArray(0);
+        glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 5 * sizeof(float), (void*)0);
+        glEnableVertexAttribArray(1);
+        glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 5 * sizeof(float),
+                              (void*)(2 * sizeof(float)));
+        glBindVertexArray(0);
+    }
+
+    // Two screen pixels per glyph pixel; rows of 7 glyph pixels.
+    const float px = 4.0f / std::max(width, 1), py = 4.0f / std::max(height, 1);
+    const size_t rows = std::min<size_t>(stages.size(), 16);
+    const float left = -1.0f + 2 * px, top = 1.0f - 2 * py;
+    const float barLeft = left + 56 * 4 * px, barWidth = 40 * 4 * px;
+    double scaleMs = 0;
+    for (size_t k = 0; k < rows; k++) {
+        scaleMs = std::max(scaleMs, stages[k].p99Ms);
+    }
+
+    std::vector<float> verts;
+    pushRect(verts, -1.0f, top - (rows + 1) * 7 * py, barLeft + barWidth + 2 * px, 1.0f,
+             0.08f, 0.08f, 0.08f);
+    pushText(verts, "stage            p50 ms   p95 ms   p99 ms   calls", left, top, px, py);
+    for (size_t k = 0; k < rows; k++) {
+        const StageSummary& s = stages[k];
+        float y = top - (k + 1) * 7 * py;
+        char line[96];
+        std::snprintf(line, sizeof(line), "%-16.16s %8.3f %8.3f %8.3f %7zu",
+                      s.name, s.p50Ms, s.p95Ms, s.p99Ms, s.count);
+        pushText(verts, line, left, y, px, py);
+        if (scaleMs > 0) {
+            float w50 = float(s.p50Ms / scaleMs) * barWidth;
+            float w95 = float(s.p95Ms / scaleMs) * barWidth;
+            float w99 = float(s.p99Ms / scaleMs) * barWidth;
+            pushRect(verts, barLeft, y - 5 * py, barLeft + w50, y, 0.2f, 0.8f, 0.3f);
+            pushRect(verts, barLeft + w50, y - 5 * py, barLeft + w95, y, 0.9f, 0.7f, 0.1f);
+            pushRect(verts, barLeft + w99 - px, y - 5 * py, barLeft + w99, y, 0.9f, 0.2f, 0.2f);
+        }
+    }
+
+    glUseProgram(hudProgram);
+    glBindVertexArray(hudVao);
+    glBindBuffer(GL_ARRAY_BUFFER, hudVbo);
+    glBufferData(GL_ARRAY_BUFFER, verts.size() * sizeof(float), verts.data(), GL_STREAM_DRAW);
+    glDrawArrays(GL_TRIANGLES, 0, (GLsizei)(verts.size() / 5));
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    glBindVertexArray(0);
+    checkGLError("drawProfileHud");
+}
+
+bool isValidGridCell(int N, int i, int j) {
     return (i >= 1 && i <= N && j >= 1 && j <= N);
 }
 
@@ -201,31 +494,33 @@ void cursor_pos_callback(GLFWwindow* window, double xpos, double ypos) {
         return;
     }
 
+    FluidSolver& solver = *static_cast<FluidSolver*>(glfwGetWindowUserPointer(window));
+    const int N = solver.n();
+
     int width, height;
     glfwGetWindowSize(window, &width, &height);
 
     int i = (int)((xpos / width) * N) + 1;
     int j = (int)(((height - ypos) / height) * N) + 1;
 
-    if (isDragging && isValidGridCell(i, j)) {
+    if (isDragging && isValidGridCell(N, i, j)) {
 
             float velX = (xpos - lastX) * 0.3f;
             float velY = (lastY - ypos) * 0.3f;
             velX = std::min(std::max(velX, -10.0f), 10.0f);
             velY = std::min(std::max(velY, -10.0f), 10.0f);
 
-            // Apply velocity and density change in the surrounding cells
-            for (int di = -2; di <= 2; di++) {
-                for (int dj = -2; dj <= 2; dj++) {
-                    if (isValidGridCell(i + di, j + dj)) {
-                        float factor = std::max(0.0f, 1.0f - 0.05f * (abs(di) + abs(dj)));
-                        u_prev[IX(i + di, j + dj)] += velX * 10 * factor;
-                        v_prev[IX(i + di, j + dj)] += velY * 10 * factor;
-                        dens_prev[IX(i + di, j + dj)] += 60.0f * factor;
-                    }
-                }
-            
-        }
+            // Queue a 5x5 stamp; the solver applies it at the start of its next step
+            Splat splat;
+            splat.x = (float)i;
+            splat.y = (float)j;
+            splat.radius = 2.0f;
+            splat.du = velX * 10;
+            splat.dv = velY * 10;
+            splat.density = 60.0f;
+            splat.falloff = 0.05f;
+            splat.shape = SplatShape::Square;
+            solver.splats().push(splat);
     }
 
     lastX = xpos;
@@ -233,7 +528,8 @@ void cursor_pos_callback(GLFWwindow* window, double xpos, double ypos) {
 }
 
 
-void setupInputCallbacks(GLFWwindow* window) {
+void setupInputCallbacks(GLFWwindow* window, FluidSolver* solver) {
+    glfwSetWindowUserPointer(window, solver);
     glfwSetMouseButtonCallback(window, mouse_button_callback);
     glfwSetCursorPosCallback(window, cursor_pos_callback);
 }
\ No newline at end of file
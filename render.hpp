@@ -3,15 +3,28 @@
 #include <GL/glew.h>
 #include <GLFW/glfw3.h>
 #include <string>   
+#include <vector>
+#include "fluid.hpp"
+#include "profiler.hpp"
+
+// Texture uploads only the density grid through double-buffered PBOs and
+// draws one full-screen quad; Quads rebuilds a vertex per cell corner.
+enum class RenderMode { Texture, Quads };
 
 extern GLuint vao, vbo, ebo, shaderProgram;
 extern GLint posAttrib, colorAttrib;
 
-bool initGL();
+bool initGL(RenderMode mode = RenderMode::Texture);
 void cleanupGL();
-void updateVBO();
-void render();
-void setupInputCallbacks(GLFWwindow* window);
+void updateFrame(const float* dens, int N);
+void updateVBO(const float* dens, int N);
+void updateTexture(const float* dens, int N);
+void render(int N);
+// Draws the stage table and p50/p95/p99 bars over the top-left corner;
+// width and height are the framebuffer size in pixels.
+void drawProfileHud(const std::vector<StageSummary>& stages, int width, int height);
+// Mouse drags push splats onto solver->splats(); no solver lock is taken.
+void setupInputCallbacks(GLFWwindow* window, FluidSolver* solver);
 void checkGLError(const std::string& place);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,165 @@
+#include "scalar_transport.hpp"
+#include "profiler.hpp"
+#include "utils.hpp"
+#include <algorithm>
+
+// The kernels mirror FluidSolver's operation for operation with the field
+// loop innermost. FixedK != 0 bakes the field count in so that loop unrolls.
+namespace {
+
+template <int FixedK>
+struct Fields {
+    int n, count;
+    int k() const { return FixedK ? FixedK : count; }
+    int operator()(int i, int j) const { return (i + (n + 2) * j) * k(); }
+};
+
+template <int FixedK>
+void set_bnd(const Fields<FixedK>& F, float* x) {
+    const int N = F.n;
+    const int K = F.k();
+    for (int i = 1; i <= N; i++) {
+        for (int k = 0; k < K; k++) {
+            x[F(0,i) + k] = x[F(1,i) + k];
+            x[F(N+1,i) + k] = x[F(N,i) + k];
+            x[F(i,0) + k] = x[F(i,1) + k];
+            x[F(i,N+1) + k] = x[F(i,N) + k];
+        }
+    }
+    for (int k = 0; k < K; k++) {
+        x[F(0,0) + k] = 0.5f * (x[F(1,0) + k] + x[F(0,1) + k]);
+        x[F(0,N+1) + k] = 0.5f * (x[F(1,N+1) + k] + x[F(0,N) + k]);
+        x[F(N+1,0) + k] = 0.5f * (x[F(N,0) + k] + x[F(N+1,1) + k]);
+        x[F(N+1,N+1) + k] = 0.5f * (x[F(N,N+1) + k] + x[F(N+1,N) + k]);
+    }
+}
+
+template <int FixedK>
+void lin_solve(const Fields<FixedK>& F, float* x, const float* x0,
+               const float* a, const float* c, int iters) {
+    const int N = F.n;
+    const int K = F.k();
+    for (int it = 0; it < iters; it++) {
+        for (int i = 1; i <= N; i++) {
+            for (int j = 1; j <= N; j++) {
+                float* xc = x + F(i,j);
+                const float* l = x + F(i-1,j);
+                const float* r = x + F(i+1,j);
+                const float* d = x + F(i,j-1);
+                const float* u = x + F(i,j+1);
+                const float* s = x0 + F(i,j);
+                for (int k = 0; k < K; k++) {
+                    xc[k] = (s[k] + a[k] * (l[k] + r[k] + d[k] + u[k])) / c[k];
+                }
+            }
+        }
+        set_bnd(F, x);
+    }
+}
+
+// One backtrace and one set of weights per cell, applied to all K fields.
+template <int FixedK>
+void advect(const Fields<FixedK>& F, float* d, const float* d0,
+            const float* u, const float* v, float dt) {
+    const int N = F.n;
+    const int K = F.k();
+    const Grid<0> IX{N};
+    float dt0 = dt * N;
+    for (int j = 1; j <= N; j++) {
+        for (int i = 1; i <= N; i++) {
+            int i0, j0;
+            float s1, t1;
+            advect_backtrace(IX, i, j, u, v, dt0, i0, j0, s1, t1);
+            float s0 = 1 - s1;
+            float t0 = 1 - t1;
+            const float* d00 = d0 + F(i0,j0);
+            const float* d01 = d0 + F(i0,j0 + 1);
+            const float* d10 = d0 + F(i0 + 1,j0);
+            const float* d11 = d0 + F(i0 + 1,j0 + 1);
+            float* out = d + F(i,j);
+            for (int k = 0; k < K; k++) {
+                out[k] = s0 * (t0 * d00[k] + t1 * d01[k]) +
+                         s1 * (t0 * d10[k] + t1 * d11[k]);
+            }
+        }
+    }
+    set_bnd(F, d);
+}
+
+// FluidSolver::dens_step for all fields.
+template <int FixedK>
+void dens_step(const Fields<FixedK>& F, std::vector<float>& x, std::vector<float>& x0,
+               const float* u, const float* v, const float* a, const float* c,
+               float dt, int iters) {
+    for (size_t k = 0; k < x.size(); k++) {
+        x[k] += dt * x0[k];
+    }
+    std::swap(x0, x);
+    {
+        ProfileScope scope("transport_diffuse");
+        lin_solve(F, x.data(), x0.data(), a, c, iters);
+    }
+    std::swap(x0, x);
+    ProfileScope scope("transport_advect");
+    advect(F, x.data(), x0.data(), u, v, dt);
+}
+
+} // namespace
+
+ScalarTransport::ScalarTransport(int n, const std::vector<float>& diff)
+    : diff(diff), n_(n), k_((int)diff.size()) {
+    clear();
+}
+
+void ScalarTransport::clear() {
+    const size_t size = (size_t)(n_ + 2) * (n_ + 2) * k_;
+    values.assign(size, 0.0f);
+    sources.assign(size, 0.0f);
+}
+
+void ScalarTransport::addSplat(const Splat& splat, const float* amounts) {
+    for_each_splat_cell(n_, splat, [&](int cell, float weight) {
+        float* s = sources.data() + (size_t)cell * k_;
+        for (int k = 0; k < k_; k++) {
+            s[k] += amounts[k] * weight;
+        }
+    });
+}
+
+void ScalarTransport::step(const float* u, const float* v, float dt, int iterations) {
+    ProfileScope scope("transport_step");
+    a_.resize(k_);
+    c_.resize(k_);
+    for (int k = 0; k < k_; k++) {
+        a_[k] = dt * diff[k] * n_ * n_;
+        c_[k] = 1 + 4 * a_[k];
+    }
+    auto run = [&](auto fields) {
+        dens_step(fields, values, sources, u, v, a_.data(), c_.data(), dt, iterations);
+    };
+    switch (k_) {
+    case 1: run(Fields<1>{n_, 1}); break;
+    case 2: run(Fields<2>{n_, 2}); break;
+    case 3: run(Fields<3>{n_, 3}); break;
+    case 4: run(Fields<4>{n_, 4}); break;
+    case 8: run(Fields<8>{n_, 8}); break;
+    default: run(Fields<0>{n_, k_}); break;
+    }
+    std::fill(sources.begin(), sources.end(), 0.0f);
+}
+
+void ScalarTransport::step(const FluidSolver& solver, float dt) {
+    // 16-bit storage releases the fp32 velocity.
+    if (solver.u.empty()) {
+        return;
+    }
+    step(solver.u.data(), solver.v.data(), dt, solver.params.iterations);
+}
+
+void ScalarTransport::sampleField(int k, std::vector<float>& out) const {
+    const int cells = Grid<0>{n_}.size();
+    out.resize(cells);
+    for (int c = 0; c < cells; c++) {
+        out[c] = values[(size_t)c * k_ + k];
+    }
+}
@@ -0,0 +1,47 @@
+#ifndef SCALAR_TRANSPORT_HPP
+#define SCALAR_TRANSPORT_HPP
+#include <vector>
+#include "fluid.hpp"
+
+// K passive scalars (dye channels, temperature, smoke age, ...) carried by
+// one velocity field. Field k of cell IX(i,j) is stored at IX(i,j) * K + k,
+// so advection backtraces a cell and computes its bilinear weights once,
+// then blends all K fields with them, and each diffusion sweep loads a
+// stencil's K values from one run of memory.
+//
+// Every field follows FluidSolver::dens_step with Gauss-Seidel diffusion
+// and semi-Lagrangian advection: given the same velocity, sources and
+// diffusion rate it matches a FluidSolver density bit for bit. The
+// relaxation, tolerance, simd and advection settings do not apply.
+class ScalarTransport {
+public:
+    // One field per diffusion rate.
+    ScalarTransport(int n, const std::vector<float>& diff);
+
+    int n() const { return n_; }
+    int fields() const { return k_; }
+    int index(int i, int j, int k) const { return (i + (n_ + 2) * j) * k_ + k; }
+
+    void clear();
+    // Adds amounts[k] * weight to field k's source over the splat's cells;
+    // the splat's du, dv and density are not used.
+    void addSplat(const Splat& splat, const float* amounts);
+    // Adds the sources, diffuses and advects every field along (u, v), then
+    // clears the sources.
+    void step(const float* u, const float* v, float dt, int iterations);
+    // Call after solver.updateFluid(dt): the fields move with the same
+    // velocity the solver's density just did. Does nothing while the solver
+    // keeps 16-bit storage.
+    void step(const FluidSolver& solver, float dt);
+    // Copies one field, (N+2)^2 values in FluidSolver layout.
+    void sampleField(int k, std::vector<float>& out) const;
+
+    std::vector<float> diff;              // per field
+    std::vector<float> values, sources;   // (N+2)^2 * K, interleaved
+
+private:
+    int n_, k_;
+    std::vector<float> a_, c_;
+};
+
+#endif
@@ -0,0 +1,105 @@
+#include "sim_thread.hpp"
+#include "profiler.hpp"
+
+SimulationThread::SimulationThread(FluidSolver& solver, float dt)
+    : solver_(solver), dt_(dt) {}
+
+SimulationThread::~SimulationThread() {
+    stop();
+}
+
+void SimulationThread::start() {
+    if (running_.exchange(true)) {
+        return;
+    }
+    lastReport_ = std::chrono::steady_clock::now();
+    thread_ = std::thread(&SimulationThread::loop, this);
+}
+
+void SimulationThread::stop() {
+    if (!running_.exchange(false)) {
+        return;
+    }
+    thread_.join();
+}
+
+void SimulationThread::loop() {
+    using clock = std::chrono::steady_clock;
+    const auto period = std::chrono::duration_cast<clock::duration>(
+        std::chrono::duration<double>(dt_));
+    // If the solver falls this far behind, stop trying to catch up.
+    const auto maxLag = period * 5;
+    auto next = clock::now();
+    profile_thread_name("simulation");
+    if (controller_ && controller_->control.budgetMs <= 0) {
+        controller_->control.budgetMs = dt_ * 1000.0;
+    }
+
+    while (running_.load(std::memory_order_relaxed)) {
+        if (controller_) {
+            substeps_.fetch_add(controller_->advance(solver_, dt_).substeps,
+                                std::memory_order_relaxed);
+        } else {
+            solver_.updateFluid(dt_);
+            substeps_.fetch_add(1, std::memory_order_relaxed);
+        }
+        uint64_t step = steps_.fetch_add(1, std::memory_order_relaxed) + 1;
+        if (checkpoints_) {
+            checkpoints_->maybeSave(solver_);
+        }
+
+        {
+            ProfileScope scope("publish");
+            DensityFrame& frame = frames_.back();
+            frame.n = solver_.n();
+            frame.step = step;
+            solver_.copyDensity(frame.dens);
+            frame.published = clock::now();
+            if (frames_.publish()) {
+                dropped_.fetch_add(1, std::memory_order_relaxed);
+            }
+        }
+
+        next += period;
+        auto now = clock::now();
+        if (now > next + maxLag) {
+            next = now;
+        } else if (next > now) {
+            std::this_thread::sleep_until(next);
+        }
+    }
+}
+
+const DensityFrame& SimulationThread::latest(bool& fresh) {
+    fresh = frames_.update();
+    const DensityFrame& frame = frames_.front();
+    if (fresh) {
+        reads_++;
+        latencySumMs_ += std::chrono::duration<double, std::milli>(
+            std::chrono::steady_clock::now() - frame.published).count();
+    } else {
+        duplicated_++;
+    }
+    return frame;
+}
+
+SimStats SimulationThread::stats() {
+    auto now = std::chrono::steady_clock::now();
+    SimStats s;
+    s.steps = steps_.load(std::memory_order_relaxed);
+    s.dropped = dropped_.load(std::memory_order_relaxed);
+    s.duplicated = duplicated_;
+    s.latencyMs = reads_ ? latencySumMs_ / reads_ : 0.0;
+    double elapsed = std::chrono::duration<double>(now - lastReport_).count();
+    if (elapsed > 0) {
+        s.stepRate = (s.steps - lastSteps_) / elapsed;
+    }
+    uint64_t substeps = substeps_.load(std::memory_order_relaxed);
+    if (s.steps > lastSteps_) {
+        s.substeps = double(substeps - lastSubsteps_) / (s.steps - lastSteps_);
+    }
+    lastSteps_ = s.steps;
+    lastSubsteps_ = substeps;
+    lastReport_ = now;
+    return s;
+}
@@ -0,0 +1,74 @@
+#ifndef SIM_THREAD_HPP
+#define SIM_THREAD_HPP
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <thread>
+#include <vector>
+#include "checkpoint.hpp"
+#include "fluid.hpp"
+#include "step_control.hpp"
+#include "triple_buffer.hpp"
+
+// One finished density field handed from the simulation to the renderer.
+struct DensityFrame {
+    int n = 0;
+    uint64_t step = 0;
+    std::chrono::steady_clock::time_point published;
+    std::vector<float> dens;
+};
+
+struct SimStats {
+    double stepRate = 0;      // steps per second over the last report window
+    uint64_t steps = 0;
+    uint64_t dropped = 0;     // published frames replaced before being read
+    uint64_t duplicated = 0;  // reads that found no new frame
+    double latencyMs = 0;     // mean publish-to-read delay of read frames
+    double substeps = 1;      // solver steps per published step, same window
+};
+
+// Steps a FluidSolver on its own thread at a fixed dt, paced to wall-clock
+// time, and publishes each finished density field through a triple buffer.
+// The render loop polls latest() and never waits on the solver.
+class SimulationThread {
+public:
+    SimulationThread(FluidSolver& solver, float dt);
+    ~SimulationThread();
+
+    void start();
+    void stop();
+    // Offers every step to writer->maybeSave(); set before start().
+    void setCheckpointWriter(CheckpointWriter* writer) { checkpoints_ = writer; }
+    // Covers each dt with controller->advance() instead of one step, and
+    // gives it the period as its budget unless one is set; set before start().
+    void setStepController(StepController* controller) { controller_ = controller; }
+
+    // Latest published frame; sets fresh to whether it is new since the
+    // last call. Only the render thread may call this.
+    const DensityFrame& latest(bool& fresh);
+
+    SimStats stats();
+
+private:
+    void loop();
+
+    FluidSolver& solver_;
+    float dt_;
+    CheckpointWriter* checkpoints_ = nullptr;
+    StepController* controller_ = nullptr;
+    std::thread thread_;
+    std::atomic<bool> running_{false};
+    TripleBuffer<DensityFrame> frames_;
+
+    std::atomic<uint64_t> steps_{0};
+    std::atomic<uint64_t> dropped_{0};
+    std::atomic<uint64_t> substeps_{0};
+    uint64_t duplicated_ = 0;
+    uint64_t reads_ = 0;
+    double latencySumMs_ = 0;
+    uint64_t lastSteps_ = 0;
+    uint64_t lastSubsteps_ = 0;
+    std::chrono::steady_clock::time_point lastReport_;
+};
+
+#endif
@@ -0,0 +1,157 @@
+#include "splat_queue.hpp"
+#include <algorithm>
+#include <tuple>
+
+SplatQueue::SplatQueue(size_t capacity) {
+    size_t size = 1;
+    while (size < capacity) {
+        size <<= 1;
+    }
+    mask_ = size - 1;
+    slots_.reset(new Slot[size]);
+    for (size_t i = 0; i < size; i++) {
+        slots_[i].sequence.store(i, std::memory_order_relaxed);
+    }
+}
+
+bool SplatQueue::push(const Splat& splat) {
+    size_t pos = tail_.load(std::memory_order_relaxed);
+    for (;;) {
+        Slot& slot = slots_[pos & mask_];
+        size_t seq = slot.sequence.load(std::memory_order_acquire);
+        intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+        if (diff == 0) {
+            if (tail_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                slot.splat = splat;
+                slot.sequence.store(pos + 1, std::memory_order_release);
+                return true;
+            }
+        } else if (diff < 0) {
+            dropped_.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        } else {
+            pos = tail_.load(std::memory_order_relaxed);
+        }
+    }
+}
+
+size_t SplatQueue::drain(std::vector<Splat>& out) {
+    size_t taken = 0;
+    for (;;) {
+        Slot& slot = slots_[head_ & mask_];
+        if (slot.sequence.load(std::memory_order_acquire) != head_ + 1) {
+            return taken;
+        }
+        out.push_back(slot.splat);
+        slot.sequence.store(head_ + mask_ + 1, std::memory_order_release);
+        head_++;
+        taken++;
+    }
+}
+
+void splat_bounds(int N, const Splat& s, int& minI, int& maxI, int& minJ, int& maxJ) {
+    if (s.shape == SplatShape::Disk) {
+        minI = std::max(1, static_cast<int>(s.x - s.radius));
+        maxI = std::min(N, static_cast<int>(s.x + s.radius));
+        minJ = std::max(1, static_cast<int>(s.y - s.radius));
+        maxJ = std::min(N, static_cast<int>(s.y + s.radius));
+    } else {
+        int r = static_cast<int>(s.radius);
+        minI = std::max(1, static_cast<int>(s.x) - r);
+        maxI = std::min(N, static_cast<int>(s.x) + r);
+        minJ = std::max(1, static_cast<int>(s.y) - r);
+        maxJ = std::min(N, static_cast<int>(s.y) + r);
+    }
+}
+
+namespace {
+
+auto footprint(const Splat& s) {
+    return std::make_tuple(s.shape, s.x, s.y, s.radius, s.falloff);
+}
+
+} // namespace
+
+void merge_splats(std::vector<Splat>& splats) {
+    if (splats.empty()) {
+        return;
+    }
+    std::stable_sort(splats.begin(), splats.end(), [](const Splat& a, const Splat& b) {
+        return footprint(a) < footprint(b);
+    });
+    size_t merged = 0;
+    for (size_t k = 1; k < splats.size(); k++) {
+        if (footprint(splats[k]) == footprint(splats[merged])) {
+            splats[merged].du += splats[k].du;
+            splats[merged].dv += splats[k].dv;
+            splats[merged].density += splats[k].density;
+        } else {
+            splats[++merged] = splats[k];
+        }
+    }
+    splats.resize(merged + 1);
+}
+
+void group_splats(int n, const std::vector<Splat>& splats, std::vector<SplatGroup>& groups,
+                  std::vector<int>& members) {
+    // Groups searched per splat; a burst arrives in order, so its
+    // neighbors are the recent groups.
+    const int lookback = 8;
+    auto area = [](int minI, int maxI, int minJ, int maxJ) {
+        return (long)(maxI - minI + 1) * (maxJ - minJ + 1);
+    };
+    groups.clear();
+    std::vector<long> cells;           // summed member box cells per group
+    std::vector<int> owner(splats.size(), -1);
+    for (size_t k = 0; k < splats.size(); k++) {
+        SplatGroup b;
+        splat_bounds(n, splats[k], b.minI, b.maxI, b.minJ, b.maxJ);
+        if (b.minI > b.maxI || b.minJ > b.maxJ) {
+            continue;
+        }
+        const long own = area(b.minI, b.maxI, b.minJ, b.maxJ);
+        int joined = -1;
+        for (int g = (int)groups.size() - 1; g >= 0 && g >= (int)groups.size() - lookback; g--) {
+            SplatGroup& group = groups[g];
+            if (b.minI > group.maxI || b.maxI < group.minI ||
+                b.minJ > group.maxJ || b.maxJ < group.minJ) {
+                continue;
+            }
+            int minI = std::min(b.minI, group.minI), maxI = std::max(b.maxI, group.maxI);
+            int minJ = std::min(b.minJ, group.minJ), maxJ = std::max(b.maxJ, group.maxJ);
+            if (area(minI, maxI, minJ, maxJ) > cells[g] + own) {
+                continue;
+            }
+            group.minI = minI;
+            group.maxI = maxI;
+            group.minJ = minJ;
+            group.maxJ = maxJ;
+            group.count++;
+            cells[g] += own;
+            joined = g;
+            break;
+        }
+        if (joined < 0) {
+            b.first = 0;
+            b.count = 1;
+            joined = (int)groups.size();
+            groups.push_back(b);
+            cells.push_back(own);
+        }
+        owner[k] = joined;
+    }
+    // Counting sort by group, keeping queue order within each.
+    int first = 0;
+    for (SplatGroup& g : groups) {
+        g.first = first;
+        first += g.count;
+        g.count = 0;
+    }
+    members.resize(first);
+    for (size_t k = 0; k < splats.size(); k++) {
+        if (owner[k] >= 0) {
+            SplatGroup& g = groups[owner[k]];
+            members[g.first + g.count++] = (int)k;
+        }
+    }
+}
@@ -0,0 +1,173 @@
+#ifndef SPLAT_QUEUE_HPP
+#define SPLAT_QUEUE_HPP
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstddef>
+#include <cstdlib>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+// Footprint of a splat: Disk covers cells within `radius` of the center,
+// Square covers the (2*radius+1)^2 block around the center cell.
+enum class SplatShape { Disk, Square };
+
+// A source injection into u_prev, v_prev and dens_prev. Every covered cell
+// gets the amounts scaled by max(0, 1 - falloff * (|di| + |dj|)).
+struct Splat {
+    float x, y;          // center in grid coordinates, interior is 1..N
+    float radius;
+    float du, dv;        // velocity added per cell
+    float density;       // density added per cell
+    float falloff = 0.0f;
+    SplatShape shape = SplatShape::Disk;
+};
+
+// Bounded multi-producer, single-consumer queue of splats. Any thread may
+// push (input callbacks, scripted sources); the solver drains it once per
+// step. Each slot carries a sequence number so producers only contend on
+// the tail counter and nobody takes a lock.
+class SplatQueue {
+public:
+    explicit SplatQueue(size_t capacity = 4096);
+
+    // Returns false, and counts the splat as dropped, when the queue is full.
+    bool push(const Splat& splat);
+    // Appends every queued splat to out; returns how many were taken.
+    size_t drain(std::vector<Splat>& out);
+
+    uint64_t dropped() const { return dropped_.load(std::memory_order_relaxed); }
+
+private:
+    struct Slot {
+        std::atomic<size_t> sequence;
+        Splat splat;
+    };
+
+    size_t mask_;
+    std::unique_ptr<Slot[]> slots_;
+    alignas(64) std::atomic<size_t> tail_{0};
+    alignas(64) size_t head_ = 0;
+    std::atomic<uint64_t> dropped_{0};
+};
+
+// Interior cells [minI, maxI] x [minJ, maxJ] a splat can touch on an n x n grid.
+void splat_bounds(int n, const Splat& s, int& minI, int& maxI, int& minJ, int& maxJ);
+
+// Calls add(i, j, weight) for every cell the splat covers on an n x n grid.
+// A disk's cells in a row form one run; its ends are estimated once per row
+// and then settled with the per-cell test, so coverage is exact.
+template <class F>
+void for_each_splat_ij(int n, const Splat& s, F&& add) {
+    int minI, maxI, minJ, maxJ;
+    splat_bounds(n, s, minI, maxI, minJ, maxJ);
+    if (minI > maxI) {
+        return;
+    }
+    const int ci = static_cast<int>(s.x);
+    const int cj = static_cast<int>(s.y);
+    for (int j = minJ; j <= maxJ; j++) {
+        int lo = minI, hi = maxI;
+        if (s.shape == SplatShape::Disk) {
+            const float dy = (j - s.y);
+            auto inside = [&](int i) {
+                float dx = (i - s.x);
+                return !(std::sqrt(dx * dx + dy * dy) > s.radius);
+            };
+            // The cell nearest the center is in the run if any cell is.
+            const int c = std::min(maxI, std::max(minI, static_cast<int>(std::lround(s.x))));
+            if (!inside(c)) {
+                continue;
+            }
+            const float half = std::sqrt(std::max(0.0f, s.radius * s.radius - dy * dy));
+            lo = std::min(c, std::max(minI, static_cast<int>(std::ceil(s.x - half))));
+            hi = std::max(c, std::min(maxI, static_cast<int>(std::floor(s.x + half))));
+            while (lo > minI && inside(lo - 1)) lo--;
+            while (!inside(lo)) lo++;
+            while (hi < maxI && inside(hi + 1)) hi++;
+            while (!inside(hi)) hi--;
+        }
+        const int dj = std::abs(j - cj);
+        for (int i = lo; i <= hi; i++) {
+            float weight = 1.0f;
+            if (s.falloff != 0.0f) {
+                weight = std::max(0.0f, 1.0f - s.falloff * (std::abs(i - ci) + dj));
+            }
+            add(i, j, weight);
+        }
+    }
+}
+
+// Calls add(index, weight) for every cell the splat covers, where index is
+// IX(i,j) on an n x n grid.
+template <class F>
+void for_each_splat_cell(int n, const Splat& s, F&& add) {
+    for_each_splat_ij(n, s, [&](int i, int j, float weight) { add(i + (n + 2) * j, weight); });
+}
+
+// Sums splats with the same footprint and center into one, so a burst of
+// events at one spot is stamped once.
+void merge_splats(std::vector<Splat>& splats);
+
+// Splats whose cell boxes overlap, stamped together: the union box
+// [minI, maxI] x [minJ, maxJ] and members[first, first + count).
+struct SplatGroup {
+    int minI, maxI, minJ, maxJ;
+    int first, count;
+};
+
+// Greedily groups overlapping splats, in order. A splat joins one of the
+// last few groups only if the union box has no more cells than the boxes it
+// replaces, so a group never touches more cells than its members would one
+// by one. Splats entirely off the grid are left out.
+void group_splats(int n, const std::vector<Splat>& splats, std::vector<SplatGroup>& groups,
+                  std::vector<int>& members);
+
+// Calls add(index, du, dv, density) once per cell a group of splats reaches,
+// with the group's amounts summed in a box-sized buffer first. A drag burst
+// of overlapping splats then reads and writes each source cell once.
+template <class F>
+void for_each_splat_sum(int n, const std::vector<Splat>& splats, F&& add) {
+    std::vector<SplatGroup> groups;
+    std::vector<int> members;
+    group_splats(n, splats, groups, members);
+    const int stride = n + 2;
+    std::vector<float> sum;
+    for (const SplatGroup& g : groups) {
+        const int w = g.maxI - g.minI + 1;
+        sum.assign(size_t(3) * w * (g.maxJ - g.minJ + 1), 0.0f);
+        for (int m = g.first; m < g.first + g.count; m++) {
+            const Splat& s = splats[members[m]];
+            for_each_splat_ij(n, s, [&](int i, int j, float weight) {
+                float* c = &sum[3 * ((j - g.minJ) * w + (i - g.minI))];
+                c[0] += s.du * weight;
+                c[1] += s.dv * weight;
+                c[2] += s.density * weight;
+            });
+        }
+        const float* c = sum.data();
+        for (int j = g.minJ; j <= g.maxJ; j++) {
+            for (int i = g.minI; i <= g.maxI; i++, c += 3) {
+                if (c[0] != 0.0f || c[1] != 0.0f || c[2] != 0.0f) {
+                    add(i + stride * j, c[0], c[1], c[2]);
+                }
+            }
+        }
+    }
+}
+
+// Merges the splats, then adds them to the source fields of an n x n grid,
+// given as row accessors (FloatRows or PackedRows).
+template <class Rows>
+void rasterize_splats(int n, std::vector<Splat>& splats, Rows u_prev, Rows v_prev,
+                      Rows dens_prev) {
+    merge_splats(splats);
+    for_each_splat_sum(n, splats, [&](int k, float du, float dv, float density) {
+        u_prev.set(k, u_prev[k] + du);
+        v_prev.set(k, v_prev[k] + dv);
+        dens_prev.set(k, dens_prev[k] + density);
+    });
+}
+
+#endif
@@ -0,0 +1,66 @@
+#include "step_control.hpp"
+#include "profiler.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+
+StepController::StepController(const StepControl& control) : control(control) {}
+
+StepReport StepController::advance(FluidSolver& solver, float frameDt) {
+    using clock = std::chrono::steady_clock;
+    ProfileScope scope("frame_substeps");
+    const auto start = clock::now();
+    auto elapsedMs = [&] {
+        return std::chrono::duration<double, std::milli>(clock::now() - start).count();
+    };
+    // Someone else changed the sweep count; take it as the new ceiling.
+    if (solver.params.iterations != iterations_) {
+        baseIterations_ = iterations_ = solver.params.iterations;
+    }
+
+    StepReport report;
+    report.iterations = iterations_;
+    float remaining = frameDt;
+    while (remaining > 0.0f) {
+        const float speed = solver.maxSpeed();
+        float dt = control.maxDt;
+        if (speed * dt * solver.n() > control.cfl) {
+            dt = control.cfl / (speed * solver.n());
+        }
+        int left = (int)std::min<double>(control.maxSubsteps - report.substeps,
+                                         std::ceil(remaining / dt));
+        left = std::max(1, left);
+        if (control.budgetMs > 0 && substepMs_ > 0) {
+            int affordable = (int)((control.budgetMs - elapsedMs()) / substepMs_);
+            if (affordable < left) {
+                left = std::max(1, affordable);
+                report.overBudget = true;
+            }
+        }
+        dt = left == 1 ? remaining : remaining / left;
+
+        auto t0 = clock::now();
+        solver.updateFluid(dt);
+        double ms = std::chrono::duration<double, std::milli>(clock::now() - t0).count();
+        substepMs_ = substepMs_ > 0 ? 0.8 * substepMs_ + 0.2 * ms : ms;
+
+        remaining = left == 1 ? 0.0f : remaining - dt;
+        report.substeps++;
+        report.dt = dt;
+        report.maxSpeed = std::max(report.maxSpeed, speed);
+    }
+    report.ms = elapsedMs();
+
+    // Sweeps for the next frame: back off quickly when over budget, recover
+    // one at a time once there is clear headroom.
+    if (control.budgetMs <= 0) {
+        iterations_ = baseIterations_;
+    } else if (report.overBudget || report.ms > control.budgetMs) {
+        int floor = std::min(control.minIterations, baseIterations_);
+        iterations_ = std::max(floor, iterations_ * 3 / 4);
+    } else if (report.ms < 0.6 * control.budgetMs && iterations_ < baseIterations_) {
+        iterations_++;
+    }
+    solver.params.iterations = iterations_;
+    return report;
+}
@@ -0,0 +1,43 @@
+#ifndef STEP_CONTROL_HPP
+#define STEP_CONTROL_HPP
+#include "fluid.hpp"
+
+struct StepControl {
+    // Largest distance in cells a backtrace may cover in one substep.
+    float cfl = 1.0f;
+    float maxDt = 0.01f;        // longest substep, however calm the flow
+    int maxSubsteps = 8;
+    // Wall-clock time a frame may take, 0 for no limit. Over budget the
+    // controller first lowers params.iterations towards minIterations, then
+    // takes fewer, longer substeps than the CFL limit asks for.
+    double budgetMs = 0.0;
+    int minIterations = 4;
+};
+
+struct StepReport {
+    int substeps = 0;
+    float dt = 0.0f;            // length of the last substep
+    float maxSpeed = 0.0f;      // fastest |(u,v)| the substeps were sized for
+    int iterations = 0;         // relaxation sweeps the substeps used
+    double ms = 0.0;
+    bool overBudget = false;    // substeps were merged to stay within budgetMs
+};
+
+// Advances a FluidSolver by a frame's worth of simulated time in CFL-limited
+// substeps. The speed comes from FluidSolver::maxSpeed(), which advect()
+// measures while it reads the velocity, so sizing a substep costs nothing.
+class StepController {
+public:
+    explicit StepController(const StepControl& control = StepControl());
+
+    StepReport advance(FluidSolver& solver, float frameDt);
+
+    StepControl control;
+
+private:
+    int baseIterations_ = 0;    // the solver's own setting
+    int iterations_ = 0;        // what the controller last set
+    double substepMs_ = 0.0;    // moving average cost of one substep
+};
+
+#endif
@@ -0,0 +1,82 @@
+#include "thread_pool.hpp"
+#include "profiler.hpp"
+
+ThreadPool::ThreadPool(int threads) {
+    for (int i = 1; i < threads; i++) {
+        workers_.emplace_back(&ThreadPool::workerLoop, this, i);
+    }
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stop_ = true;
+    }
+    start_.notify_all();
+    for (std::thread& t : workers_) {
+        t.join();
+    }
+}
+
+void ThreadPool::run(const std::function<void(int)>& task) {
+    if (workers_.empty()) {
+        task(0);
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        task_ = &task;
+        pending_ = (int)workers_.size();
+        generation_++;
+    }
+    start_.notify_all();
+    task(0);
+    std::unique_lock<std::mutex> lock(mutex_);
+    done_.wait(lock, [this] { return pending_ == 0; });
+    task_ = nullptr;
+}
+
+void ThreadPool::barrier() {
+    if (workers_.empty()) {
+        return;
+    }
+    unsigned phase = phase_.load(std::memory_order_acquire);
+    if (arrived_.fetch_add(1, std::memory_order_acq_rel) + 1 == size()) {
+        arrived_.store(0, std::memory_order_relaxed);
+        phase_.fetch_add(1, std::memory_order_release);
+        return;
+    }
+    // Sweeps between barriers are short, so spin briefly before yielding.
+    for (int spins = 0; phase_.load(std::memory_order_acquire) == phase; spins++) {
+        if (spins > 1000) {
+            std::this_thread::yield();
+        }
+    }
+}
+
+void ThreadPool::workerLoop(int index) {
+    profile_thread_name("pool worker");
+    uint64_t seen = 0;
+    for (;;) {
+        const std::function<void(int)>* task;
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            start_.wait(lock, [&] { return stop_ || generation_ != seen; });
+            if (stop_) {
+                return;
+            }
+            seen = generation_;
+            task = task_;
+        }
+        {
+            ProfileScope scope("pool_task");
+            (*task)(index);
+        }
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (--pending_ == 0) {
+                done_.notify_one();
+            }
+        }
+    }
+}
@@ -0,0 +1,48 @@
+#ifndef THREAD_POOL_HPP
+#define THREAD_POOL_HPP
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Persistent workers for the solver's parallel sweeps. run() hands the same
+// task to every worker (the calling thread is worker 0) and returns once all
+// of them finish; inside a task, barrier() synchronizes the workers.
+class ThreadPool {
+public:
+    explicit ThreadPool(int threads);
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    int size() const { return (int)workers_.size() + 1; }
+    void run(const std::function<void(int worker)>& task);
+    void barrier();
+
+private:
+    void workerLoop(int index);
+
+    std::vector<std::thread> workers_;
+    std::mutex mutex_;
+    std::condition_variable start_, done_;
+    const std::function<void(int)>* task_ = nullptr;
+    uint64_t generation_ = 0;
+    int pending_ = 0;
+    bool stop_ = false;
+
+    std::atomic<int> arrived_{0};
+    std::atomic<unsigned> phase_{0};
+};
+
+// Splits rows 1..n into `parts` contiguous bands and returns band `index`
+// as [first, last].
+inline void row_band(int n, int parts, int index, int& first, int& last) {
+    first = 1 + (int)((int64_t)n * index / parts);
+    last = (int)((int64_t)n * (index + 1) / parts);
+}
+
+#endif
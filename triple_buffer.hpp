@@ -0,0 +1,41 @@
+#ifndef TRIPLE_BUFFER_HPP
+#define TRIPLE_BUFFER_HPP
+#include <atomic>
+
+// Single-producer, single-consumer triple buffer. The writer fills back()
+// and publish()es it; the reader calls update() to take the most recent
+// published slot. Neither side ever blocks or waits for the other.
+template <class T>
+class TripleBuffer {
+public:
+    T& back() { return slots_[back_]; }
+    const T& front() const { return slots_[front_]; }
+
+    // Returns true if the previously published slot was never read.
+    bool publish() {
+        unsigned old = middle_.exchange(back_ | kFresh, std::memory_order_acq_rel);
+        back_ = old & kIndex;
+        return (old & kFresh) != 0;
+    }
+
+    // Returns true if front() now holds a slot that was not seen before.
+    bool update() {
+        if (!(middle_.load(std::memory_order_relaxed) & kFresh)) {
+            return false;
+        }
+        unsigned old = middle_.exchange(front_, std::memory_order_acq_rel);
+        front_ = old & kIndex;
+        return true;
+    }
+
+private:
+    static constexpr unsigned kIndex = 3;
+    static constexpr unsigned kFresh = 4;
+
+    T slots_[3];
+    unsigned back_ = 0;
+    unsigned front_ = 1;
+    std::atomic<unsigned> middle_{2};
+};
+
+#endif
@@ -1,11 +1,105 @@
 #ifndef UTILS_HPP
 #define UTILS_HPP
+#include <algorithm>
 #include <vector>
-#include <string>
+
+// Grid indexing. FixedN != 0 bakes the resolution into the kernel so strides
+// constant-fold; FixedN == 0 reads it from dynamicN at runtime.
+template <int FixedN>
+struct Grid {
+    int dynamicN;
+    int n() const { return FixedN ? FixedN : dynamicN; }
+    int stride() const { return n() + 2; }
+    int size() const { return stride() * stride(); }
+    int operator()(int i, int j) const { return i + stride() * j; }
+};
+
+// Row access to a solver field, so a kernel is written once for every
+// storage format: FloatRows here, PackedRows (packed_fields.hpp) for 16-bit
+// fields. A kernel asks for row j as fp32 and gets the field's own row here,
+// or a copy widened into the line buffer it passes (stride floats) there;
+// rows it wrote go back through store(), a no-op here. x[k] and set(k, f)
+// address single cells, k = IX(i,j).
+struct FloatRows {
+    float* data;
+    int stride;
+
+    float operator[](int k) const { return data[k]; }
+    void set(int k, float f) const { data[k] = f; }
+    // x[to] = x[from], negated if asked.
+    void mirror(int to, int from, bool negate) const {
+        data[to] = negate ? -data[from] : data[from];
+    }
+    // Row j, valid in cells [lo, hi] (all of it without them).
+    const float* row(int j, float*) const { return data + j * stride; }
+    const float* row(int j, float*, int, int) const { return data + j * stride; }
+    // Every other cell first, first + 2, ... up to last of row j, for rows
+    // another thread is writing the remaining cells of.
+    const float* alternate(int j, float*, int, int) const { return data + j * stride; }
+    // Row j for writing: edit() holds its current values (in [lo, hi] if
+    // given), out() may not.
+    float* edit(int j, float*) const { return data + j * stride; }
+    float* edit(int j, float*, int, int) const { return data + j * stride; }
+    float* out(int j, float*) const { return data + j * stride; }
+    // Writes cells [lo, hi], or every other one from first, of a row from
+    // edit() or out() back.
+    void store(int, const float*, int, int) const {}
+    void storeAlternate(int, const float*, int, int) const {}
+    // Copies cells [lo, hi] of row j to or from dst[0..hi-lo].
+    void read(int j, int lo, int hi, float* dst) const {
+        std::copy(data + j * stride + lo, data + j * stride + hi + 1, dst);
+    }
+    void write(int j, int lo, int hi, const float* src) const {
+        std::copy(src, src + hi - lo + 1, data + j * stride + lo);
+    }
+    // Zeroes cells [first, last].
+    void clear(int first, int last) const { std::fill(data + first, data + last + 1, 0.0f); }
+};
+
+template <class G, class R>
+void set_bnd(G IX, int b, R x) {
+    const int N = IX.n();
+    for (int i = 1; i <= N; i++) {
+        x.mirror(IX(0,i), IX(1,i), b == 1);
+        x.mirror(IX(N+1,i), IX(N,i), b == 1);
+        x.mirror(IX(i,0), IX(i,1), b == 2);
+        x.mirror(IX(i,N+1), IX(i,N), b == 2);
+    }
+    x.set(IX(0,0), 0.5f * (x[IX(1,0)] + x[IX(0,1)]));
+    x.set(IX(0,N+1), 0.5f * (x[IX(1,N+1)] + x[IX(0,N)]));
+    x.set(IX(N+1,0), 0.5f * (x[IX(N,0)] + x[IX(N+1,1)]));
+    x.set(IX(N+1,N+1), 0.5f * (x[IX(N,N+1)] + x[IX(N+1,N)]));
+}
+
+template <class G>
+void set_bnd(G IX, int b, float* x) {
+    set_bnd(IX, b, FloatRows{x, IX.stride()});
+}
+
+// Two line buffers of stride floats.
+template <class G, class R>
+void add_source(G IX, R x, R s, float dt, float* lines) {
+    const int S = IX.stride();
+    for (int j = 0; j < S; j++) {
+        float* row = x.edit(j, lines);
+        const float* src = s.row(j, lines + S);
+        for (int i = 0; i < S; i++) {
+            row[i] += dt * src[i];
+        }
+        x.store(j, row, 0, S - 1);
+    }
+}
+
+template <class G>
+void add_source(G IX, float* x, const float* s, float dt) {
+    const int size = IX.size();
+    for (int i = 0; i < size; i++) {
+        x[i] += dt * s[i];
+    }
+}
 
 void SWAP(std::vector<float>& x0, std::vector<float>& x);
-void set_bnd(int b, std::vector<float>& x);
-void add_source(std::vector<float>& x, std::vector<float>& s, float dt);
-void checkGLError(const std::string& place);
+void set_bnd(int n, int b, float* x);
+void add_source(int n, float* x, const float* s, float dt);
 
-#endif
\ No newline at end of file
+#endif